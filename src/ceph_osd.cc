@@ -358,11 +358,13 @@ int main(int argc, const char **argv)
   
   cluster_messenger->set_default_policy(Messenger::Policy::stateless_server(0, 0));
   cluster_messenger->set_policy(entity_name_t::TYPE_MON, Messenger::Policy::lossy_client(0,0));
-  cluster_messenger->set_policy(entity_name_t::TYPE_OSD,
-				Messenger::Policy::lossless_peer(supported,
-								 CEPH_FEATURE_UID |
-								 CEPH_FEATURE_PGID64 |
-								 CEPH_FEATURE_OSDENC));
+  Messenger::Policy osd_peer_policy =
+    Messenger::Policy::lossless_peer(supported,
+				     CEPH_FEATURE_UID |
+				     CEPH_FEATURE_PGID64 |
+				     CEPH_FEATURE_OSDENC);
+  osd_peer_policy.batch = true;  // coalesce small sub ops and replies
+  cluster_messenger->set_policy(entity_name_t::TYPE_OSD, osd_peer_policy);
   cluster_messenger->set_policy(entity_name_t::TYPE_CLIENT,
 				Messenger::Policy::stateless_server(0, 0));
 
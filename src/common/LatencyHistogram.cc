@@ -0,0 +1,73 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/LatencyHistogram.h"
+#include "common/Formatter.h"
+
+uint64_t LatencyHistogram::get_count() const
+{
+  uint64_t count = 0;
+  for (int i = 0; i < NUM_BUCKETS; i++)
+    count += buckets[i].read();
+  return count;
+}
+
+uint64_t LatencyHistogram::get_percentile(double pct) const
+{
+  uint64_t counts[NUM_BUCKETS];
+  uint64_t total = 0;
+  for (int i = 0; i < NUM_BUCKETS; i++) {
+    counts[i] = buckets[i].read();
+    total += counts[i];
+  }
+  if (!total)
+    return 0;
+
+  uint64_t target = (uint64_t)((double)total * pct / 100.0);
+  if (target >= total)
+    target = total - 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < NUM_BUCKETS; i++) {
+    seen += counts[i];
+    if (seen > target)
+      return bucket_limit(i);
+  }
+  return bucket_limit(NUM_BUCKETS - 1);
+}
+
+void LatencyHistogram::reset()
+{
+  for (int i = 0; i < NUM_BUCKETS; i++)
+    buckets[i].set(0);
+}
+
+void LatencyHistogram::dump(Formatter *f) const
+{
+  f->dump_unsigned("count", get_count());
+  f->dump_unsigned("p50_usec", get_percentile(50));
+  f->dump_unsigned("p99_usec", get_percentile(99));
+
+  // trailing empty buckets carry no information
+  int last = NUM_BUCKETS - 1;
+  while (last >= 0 && buckets[last].read() == 0)
+    last--;
+  f->open_array_section("buckets_usec");
+  for (int i = 0; i <= last; i++) {
+    f->open_object_section("bucket");
+    f->dump_unsigned("lt", bucket_limit(i));
+    f->dump_unsigned("count", buckets[i].read());
+    f->close_section();
+  }
+  f->close_section();
+}
@@ -0,0 +1,85 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_COMMON_LATENCYHISTOGRAM_H
+#define CEPH_COMMON_LATENCYHISTOGRAM_H
+
+#include "include/atomic.h"
+#include "include/utime.h"
+
+namespace ceph {
+  class Formatter;
+}
+
+/**
+ * power-of-two latency histogram
+ *
+ * Bucket 0 counts samples below 1us; bucket i counts samples in
+ * [2^(i-1), 2^i) us.  The last bucket also takes anything larger
+ * (about 17 minutes and up), including negative deltas from clock
+ * jumps.
+ *
+ * add() is a single atomic increment so the histogram can sit on a
+ * data path without a lock.  A concurrent dump() or reset() may miss
+ * or double count a sample in flight; that's fine for statistics.
+ */
+class LatencyHistogram {
+public:
+  static const int NUM_BUCKETS = 32;
+
+private:
+  atomic_t buckets[NUM_BUCKETS];
+
+  LatencyHistogram(const LatencyHistogram& other);
+  const LatencyHistogram& operator=(const LatencyHistogram& other);
+
+public:
+  LatencyHistogram() {}
+
+  static int bucket_for(uint64_t usec) {
+    int b = 0;
+    while (usec && b < NUM_BUCKETS - 1) {
+      usec >>= 1;
+      b++;
+    }
+    return b;
+  }
+
+  /// upper bound (exclusive), in usec, of bucket b
+  static uint64_t bucket_limit(int b) {
+    return 1ull << b;
+  }
+
+  void add_usec(uint64_t usec) {
+    buckets[bucket_for(usec)].inc();
+  }
+  void add(utime_t lat) {
+    add_usec((uint64_t)lat.sec() * 1000000ull + lat.usec());
+  }
+
+  uint64_t get_count() const;
+
+  /**
+   * estimate a percentile from the bucket counts
+   *
+   * @param pct percentile, 0..100
+   * @return upper bound of the bucket holding that sample, in usec
+   */
+  uint64_t get_percentile(double pct) const;
+
+  void reset();
+  void dump(ceph::Formatter *f) const;
+};
+
+#endif
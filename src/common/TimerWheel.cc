@@ -0,0 +1,188 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/TimerWheel.h"
+#include "common/Clock.h"
+#include "common/Thread.h"
+#include "common/config.h"
+#include "common/debug.h"
+#include "include/Context.h"
+
+#define dout_subsys ceph_subsys_timer
+#undef dout_prefix
+#define dout_prefix *_dout << "timerwheel(" << this << ")."
+
+class TimerWheelThread : public Thread {
+  TimerWheel *parent;
+public:
+  TimerWheelThread(TimerWheel *w) : parent(w) {}
+  void *entry() {
+    parent->timer_thread();
+    return NULL;
+  }
+};
+
+TimerWheel::TimerWheel(CephContext *cct_, Mutex &l, double tick, unsigned n)
+  : cct(cct_), lock(l),
+    tick_usec(MAX((uint64_t)(tick * 1000000.0), 1000ull)),
+    num_slots(MAX(n, 1u)),
+    slots(num_slots + 1),
+    cur_tick(0),
+    stopping(false),
+    thread(NULL)
+{
+}
+
+TimerWheel::~TimerWheel()
+{
+  assert(thread == NULL);
+}
+
+void TimerWheel::init()
+{
+  ldout(cct,10) << "init tick " << tick_usec << "us, " << num_slots << " slots" << dendl;
+  thread = new TimerWheelThread(this);
+  thread->create();
+}
+
+void TimerWheel::shutdown()
+{
+  ldout(cct,10) << "shutdown" << dendl;
+  if (thread) {
+    assert(lock.is_locked());
+    cancel_all_events();
+    stopping = true;
+    cond.Signal();
+    lock.Unlock();
+    thread->join();
+    lock.Lock();
+    delete thread;
+    thread = NULL;
+  }
+}
+
+void TimerWheel::add_event_after(double seconds, Context *callback)
+{
+  assert(lock.is_locked());
+  utime_t when = ceph_clock_now(cct);
+  when += seconds;
+  add_event_at(when, callback);
+}
+
+void TimerWheel::add_event_at(utime_t when, Context *callback)
+{
+  assert(lock.is_locked());
+  uint64_t usec = (uint64_t)when.sec() * 1000000ull + when.usec();
+  uint64_t tick = (usec + tick_usec - 1) / tick_usec;
+
+  bool was_empty = events.empty();
+  if (was_empty)
+    cur_tick = tick_of(ceph_clock_now(cct));
+  if (tick < cur_tick)
+    tick = cur_tick;
+
+  ldout(cct,10) << "add_event_at " << when << " (tick " << tick << ") -> "
+		<< callback << dendl;
+
+  unsigned slot = tick % num_slots;
+  slots[slot].push_back(Event(tick, callback));
+  Location loc;
+  loc.slot = slot;
+  loc.pos = --slots[slot].end();
+  /* If you hit this, you tried to insert the same Context* twice. */
+  assert(events.count(callback) == 0);
+  events[callback] = loc;
+
+  if (was_empty)
+    cond.Signal();
+}
+
+bool TimerWheel::cancel_event(Context *callback)
+{
+  assert(lock.is_locked());
+  __gnu_cxx::hash_map<Context*, Location, ContextHash>::iterator p =
+    events.find(callback);
+  if (p == events.end()) {
+    ldout(cct,10) << "cancel_event " << callback << " not found" << dendl;
+    return false;
+  }
+  ldout(cct,10) << "cancel_event " << callback << dendl;
+  slots[p->second.slot].erase(p->second.pos);
+  events.erase(p);
+  delete callback;
+  return true;
+}
+
+void TimerWheel::cancel_all_events()
+{
+  ldout(cct,10) << "cancel_all_events" << dendl;
+  assert(lock.is_locked());
+  for (unsigned i = 0; i <= num_slots; i++) {
+    for (std::list<Event>::iterator p = slots[i].begin(); p != slots[i].end(); ++p)
+      delete p->callback;
+    slots[i].clear();
+  }
+  events.clear();
+}
+
+void TimerWheel::_sweep(utime_t now)
+{
+  uint64_t now_tick = tick_of(now);
+  std::list<Event>& ready = slots[num_slots];
+
+  // one lap visits every slot, so a late wakeup never needs more
+  for (unsigned n = 0; cur_tick <= now_tick && n < num_slots; n++, cur_tick++) {
+    std::list<Event>& slot = slots[cur_tick % num_slots];
+    for (std::list<Event>::iterator p = slot.begin(); p != slot.end(); ) {
+      std::list<Event>::iterator q = p++;
+      if (q->tick > now_tick)
+	continue;  // a later lap
+      events[q->callback].slot = num_slots;
+      ready.splice(ready.end(), slot, q);  // iterators stay valid
+    }
+  }
+  if (cur_tick <= now_tick)
+    cur_tick = now_tick + 1;
+
+  // callbacks may drop the lock, and others may cancel what's still ready
+  while (!ready.empty()) {
+    Context *callback = ready.front().callback;
+    ready.pop_front();
+    events.erase(callback);
+    ldout(cct,10) << "timer_thread executing " << callback << dendl;
+    callback->finish(0);
+    delete callback;
+  }
+}
+
+void TimerWheel::timer_thread()
+{
+  lock.Lock();
+  ldout(cct,10) << "timer_thread starting" << dendl;
+  while (!stopping) {
+    if (!events.empty())
+      _sweep(ceph_clock_now(cct));
+
+    if (events.empty()) {
+      cond.Wait(lock);
+    } else {
+      // sleep until the next tick boundary
+      utime_t next;
+      next.set_from_double((double)(cur_tick * tick_usec) / 1000000.0);
+      cond.WaitUntil(lock, next);
+    }
+  }
+  ldout(cct,10) << "timer_thread exiting" << dendl;
+  lock.Unlock();
+}
@@ -0,0 +1,112 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_COMMON_TIMERWHEEL_H
+#define CEPH_COMMON_TIMERWHEEL_H
+
+#include <list>
+#include <vector>
+#include <ext/hash_map>
+
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "include/utime.h"
+
+class CephContext;
+class Context;
+class TimerWheelThread;
+
+/**
+ * hashed timing wheel
+ *
+ * A drop-in for SafeTimer when there are many timeouts that are
+ * usually cancelled before they fire (watch and notify timeouts,
+ * heartbeat grace periods).  Events hash into one of num_slots lists
+ * by the tick they expire on, so adding and cancelling are O(1)
+ * instead of a multimap insert/erase.  The price is resolution: an
+ * event fires on the first tick at or after its deadline, up to
+ * tick seconds late, and the thread wakes every tick while anything
+ * is scheduled.
+ *
+ * Locking is as for SafeTimer: add/cancel are called with the lock
+ * held, and callbacks run with it held.  A callback may drop and
+ * retake the lock.
+ */
+class TimerWheel
+{
+  TimerWheel(const TimerWheel &rhs);
+  TimerWheel& operator=(const TimerWheel &rhs);
+
+  struct Event {
+    uint64_t tick;  ///< first tick at or after the deadline
+    Context *callback;
+    Event(uint64_t t, Context *c) : tick(t), callback(c) {}
+  };
+  struct Location {
+    unsigned slot;  ///< num_slots for the ready list
+    std::list<Event>::iterator pos;
+  };
+  struct ContextHash {
+    size_t operator()(const Context *c) const {
+      return (size_t)c;
+    }
+  };
+
+  CephContext *cct;
+  Mutex& lock;
+  Cond cond;
+  uint64_t tick_usec;
+  unsigned num_slots;
+  /// num_slots wheel slots, then the list of events being fired
+  std::vector<std::list<Event> > slots;
+  __gnu_cxx::hash_map<Context*, Location, ContextHash> events;
+  uint64_t cur_tick;  ///< next tick to sweep
+  bool stopping;
+
+  friend class TimerWheelThread;
+  TimerWheelThread *thread;
+
+  uint64_t tick_of(utime_t t) const {
+    return ((uint64_t)t.sec() * 1000000ull + t.usec()) / tick_usec;
+  }
+  void _sweep(utime_t now);
+  void timer_thread();
+
+public:
+  /**
+   * @param tick resolution, in seconds
+   * @param num_slots wheel size; deadlines further out than
+   *        tick * num_slots just take more than one lap
+   */
+  TimerWheel(CephContext *cct, Mutex &l, double tick, unsigned num_slots = 512);
+  ~TimerWheel();
+
+  /// start the thread; call with the lock UNLOCKED
+  void init();
+  /// cancel everything and stop the thread; call with the lock LOCKED
+  void shutdown();
+
+  void add_event_after(double seconds, Context *callback);
+  void add_event_at(utime_t when, Context *callback);
+
+  /// @return true if the callback was cancelled (and deleted)
+  bool cancel_event(Context *callback);
+  void cancel_all_events();
+
+  unsigned get_num_events() const {
+    return events.size();
+  }
+};
+
+#endif
@@ -23,7 +23,68 @@
 
 class TrackedOp {
 public:
-  virtual void mark_event(const string &event) = 0;
+  /**
+   * Events an op can record.  Ops store the id and a timestamp, so
+   * marking an event allocates nothing; get_event_name() gives the
+   * name shown when ops are dumped.
+   */
+  enum event_t {
+    EVENT_NONE = 0,
+    EVENT_HEADER_READ,
+    EVENT_THROTTLED,
+    EVENT_ALL_READ,
+    EVENT_DISPATCHED,
+    EVENT_WAITING_FOR_OSDMAP,
+    EVENT_QUEUED_FOR_PG,
+    EVENT_REACHED_PG,
+    EVENT_STARTED,
+    EVENT_SUB_OP_SENT,
+    EVENT_TXN_SUBMITTED,
+    EVENT_COMMIT_QUEUED_FOR_JOURNAL_WRITE,
+    EVENT_COMMIT_BLOCKED_BY_JOURNAL_FULL,
+    EVENT_WRITE_THREAD_IN_JOURNAL_BUFFER,
+    EVENT_JOURNALED_COMPLETION_QUEUED,
+    EVENT_OP_APPLIED,
+    EVENT_OP_COMMIT,
+    EVENT_SUB_OP_APPLIED_REC,
+    EVENT_SUB_OP_COMMIT_REC,
+    EVENT_SUB_OP_APPLIED,
+    EVENT_SUB_OP_COMMIT,
+    EVENT_REPLY_SENT,
+    EVENT_DONE,
+    NUM_EVENTS
+  };
+
+  static const char *get_event_name(int e) {
+    switch (e) {
+    case EVENT_NONE: return "none";
+    case EVENT_HEADER_READ: return "header_read";
+    case EVENT_THROTTLED: return "throttled";
+    case EVENT_ALL_READ: return "all_read";
+    case EVENT_DISPATCHED: return "dispatched";
+    case EVENT_WAITING_FOR_OSDMAP: return "waiting_for_osdmap";
+    case EVENT_QUEUED_FOR_PG: return "queued_for_pg";
+    case EVENT_REACHED_PG: return "reached_pg";
+    case EVENT_STARTED: return "started";
+    case EVENT_SUB_OP_SENT: return "sub_op_sent";
+    case EVENT_TXN_SUBMITTED: return "txn_submitted";
+    case EVENT_COMMIT_QUEUED_FOR_JOURNAL_WRITE: return "commit_queued_for_journal_write";
+    case EVENT_COMMIT_BLOCKED_BY_JOURNAL_FULL: return "commit_blocked_by_journal_full";
+    case EVENT_WRITE_THREAD_IN_JOURNAL_BUFFER: return "write_thread_in_journal_buffer";
+    case EVENT_JOURNALED_COMPLETION_QUEUED: return "journaled_completion_queued";
+    case EVENT_OP_APPLIED: return "op_applied";
+    case EVENT_OP_COMMIT: return "op_commit";
+    case EVENT_SUB_OP_APPLIED_REC: return "sub_op_applied_rec";
+    case EVENT_SUB_OP_COMMIT_REC: return "sub_op_commit_rec";
+    case EVENT_SUB_OP_APPLIED: return "sub_op_applied";
+    case EVENT_SUB_OP_COMMIT: return "sub_op_commit";
+    case EVENT_REPLY_SENT: return "reply_sent";
+    case EVENT_DONE: return "done";
+    default: return "???";
+    }
+  }
+
+  virtual void mark_event(event_t event) = 0;
   virtual ~TrackedOp() {}
 };
 typedef std::tr1::shared_ptr<TrackedOp> TrackedOpRef;
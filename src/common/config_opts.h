@@ -99,6 +99,9 @@ OPTION(ms_bind_ipv6, OPT_BOOL, false)
 OPTION(ms_rwthread_stack_bytes, OPT_U64, 1024 << 10)
 OPTION(ms_tcp_read_timeout, OPT_U64, 900)
 OPTION(ms_inject_socket_failures, OPT_U64, 0)
+OPTION(ms_latency_stats, OPT_BOOL, true)  // keep per-connection and per-peer-type latency histograms
+OPTION(ms_batch_max_msgs, OPT_INT, 16)  // max messages per MMsgBatch, for Policy::batch peers (<2 disables)
+OPTION(ms_batch_max_bytes, OPT_U64, 16384)  // only batch messages with at most this much data
 OPTION(mon_data, OPT_STR, "/var/lib/ceph/mon/$cluster-$id")
 OPTION(mon_initial_members, OPT_STR, "")    // list of initial cluster mon ids; if specified, need majority to form initial quorum and create new cluster
 OPTION(mon_sync_fs_threshold, OPT_INT, 5)   // sync() when writing this many objects; 0 to disable.
@@ -122,6 +125,7 @@ OPTION(mon_osd_full_ratio, OPT_FLOAT, .95) // what % full makes an OSD "full"
 OPTION(mon_osd_nearfull_ratio, OPT_FLOAT, .85) // what % full makes an OSD near full
 OPTION(mon_globalid_prealloc, OPT_INT, 100)   // how many globalids to prealloc
 OPTION(mon_osd_report_timeout, OPT_INT, 900)    // grace period before declaring unresponsive OSDs dead
+OPTION(mon_osd_pg_mappings, OPT_BOOL, true)  // precompute pg -> osd mappings for the current osdmap
 OPTION(mon_force_standby_active, OPT_BOOL, true) // should mons force standby-replay mds to be active
 OPTION(mon_min_osdmap_epochs, OPT_INT, 500)
 OPTION(mon_max_pgmap_epochs, OPT_INT, 500)
@@ -175,6 +179,7 @@ OPTION(objecter_mon_retry_interval, OPT_DOUBLE, 5.0)
 OPTION(objecter_timeout, OPT_DOUBLE, 10.0)    // before we ask for a map
 OPTION(objecter_inflight_op_bytes, OPT_U64, 1024*1024*100) // max in-flight data (both directions)
 OPTION(objecter_inflight_ops, OPT_U64, 1024)               // max in-flight ios
+OPTION(objecter_pg_mappings, OPT_BOOL, false)  // precompute pg -> osd mappings for each map
 OPTION(journaler_allow_split_entries, OPT_BOOL, true)
 OPTION(journaler_write_head_interval, OPT_INT, 15)
 OPTION(journaler_prefetch_periods, OPT_INT, 10)   // * journal object size
@@ -282,16 +287,22 @@ OPTION(osd_pool_default_size, OPT_INT, 2)
 OPTION(osd_pool_default_pg_num, OPT_INT, 8)
 OPTION(osd_pool_default_pgp_num, OPT_INT, 8)
 OPTION(osd_map_dedup, OPT_BOOL, true)
+OPTION(osd_map_pg_mappings, OPT_BOOL, false)  // precompute pg -> osd mappings for each map we process; costs crush for every pg in the cluster per map
 OPTION(osd_map_cache_size, OPT_INT, 500)
 OPTION(osd_map_cache_bl_size, OPT_INT, 50)
 OPTION(osd_map_cache_bl_inc_size, OPT_INT, 100)
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
 OPTION(osd_op_threads, OPT_INT, 2)    // 0 == no threading
+OPTION(osd_peering_threads, OPT_INT, 2)  // advance pgs through new maps and peer
+OPTION(osd_peering_wq_batch_size, OPT_U64, 20)  // pgs a peering thread takes at a time
+OPTION(osd_op_num_shards, OPT_INT, 2)  // op queue shards; osd_op_threads are split among them
 OPTION(osd_disk_threads, OPT_INT, 1)
+OPTION(osd_load_pgs_threads, OPT_INT, 4)   // threads reading pg state/logs at startup
 OPTION(osd_recovery_threads, OPT_INT, 1)
 OPTION(osd_recover_clone_overlap, OPT_BOOL, true)   // preserve clone_overlap during recovery/migration
 OPTION(osd_backfill_scan_min, OPT_INT, 64)
 OPTION(osd_backfill_scan_max, OPT_INT, 512)
+OPTION(osd_snap_trim_batch, OPT_INT, 16)   // clones trimmed per pass; the next batch waits for the last to apply
 OPTION(osd_op_thread_timeout, OPT_INT, 30)
 OPTION(osd_backlog_thread_timeout, OPT_INT, 60*60*1)
 OPTION(osd_recovery_thread_timeout, OPT_INT, 30)
@@ -305,10 +316,13 @@ OPTION(osd_age_time, OPT_INT, 0)
 OPTION(osd_heartbeat_addr, OPT_ADDR, entity_addr_t())
 OPTION(osd_heartbeat_interval, OPT_INT, 6)       // (seconds) how often we ping peers
 OPTION(osd_heartbeat_grace, OPT_INT, 20)         // (seconds) how long before we decide a peer has failed
+OPTION(osd_heartbeat_timer_tick, OPT_DOUBLE, .5)  // resolution of heartbeat grace deadlines, in seconds
 OPTION(osd_mon_heartbeat_interval, OPT_INT, 30)  // (seconds) how often to ping monitor if no peers
 OPTION(osd_mon_report_interval_max, OPT_INT, 120)
 OPTION(osd_mon_report_interval_min, OPT_INT, 5)  // pg stats, failures, up_thru, boot.
 OPTION(osd_mon_ack_timeout, OPT_INT, 30) // time out a mon if it doesn't ack stats
+OPTION(osd_mon_report_backoff, OPT_BOOL, true) // hold pg stats while the last report is unacked, up to osd_mon_report_interval_max
+OPTION(osd_pg_stat_delta, OPT_BOOL, true) // send pg stats relative to what the mon last acked, when it can
 OPTION(osd_min_down_reporters, OPT_INT, 1)   // number of OSDs who need to report a down OSD for it to count
 OPTION(osd_min_down_reports, OPT_INT, 3)     // number of times a down OSD must be reported for it to count
 OPTION(osd_default_data_pool_replay_window, OPT_INT, 45)
@@ -316,18 +330,43 @@ OPTION(osd_preserve_trimmed_log, OPT_BOOL, false)
 OPTION(osd_auto_mark_unfound_lost, OPT_BOOL, false)
 OPTION(osd_recovery_delay_start, OPT_FLOAT, 15)
 OPTION(osd_recovery_max_active, OPT_INT, 5)
+OPTION(osd_recovery_max_active_per_pg, OPT_INT, 3) // 0 = only osd_recovery_max_active applies
+OPTION(osd_replica_reads, OPT_BOOL, true)  // serve balanced/localized reads on replicas
+OPTION(osd_pg_object_context_cache_count, OPT_INT, 64)  // unreferenced obcs kept per (primary) pg
 OPTION(osd_recovery_max_chunk, OPT_U64, 1<<20)  // max size of push chunk
+OPTION(osd_pg_log_max_dirty_extents, OPT_INT, 16)  // extents recorded per log entry for delta pushes; 0 = always push whole objects
 OPTION(osd_recovery_forget_lost_objects, OPT_BOOL, false)   // off for now
+OPTION(osd_sched_client_weight, OPT_DOUBLE, 60)    // relative shares of disk cost between work classes
+OPTION(osd_sched_recovery_weight, OPT_DOUBLE, 20)
+OPTION(osd_sched_scrub_weight, OPT_DOUBLE, 10)
+OPTION(osd_sched_snaptrim_weight, OPT_DOUBLE, 10)
+OPTION(osd_sched_client_reservation, OPT_U64, 0)   // cost/sec always admitted for a class (0 = none)
+OPTION(osd_sched_recovery_reservation, OPT_U64, 4<<20)
+OPTION(osd_sched_scrub_reservation, OPT_U64, 0)
+OPTION(osd_sched_snaptrim_reservation, OPT_U64, 0)
+OPTION(osd_sched_op_cost, OPT_U64, 64<<10)   // cost of one IO, in bytes, on top of the bytes moved
+OPTION(osd_sched_recovery_op_bytes, OPT_U64, 4<<20)  // bytes charged per recovery op started
+OPTION(osd_sched_burst, OPT_U64, 16<<20)     // cost a class may run ahead of the others
+OPTION(osd_sched_idle, OPT_DOUBLE, .5)       // seconds without work before a class restarts level with the others
+OPTION(osd_sched_max_wait, OPT_DOUBLE, 1)    // longest a unit of work waits for its share
 OPTION(osd_max_scrubs, OPT_INT, 1)
 OPTION(osd_scrub_load_threshold, OPT_FLOAT, 0.5)
 OPTION(osd_scrub_min_interval, OPT_FLOAT, 300)
 OPTION(osd_scrub_max_interval, OPT_FLOAT, 60*60*24)   // once a day
+OPTION(osd_scrub_chunky, OPT_BOOL, true)     // scrub in hash range chunks, if replicas support it
+OPTION(osd_scrub_chunk_min, OPT_INT, 5)      // objects per chunk, at least
+OPTION(osd_scrub_chunk_max, OPT_INT, 25)     // objects per chunk, at most (unless they share a hash)
+OPTION(osd_deep_scrub, OPT_BOOL, false)      // chunky scrubs also read and checksum object data
+OPTION(osd_deep_scrub_stride, OPT_INT, 512<<10) // read size while deep scrubbing
+OPTION(osd_deep_scrub_bandwidth, OPT_U64, 32<<20) // bytes/sec of deep scrub reads per pg; 0 = unlimited
+OPTION(osd_scrub_chunk_defer, OPT_DOUBLE, .1) // seconds to hold the next chunk back while scrub is over its share
 OPTION(osd_auto_weight, OPT_BOOL, false)
 OPTION(osd_class_dir, OPT_STR, CEPH_LIBDIR "/rados-classes") // where rados plugins are stored
 OPTION(osd_check_for_log_corruption, OPT_BOOL, false)
 OPTION(osd_use_stale_snap, OPT_BOOL, false)
 OPTION(osd_rollback_to_cluster_snap, OPT_STR, "")
 OPTION(osd_default_notify_timeout, OPT_U32, 30) // default notify timeout in seconds
+OPTION(osd_watch_timer_tick, OPT_DOUBLE, .1) // resolution of watch and notify timeouts, in seconds
 OPTION(osd_kill_backfill_at, OPT_INT, 0)
 OPTION(osd_min_pg_log_entries, OPT_U32, 1000) // number of entries to keep in the pg log when trimming it
 OPTION(osd_op_complaint_time, OPT_FLOAT, 30) // how many seconds old makes an op complaint-worthy
@@ -340,6 +379,7 @@ OPTION(osd_debug_drop_pg_create_probability, OPT_DOUBLE, 0)
 OPTION(osd_debug_drop_pg_create_duration, OPT_INT, 1)
 OPTION(osd_op_history_size, OPT_U32, 20)    // Max number of completed ops to track
 OPTION(osd_op_history_duration, OPT_U32, 600) // Oldest completed op to track
+OPTION(osd_op_latency_stats, OPT_BOOL, true)  // keep per op type, per phase latency histograms
 OPTION(osd_target_transaction_size, OPT_INT, 300)     // to adjust various transactions that batch smaller items
 OPTION(filestore, OPT_BOOL, false)
 OPTION(filestore_debug_omap_check, OPT_BOOL, 0) // Expensive debugging check on sync
@@ -23,6 +23,10 @@
 #define CEPH_FEATURE_QUERY_T        (1<<16)
 #define CEPH_FEATURE_INDEP_PG_MAP   (1<<17)
 #define CEPH_FEATURE_CRUSH_TUNABLES (1<<18)
+#define CEPH_FEATURE_MSG_BATCH      (1<<19)
+#define CEPH_FEATURE_CHUNKY_SCRUB   (1<<20)
+#define CEPH_FEATURE_RECOVERY_DELTA (1<<21)
+#define CEPH_FEATURE_PGSTAT_DELTA   (1<<22)
 
 /*
  * Features supported.  Should be everything above.
@@ -46,7 +50,11 @@
 	 CEPH_FEATURE_QUERY_T |		 \
 	 CEPH_FEATURE_MONENC |		 \
 	 CEPH_FEATURE_INDEP_PG_MAP |	 \
-	 CEPH_FEATURE_CRUSH_TUNABLES)
+	 CEPH_FEATURE_CRUSH_TUNABLES |	 \
+	 CEPH_FEATURE_MSG_BATCH |	 \
+	 CEPH_FEATURE_CHUNKY_SCRUB |	 \
+	 CEPH_FEATURE_RECOVERY_DELTA |	 \
+	 CEPH_FEATURE_PGSTAT_DELTA)
 
 #define CEPH_FEATURES_SUPPORTED_DEFAULT  CEPH_FEATURES_ALL
 
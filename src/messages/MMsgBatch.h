@@ -0,0 +1,73 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MMSGBATCH_H
+#define CEPH_MMSGBATCH_H
+
+#include "msg/Message.h"
+
+/*
+ * MMsgBatch
+ *
+ * Several small messages queued back to back on a Pipe, sent as one.
+ * The Pipe writer builds these for peers whose Policy allows batching
+ * (and who advertise CEPH_FEATURE_MSG_BATCH); the reader unpacks them
+ * and queues the inner messages for dispatch in order, so dispatchers
+ * never see an MMsgBatch.
+ */
+class MMsgBatch : public Message {
+public:
+  /// messages to encode; we hold a ref until encode_payload()
+  list<Message*> pending;
+  /// encoded messages, as produced by encode_message()
+  vector<bufferlist> msgs;
+
+  MMsgBatch() : Message(MSG_MSGR_BATCH) {}
+private:
+  ~MMsgBatch() {
+    for (list<Message*>::iterator p = pending.begin(); p != pending.end(); ++p)
+      (*p)->put();
+  }
+
+public:
+  /// take ownership of m's ref
+  void add(Message *m) {
+    pending.push_back(m);
+  }
+  unsigned get_num_msgs() const {
+    return pending.size() + msgs.size();
+  }
+
+  const char *get_type_name() const { return "msg_batch"; }
+  void print(ostream& out) const {
+    out << "msg_batch(" << get_num_msgs() << " msgs)";
+  }
+
+  void encode_payload(uint64_t features) {
+    while (!pending.empty()) {
+      Message *m = pending.front();
+      pending.pop_front();
+      msgs.push_back(bufferlist());
+      encode_message(m, features, msgs.back());
+      m->put();
+    }
+    ::encode(msgs, payload);
+  }
+  void decode_payload() {
+    bufferlist::iterator p = payload.begin();
+    ::decode(msgs, p);
+  }
+};
+
+#endif
@@ -17,6 +17,7 @@
 #define CEPH_MOSDOP_H
 
 #include "msg/Message.h"
+#include "msg/MessageSlab.h"
 #include "osd/osd_types.h"
 #include "include/ceph_features.h"
 
@@ -110,6 +111,7 @@ public:
       rmw_flags(flags) {
     set_tid(tid);
   }
+  MESSAGE_SLAB_ALLOCATED(MOSDOp)
 private:
   ~MOSDOp() {}
 
@@ -17,6 +17,7 @@
 #define CEPH_MOSDOPREPLY_H
 
 #include "msg/Message.h"
+#include "msg/MessageSlab.h"
 
 #include "MOSDOp.h"
 #include "os/ObjectStore.h"
@@ -109,6 +110,7 @@ public:
     for (unsigned i = 0; i < ops.size(); i++)
       ops[i].op.payload_len = 0;
   }
+  MESSAGE_SLAB_ALLOCATED(MOSDOpReply)
 private:
   ~MOSDOpReply() {}
 
@@ -20,25 +20,41 @@
 
 /*
  * instruct an OSD initiate a replica scrub on a specific PG
+ *
+ * A chunky request asks for the map of objects in [start, end) only,
+ * built once the replica has applied scrub_to.
  */
 
 struct MOSDRepScrub : public Message {
 
-  static const int HEAD_VERSION = 2;
+  static const int HEAD_VERSION = 3;
 
   pg_t pgid;             // PG to scrub
   eversion_t scrub_from; // only scrub log entries after scrub_from
   eversion_t scrub_to;   // last_update_applied when message sent
   epoch_t map_epoch;
+  bool chunky;           // true for chunky scrubs
+  hobject_t start;       // lower bound of scrub, inclusive
+  hobject_t end;         // upper bound of scrub, exclusive
 
-  MOSDRepScrub() : Message(MSG_OSD_REP_SCRUB, HEAD_VERSION) { }
+  MOSDRepScrub() : Message(MSG_OSD_REP_SCRUB, HEAD_VERSION), chunky(false) { }
   MOSDRepScrub(pg_t pgid, eversion_t scrub_from, eversion_t scrub_to,
 	       epoch_t map_epoch)
     : Message(MSG_OSD_REP_SCRUB, HEAD_VERSION),
       pgid(pgid),
       scrub_from(scrub_from),
       scrub_to(scrub_to),
-      map_epoch(map_epoch) { }
+      map_epoch(map_epoch),
+      chunky(false) { }
+  MOSDRepScrub(pg_t pgid, eversion_t scrub_to, epoch_t map_epoch,
+	       hobject_t start, hobject_t end)
+    : Message(MSG_OSD_REP_SCRUB, HEAD_VERSION),
+      pgid(pgid),
+      scrub_to(scrub_to),
+      map_epoch(map_epoch),
+      chunky(true),
+      start(start),
+      end(end) { }
   
 private:
   ~MOSDRepScrub() {}
@@ -49,6 +65,8 @@ public:
     out << "replica scrub(pg: ";
     out << pgid << ",from:" << scrub_from << ",to:" << scrub_to
 	<< "epoch:" << map_epoch;
+    if (chunky)
+      out << ",chunky:" << start << "-" << end;
     out << ")";
   }
 
@@ -57,6 +75,9 @@ public:
     ::encode(scrub_from, payload);
     ::encode(scrub_to, payload);
     ::encode(map_epoch, payload);
+    ::encode(chunky, payload);
+    ::encode(start, payload);
+    ::encode(end, payload);
   }
   void decode_payload() {
     bufferlist::iterator p = payload.begin();
@@ -64,6 +85,13 @@ public:
     ::decode(scrub_from, p);
     ::decode(scrub_to, p);
     ::decode(map_epoch, p);
+    if (header.version >= 3) {
+      ::decode(chunky, p);
+      ::decode(start, p);
+      ::decode(end, p);
+    } else {
+      chunky = false;
+    }
   }
 };
 
@@ -17,6 +17,7 @@
 #define CEPH_MOSDSUBOP_H
 
 #include "msg/Message.h"
+#include "msg/MessageSlab.h"
 #include "osd/osd_types.h"
 
 /*
@@ -25,7 +26,7 @@
 
 class MOSDSubOp : public Message {
 
-  static const int HEAD_VERSION = 7;
+  static const int HEAD_VERSION = 8;
   static const int COMPAT_VERSION = 1;
 
 public:
@@ -62,6 +63,7 @@ public:
 
   // piggybacked osd/og state
   eversion_t pg_trim_to;   // primary->replica: trim to here
+  eversion_t pg_committed_to;  // primary->replica: committed on all replicas to here
   osd_peer_stat_t peer_stat;
 
   map<string,bufferptr> attrset;
@@ -137,6 +139,8 @@ public:
       ::decode(omap_entries, p);
     if (header.version >= 6)
       ::decode(omap_header, p);
+    if (header.version >= 8)
+      ::decode(pg_committed_to, p);
 
     if (header.version < 7) {
       // Handle hobject_t format change
@@ -188,6 +192,7 @@ public:
     ::encode(current_progress, payload);
     ::encode(omap_entries, payload);
     ::encode(omap_header, payload);
+    ::encode(pg_committed_to, payload);
   }
 
   MOSDSubOp()
@@ -208,6 +213,7 @@ public:
     memset(&peer_stat, 0, sizeof(peer_stat));
     set_tid(rtid);
   }
+  MESSAGE_SLAB_ALLOCATED(MOSDSubOp)
 private:
   ~MOSDSubOp() {}
 
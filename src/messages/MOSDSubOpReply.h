@@ -17,6 +17,7 @@
 #define CEPH_MOSDSUBOPREPLY_H
 
 #include "msg/Message.h"
+#include "msg/MessageSlab.h"
 
 #include "MOSDSubOp.h"
 #include "os/ObjectStore.h"
@@ -123,6 +124,7 @@ public:
     set_tid(req->get_tid());
   }
   MOSDSubOpReply() : Message(MSG_OSD_SUBOPREPLY) {}
+  MESSAGE_SLAB_ALLOCATED(MOSDSubOpReply)
 private:
   ~MOSDSubOpReply() {}
 
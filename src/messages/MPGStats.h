@@ -17,18 +17,30 @@
 
 #include "osd/osd_types.h"
 #include "messages/PaxosServiceMessage.h"
+#include "include/ceph_features.h"
 
 class MPGStats : public PaxosServiceMessage {
+  static const int HEAD_VERSION = 2;  // pg_stat_delta
+
 public:
   uuid_d fsid;
+  /*
+   * The sender fills pg_stat for every pg, and pg_stat_delta for those
+   * that can be sent relative to what the mon last acked.  Peers with
+   * CEPH_FEATURE_PGSTAT_DELTA get the deltas in place of those pgs'
+   * full stats; after decoding, pg_stat holds only the pgs that were
+   * sent in full.
+   */
   map<pg_t,pg_stat_t> pg_stat;
+  map<pg_t,pg_stat_delta_t> pg_stat_delta;
   osd_stat_t osd_stat;
   epoch_t epoch;
   utime_t had_map_for;
   
-  MPGStats() : PaxosServiceMessage(MSG_PGSTATS, 0) {}
+  MPGStats() : PaxosServiceMessage(MSG_PGSTATS, 0, HEAD_VERSION) {}
   MPGStats(const uuid_d& f, epoch_t e, utime_t had) : 
-    PaxosServiceMessage(MSG_PGSTATS, e), fsid(f), epoch(e), had_map_for(had) {}
+    PaxosServiceMessage(MSG_PGSTATS, e, HEAD_VERSION),
+    fsid(f), epoch(e), had_map_for(had) {}
 
 private:
   ~MPGStats() {};
@@ -36,16 +48,40 @@ private:
 public:
   const char *get_type_name() const { return "pg_stats"; }
   void print(ostream& out) const {
-    out << "pg_stats(" << pg_stat.size() << " pgs tid " << get_tid() << " v " << version << ")";
+    out << "pg_stats(" << pg_stat.size() << " pgs";
+    if (!pg_stat_delta.empty())
+      out << ", " << pg_stat_delta.size() << " deltas";
+    out << " tid " << get_tid() << " v " << version << ")";
   }
 
   void encode_payload(uint64_t features) {
     paxos_encode();
     ::encode(fsid, payload);
     ::encode(osd_stat, payload);
-    ::encode(pg_stat, payload);
+    if (features & CEPH_FEATURE_PGSTAT_DELTA) {
+      header.version = HEAD_VERSION;
+      // same layout as the map, minus the pgs we have deltas for
+      __u32 n = 0;
+      for (map<pg_t,pg_stat_t>::const_iterator q = pg_stat.begin(); q != pg_stat.end(); ++q)
+	if (!pg_stat_delta.count(q->first))
+	  n++;
+      ::encode(n, payload);
+      for (map<pg_t,pg_stat_t>::const_iterator q = pg_stat.begin(); q != pg_stat.end(); ++q) {
+	if (pg_stat_delta.count(q->first))
+	  continue;
+	::encode(q->first, payload);
+	::encode(q->second, payload);
+      }
+    } else {
+      // a peon expands deltas before forwarding to an old leader (see
+      // PGMonitor::preprocess_pg_stats), so there are none left here
+      header.version = 1;
+      ::encode(pg_stat, payload);
+    }
     ::encode(epoch, payload);
     ::encode(had_map_for, payload);
+    if (features & CEPH_FEATURE_PGSTAT_DELTA)
+      ::encode(pg_stat_delta, payload);
   }
   void decode_payload() {
     bufferlist::iterator p = payload.begin();
@@ -55,6 +91,8 @@ public:
     ::decode(pg_stat, p);
     ::decode(epoch, p);
     ::decode(had_map_for, p);
+    if (header.version >= 2)
+      ::decode(pg_stat_delta, p);
   }
 };
 
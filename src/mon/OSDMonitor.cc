@@ -105,6 +105,8 @@ void OSDMonitor::update_from_paxos()
     dout(7) << "update_from_paxos loading latest full map e" << v << dendl;
     osdmap.decode(latest);
   } 
+  if (g_conf->mon_osd_pg_mappings && !osdmap.have_pg_mappings())
+    osdmap.build_pg_mappings();
   
   // walk through incrementals
   bufferlist bl;
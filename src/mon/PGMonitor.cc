@@ -398,6 +398,29 @@ bool PGMonitor::preprocess_pg_stats(MPGStats *stats)
       stats->epoch < mon->osdmon()->osdmap.get_epoch())
     mon->osdmon()->send_latest_now_nodelete(stats, stats->epoch+1);
 
+  // A leader without pgstat deltas would drop them when we forward, so
+  // expand them here against our committed pg_map.  Anything we can't
+  // expand gets a zero-version ack so the osd resends it in full.
+  if (!stats->pg_stat_delta.empty() && mon->is_peon()) {
+    Connection *con = mon->messenger->get_connection(mon->monmap->get_inst(mon->get_leader()));
+    bool leader_has_deltas = con->has_feature(CEPH_FEATURE_PGSTAT_DELTA);
+    con->put();
+    if (!leader_has_deltas) {
+      dout(10) << " leader lacks pgstat deltas, expanding " << stats->pg_stat_delta.size()
+	       << " deltas before forwarding" << dendl;
+      set<pg_t> no_base;
+      expand_pg_stat_deltas(stats, &no_base);
+      if (!no_base.empty()) {
+	MPGStatsAck *ack = new MPGStatsAck;
+	// tid 0: the leader's ack is the one that flushes this report
+	ack->set_tid(0);
+	for (set<pg_t>::iterator p = no_base.begin(); p != no_base.end(); ++p)
+	  ack->pg_stat[*p] = eversion_t();
+	mon->send_reply(stats, ack);
+      }
+    }
+  }
+
   // Always forward the PGStats to the leader, even if they are the same as
   // the old PGStats. The leader will mark as down osds that haven't sent
   // PGStats for a few minutes.
@@ -426,6 +449,44 @@ bool PGMonitor::pg_stats_have_changed(int from, const MPGStats *stats) const
   return false;
 }
 
+void PGMonitor::expand_pg_stat_deltas(MPGStats *stats, set<pg_t> *no_base)
+{
+  for (map<pg_t,pg_stat_delta_t>::iterator p = stats->pg_stat_delta.begin();
+       p != stats->pg_stat_delta.end();
+       ++p) {
+    pg_t pgid = p->first;
+    const pg_stat_t *base = NULL;
+    map<pg_t,pg_stat_t>::const_iterator q = pending_inc.pg_stat_updates.end();
+    if (mon->is_leader())  // a peon only has the committed map
+      q = pending_inc.pg_stat_updates.find(pgid);
+    if (q != pending_inc.pg_stat_updates.end()) {
+      base = &q->second;
+    } else {
+      hash_map<pg_t,pg_stat_t>::const_iterator r = pg_map.pg_stat.find(pgid);
+      if (r != pg_map.pg_stat.end())
+	base = &r->second;
+    }
+    if (!base || base->reported != p->second.base_reported) {
+      dout(15) << " delta for " << pgid << " from " << p->second.base_reported
+	       << " but have " << (base ? base->reported : eversion_t()) << dendl;
+      no_base->insert(pgid);
+      continue;
+    }
+    // we mark pgs stale or creating ourselves without bumping reported,
+    // so the osd's copy of the base no longer matches ours
+    if (base->state & (PG_STATE_STALE | PG_STATE_CREATING)) {
+      dout(15) << " delta for " << pgid << " but base is "
+	       << pg_state_string(base->state) << dendl;
+      no_base->insert(pgid);
+      continue;
+    }
+    pg_stat_t& s = stats->pg_stat[pgid];
+    s = *base;
+    p->second.apply(s);
+  }
+  stats->pg_stat_delta.clear();
+}
+
 bool PGMonitor::prepare_pg_stats(MPGStats *stats) 
 {
   dout(10) << "prepare_pg_stats " << *stats << " from " << stats->get_orig_source() << dendl;
@@ -447,14 +508,21 @@ bool PGMonitor::prepare_pg_stats(MPGStats *stats)
     return false;
   }
       
+  // a zero version in the ack tells the osd to send those in full
+  set<pg_t> no_base;
+  expand_pg_stat_deltas(stats, &no_base);
+
   if (!pg_stats_have_changed(from, stats)) {
     dout(10) << " message contains no new osd|pg stats" << dendl;
     MPGStatsAck *ack = new MPGStatsAck;
+    ack->set_tid(stats->get_tid());
     for (map<pg_t,pg_stat_t>::const_iterator p = stats->pg_stat.begin();
 	 p != stats->pg_stat.end();
 	 ++p) {
       ack->pg_stat[p->first] = p->second.reported;
     }
+    for (set<pg_t>::iterator p = no_base.begin(); p != no_base.end(); ++p)
+      ack->pg_stat[*p] = eversion_t();
     mon->send_reply(stats, ack);
     stats->put();
     return false;
@@ -483,6 +551,8 @@ bool PGMonitor::prepare_pg_stats(MPGStats *stats)
   // pg stats
   MPGStatsAck *ack = new MPGStatsAck;
   ack->set_tid(stats->get_tid());
+  for (set<pg_t>::iterator p = no_base.begin(); p != no_base.end(); ++p)
+    ack->pg_stat[*p] = eversion_t();
   for (map<pg_t,pg_stat_t>::iterator p = stats->pg_stat.begin();
        p != stats->pg_stat.end();
        p++) {
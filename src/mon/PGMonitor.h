@@ -61,6 +61,8 @@ private:
 
   bool preprocess_pg_stats(MPGStats *stats);
   bool pg_stats_have_changed(int from, const MPGStats *stats) const;
+  /// rebuild full stats from deltas; no_base gets the pgs we can't
+  void expand_pg_stat_deltas(MPGStats *stats, set<pg_t> *no_base);
   bool prepare_pg_stats(MPGStats *stats);
   void _updated_stats(MPGStats *req, MPGStatsAck *ack);
 
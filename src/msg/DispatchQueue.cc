@@ -251,8 +251,24 @@ void DispatchQueue::entry()
 		     << " " << m->get_footer().data_crc << ")"
 		     << " " << m << " con " << m->get_connection()
 		     << dendl;
+	// hold the Connection; ms_dispatch may drop the last message ref
+	Connection *lcon = NULL;
+	utime_t start;
+	if (m->get_connection() && m->get_connection()->get_latency()) {
+	  lcon = m->get_connection()->get();
+	  start = ceph_clock_now(cct);
+	  if (m->get_recv_complete_stamp() != utime_t())
+	    note_latency(lcon, msgr_latency_t::DISPATCH_Q,
+			 start - m->get_recv_complete_stamp());
+	}
+
 	msgr->ms_deliver_dispatch(m);
 
+	if (lcon) {
+	  note_latency(lcon, msgr_latency_t::DISPATCH, ceph_clock_now(cct) - start);
+	  lcon->put();
+	}
+
 	msgr->dispatch_throttle_release(msize);
 
 	ldout(cct,20) << "done calling dispatch on " << m << dendl;
@@ -266,6 +282,14 @@ void DispatchQueue::entry()
   lock.Unlock();
 }
 
+void DispatchQueue::note_latency(Connection *con, int which, utime_t lat)
+{
+  con->get_latency()->add(which, lat);
+  msgr_latency_t *l = msgr->get_peer_type_latency(con->get_peer_type());
+  if (l)
+    l->add(which, lat);
+}
+
 void DispatchQueue::start()
 {
   assert(!stop);
@@ -154,6 +154,9 @@ struct DispatchQueue {
     lock.Unlock();
   }
 
+  /// account a dispatch-side latency sample to con and its peer type
+  void note_latency(Connection *con, int which, utime_t lat);
+
   void start();
   void entry();
   void wait();
@@ -141,12 +141,42 @@ using namespace std;
 
 #include "messages/MWatchNotify.h"
 
+#include "messages/MMsgBatch.h"
+
 #include "common/config.h"
 
 #define DEBUGLVL  10    // debug level of output
 
 #define dout_subsys ceph_subsys_ms
 
+const char *msgr_latency_t::get_name(int i)
+{
+  switch (i) {
+  case OUT_Q: return "out_q";
+  case SEND: return "send";
+  case THROTTLE: return "throttle";
+  case RECV: return "recv";
+  case DISPATCH_Q: return "dispatch_q";
+  case DISPATCH: return "dispatch";
+  default: return "unknown";
+  }
+}
+
+void msgr_latency_t::reset()
+{
+  for (int i = 0; i < NUM; i++)
+    hist[i].reset();
+}
+
+void msgr_latency_t::dump(Formatter *f) const
+{
+  for (int i = 0; i < NUM; i++) {
+    f->open_object_section(get_name(i));
+    hist[i].dump(f);
+    f->close_section();
+  }
+}
+
 void intrusive_ptr_add_ref(Message *p)
 {
   p->get();
@@ -372,6 +402,10 @@ Message *decode_message(CephContext *cct, ceph_msg_header& header, ceph_msg_foot
     m = new MOSDSubOpReply();
     break;
 
+  case MSG_MSGR_BATCH:
+    m = new MMsgBatch();
+    break;
+
   case CEPH_MSG_OSD_MAP:
     m = new MOSDMap;
     break;
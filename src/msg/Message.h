@@ -24,6 +24,7 @@
 #include "msg_types.h"
 
 #include "common/RefCountedObj.h"
+#include "common/LatencyHistogram.h"
 
 #include "common/debug.h"
 #include "common/config.h"
@@ -93,6 +94,10 @@
 #define MSG_COMMAND            97
 #define MSG_COMMAND_REPLY      98
 
+// *** messenger internal ***
+
+#define MSG_MSGR_BATCH             0x600
+
 // *** MDS ***
 
 #define MSG_MDS_BEACON             100  // to monitor
@@ -141,6 +146,33 @@
 
 // ======================================================
 
+/**
+ * messenger latency histograms
+ *
+ * Kept per Connection and per peer type when ms_latency_stats is
+ * enabled, so a slow peer can be broken down into time spent queued,
+ * on the wire, throttled, and waiting for or inside dispatch.
+ */
+struct msgr_latency_t {
+  enum {
+    OUT_Q,       ///< queued on the Pipe until the writer picks it up
+    SEND,        ///< encode and write to the socket
+    THROTTLE,    ///< reader blocked on the policy and dispatch throttlers
+    RECV,        ///< reading the front/middle/data off the socket
+    DISPATCH_Q,  ///< fully read until the dispatch thread picks it up
+    DISPATCH,    ///< inside ms_dispatch
+    NUM
+  };
+  LatencyHistogram hist[NUM];
+
+  static const char *get_name(int i);
+  void add(int i, utime_t lat) {
+    hist[i].add(lat);
+  }
+  void reset();
+  void dump(ceph::Formatter *f) const;
+};
+
 // abstract Connection, for keeping per-connection state
 
 
@@ -156,6 +188,8 @@ struct Connection : public RefCountedObject {
   int rx_buffers_version;
   map<tid_t,pair<bufferlist,int> > rx_buffers;
 
+  msgr_latency_t *latency;  ///< NULL unless ms_latency_stats is set
+
 public:
   Connection()
     : lock("Connection::lock"),
@@ -164,7 +198,8 @@ public:
       features(0),
       pipe(NULL),
       failed(false),
-      rx_buffers_version(0) {
+      rx_buffers_version(0),
+      latency(NULL) {
   }
   ~Connection() {
     //generic_dout(0) << "~Connection " << this << dendl;
@@ -174,8 +209,17 @@ public:
     }
     if (pipe)
       pipe->put();
+    delete latency;
   }
 
+  /// allocate latency histograms; once set, they live as long as we do
+  void enable_latency() {
+    Mutex::Locker l(lock);
+    if (!latency)
+      latency = new msgr_latency_t;
+  }
+  msgr_latency_t *get_latency() { return latency; }
+
   Connection *get() {
     return (Connection *)RefCountedObject::get();
   }
@@ -279,6 +323,8 @@ protected:
   utime_t throttle_stamp;
   /* time at which message was fully read */
   utime_t recv_complete_stamp;
+  /* time at which an outgoing message was queued on its Pipe */
+  utime_t queue_stamp;
 
   Connection *connection;
 
@@ -293,20 +339,26 @@ protected:
   // currently throttled.
   uint64_t dispatch_throttle_size;
 
+  // link for the lock-free list of messages handed to Pipe::send()
+  Message *out_next;
+
   friend class Messenger;
+  friend class Pipe;
 
 public:
   Message()
     : connection(NULL),
       throttler(NULL),
-      dispatch_throttle_size(0) {
+      dispatch_throttle_size(0),
+      out_next(NULL) {
     memset(&header, 0, sizeof(header));
     memset(&footer, 0, sizeof(footer));
   };
   Message(int t, int version=1, int compat_version=0)
     : connection(NULL),
       throttler(NULL),
-      dispatch_throttle_size(0) {
+      dispatch_throttle_size(0),
+      out_next(NULL) {
     memset(&header, 0, sizeof(header));
     header.type = t;
     header.version = version;
@@ -399,6 +451,8 @@ public:
   const utime_t& get_throttle_stamp() const { return throttle_stamp; }
   void set_recv_complete_stamp(utime_t t) { recv_complete_stamp = t; }
   const utime_t& get_recv_complete_stamp() const { return recv_complete_stamp; }
+  void set_queue_stamp(utime_t t) { queue_stamp = t; }
+  const utime_t& get_queue_stamp() const { return queue_stamp; }
 
   void calc_header_crc() {
     header.crc = ceph_crc32c_le(0, (unsigned char*)&header,
@@ -0,0 +1,134 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MSG_MESSAGESLAB_H
+#define CEPH_MSG_MESSAGESLAB_H
+
+#include <new>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "include/atomic.h"
+#include "common/simple_spin.h"
+
+/**
+ * MessageSlab
+ *
+ * A per-type free list of raw Message storage.  The hot OSD message
+ * types (MOSDOp, MOSDOpReply, MOSDSubOp, MOSDSubOpReply) are created
+ * and destroyed once per client op; routing their operator new/delete
+ * through here lets the memory of a message whose last ref was put()
+ * be handed to the next message of the same type instead of going back
+ * to the heap.
+ *
+ * Only allocations of exactly sizeof(T) are cached, so a subclass that
+ * inherits the operators falls through to the global allocator.  At
+ * most MAX_FREE chunks are kept per type; anything beyond that is
+ * freed.
+ */
+template <class T, unsigned MAX_FREE=1024>
+class MessageSlab {
+  struct chunk_t {
+    chunk_t *next;
+  };
+
+  static simple_spinlock_t lock;
+  static chunk_t *free_list;
+  static unsigned num_free;
+
+  static atomic_t num_alloc;  ///< allocations served by the heap
+  static atomic_t num_reuse;  ///< allocations served by the free list
+
+public:
+  static void *alloc(size_t size) {
+    if (size == sizeof(T)) {
+      simple_spin_lock(&lock);
+      chunk_t *c = free_list;
+      if (c) {
+	free_list = c->next;
+	num_free--;
+      }
+      simple_spin_unlock(&lock);
+      if (c) {
+	num_reuse.inc();
+	return c;
+      }
+    }
+    num_alloc.inc();
+    return ::operator new(size < sizeof(chunk_t) ? sizeof(chunk_t) : size);
+  }
+
+  static void release(void *p, size_t size) {
+    if (!p)
+      return;
+    if (size == sizeof(T)) {
+      chunk_t *c = static_cast<chunk_t*>(p);
+      simple_spin_lock(&lock);
+      if (num_free < MAX_FREE) {
+	c->next = free_list;
+	free_list = c;
+	num_free++;
+	c = NULL;
+      }
+      simple_spin_unlock(&lock);
+      if (!c)
+	return;
+    }
+    ::operator delete(p);
+  }
+
+  /// free all cached chunks
+  static void trim() {
+    simple_spin_lock(&lock);
+    chunk_t *c = free_list;
+    free_list = NULL;
+    num_free = 0;
+    simple_spin_unlock(&lock);
+    while (c) {
+      chunk_t *next = c->next;
+      ::operator delete(c);
+      c = next;
+    }
+  }
+
+  static unsigned get_num_free() { return num_free; }
+  static uint64_t get_num_alloc() { return num_alloc.read(); }
+  static uint64_t get_num_reuse() { return num_reuse.read(); }
+};
+
+template <class T, unsigned MAX_FREE>
+simple_spinlock_t MessageSlab<T, MAX_FREE>::lock = SIMPLE_SPINLOCK_INITIALIZER;
+template <class T, unsigned MAX_FREE>
+typename MessageSlab<T, MAX_FREE>::chunk_t *MessageSlab<T, MAX_FREE>::free_list = NULL;
+template <class T, unsigned MAX_FREE>
+unsigned MessageSlab<T, MAX_FREE>::num_free = 0;
+template <class T, unsigned MAX_FREE>
+atomic_t MessageSlab<T, MAX_FREE>::num_alloc;
+template <class T, unsigned MAX_FREE>
+atomic_t MessageSlab<T, MAX_FREE>::num_reuse;
+
+/**
+ * Declare class-specific operator new/delete for a Message type so that
+ * instances are carved from MessageSlab<type>.  Use inside the class body.
+ */
+#define MESSAGE_SLAB_ALLOCATED(type)					\
+  public:								\
+  static void *operator new(size_t size) {				\
+    return MessageSlab<type>::alloc(size);				\
+  }									\
+  static void operator delete(void *p, size_t size) {			\
+    MessageSlab<type>::release(p, size);				\
+  }
+
+#endif
@@ -68,6 +68,8 @@ public:
     bool standby;
     /// If true, we will try to detect session resets
     bool resetcheck;
+    /// If true, small messages queued back to back may be sent as one MMsgBatch
+    bool batch;
     /**
      *  The throttler is used to limit how much data is held by Messages from
      *  the associated Connection(s). When reading in a new Message, the Messenger
@@ -81,12 +83,14 @@ public:
     uint64_t features_required;
 
     Policy()
-      : lossy(false), server(false), standby(false), resetcheck(true), throttler(NULL),
+      : lossy(false), server(false), standby(false), resetcheck(true), batch(false),
+	throttler(NULL),
 	features_supported(CEPH_FEATURES_SUPPORTED_DEFAULT),
 	features_required(0) {}
   private:
     Policy(bool l, bool s, bool st, bool r, uint64_t sup, uint64_t req)
-      : lossy(l), server(s), standby(st), resetcheck(r), throttler(NULL),
+      : lossy(l), server(s), standby(st), resetcheck(r), batch(false),
+	throttler(NULL),
 	features_supported(sup | CEPH_FEATURES_SUPPORTED_DEFAULT),
 	features_required(req) {}
 
@@ -22,6 +22,8 @@
 #include "Pipe.h"
 #include "SimpleMessenger.h"
 
+#include "messages/MMsgBatch.h"
+
 #include "common/debug.h"
 #include "common/errno.h"
 
@@ -52,7 +54,9 @@ Pipe::Pipe(SimpleMessenger *r, int st, Connection *con)
     pipe_lock("SimpleMessenger::Pipe::pipe_lock"),
     state(st),
     connection_state(NULL),
+    peer_type_latency(NULL),
     reader_running(false), reader_joining(false), writer_running(false),
+    out_incoming(NULL),
     in_q(r->dispatch_queue.create_queue(this)),
     keepalive(false),
     close_on_empty(false),
@@ -65,6 +69,8 @@ Pipe::Pipe(SimpleMessenger *r, int st, Connection *con)
     connection_state = new Connection();
     connection_state->pipe = get();
   }
+  if (msgr->cct->_conf->ms_latency_stats)
+    connection_state->enable_latency();
   msgr->timeout = msgr->cct->_conf->ms_tcp_read_timeout * 1000; //convert to ms
   if (msgr->timeout == 0)
     msgr->timeout = -1;
@@ -74,6 +80,7 @@ Pipe::~Pipe()
 {
   in_q->put();
   assert(out_q.empty());
+  assert(!out_incoming);
   assert(sent.empty());
   if (connection_state)
     connection_state->put();
@@ -98,6 +105,131 @@ void Pipe::handle_ack(uint64_t seq)
   }
 }
 
+void Pipe::set_peer_type(int t)
+{
+  peer_type = t;
+  connection_state->set_peer_type(t);
+  peer_type_latency = msgr->get_peer_type_latency(t);
+}
+
+void Pipe::send(Message *m)
+{
+  if (connection_state->get_latency())
+    m->set_queue_stamp(ceph_clock_now(msgr->cct));
+
+  Message *head;
+  do {
+    head = out_incoming;
+    m->out_next = head;
+  } while (!__sync_bool_compare_and_swap(&out_incoming, head, m));
+
+  // The writer only sleeps after finding out_incoming empty under
+  // pipe_lock, so only the push that makes it non-empty has to wake it.
+  if (!head) {
+    pipe_lock.Lock();
+    cond.Signal();
+    pipe_lock.Unlock();
+  }
+}
+
+void Pipe::_take_out_incoming()
+{
+  assert(pipe_lock.is_locked());
+  Message *m;
+  do {
+    m = out_incoming;
+  } while (m && !__sync_bool_compare_and_swap(&out_incoming, m, (Message*)NULL));
+
+  // the stack is newest first; reverse it to preserve send order
+  Message *rev = NULL;
+  while (m) {
+    Message *next = m->out_next;
+    m->out_next = rev;
+    rev = m;
+    m = next;
+  }
+  while (rev) {
+    Message *next = rev->out_next;
+    rev->out_next = NULL;
+    out_q[rev->get_priority()].push_back(rev);
+    rev = next;
+  }
+}
+
+void Pipe::queue_received_batch(MMsgBatch *b)
+{
+  assert(pipe_lock.is_locked());
+  ldout(msgr->cct,20) << "reader unpacking " << *b << dendl;
+
+  // the inner messages take over the envelope's share of the throttlers
+  for (vector<bufferlist>::iterator p = b->msgs.begin(); p != b->msgs.end(); ++p) {
+    bufferlist::iterator q = p->begin();
+    Message *m = decode_message(msgr->cct, q);
+    if (!m) {
+      ldout(msgr->cct,0) << "reader got bad message in " << *b << ", discarding" << dendl;
+      assert(!msgr->cct->_conf->ms_die_on_bad_msg);
+      continue;
+    }
+    uint64_t size = m->get_payload().length() + m->get_middle().length() +
+      m->get_data().length();
+    if (policy.throttler) {
+      policy.throttler->take(size);
+      m->set_throttler(policy.throttler);
+    }
+    msgr->dispatch_throttler.take(size);
+    m->set_dispatch_throttle_size(size);
+    m->set_recv_stamp(b->get_recv_stamp());
+    m->set_throttle_stamp(b->get_throttle_stamp());
+    m->set_recv_complete_stamp(b->get_recv_complete_stamp());
+    m->set_connection(connection_state->get());
+    ldout(msgr->cct,10) << "reader got batched message " << m << " " << *m << dendl;
+    queue_received(m);
+  }
+
+  msgr->dispatch_throttle_release(b->get_dispatch_throttle_size());
+  b->put();
+}
+
+bool Pipe::_can_batch(Message *m)
+{
+  return m->get_type() != MSG_MSGR_BATCH &&
+    m->get_data().length() <= msgr->cct->_conf->ms_batch_max_bytes;
+}
+
+Message *Pipe::_batch_outgoing(Message *m)
+{
+  int max = msgr->cct->_conf->ms_batch_max_msgs;
+  if (!policy.batch || max < 2 ||
+      !connection_state->has_feature(CEPH_FEATURE_MSG_BATCH) ||
+      !_can_batch(m))
+    return m;
+
+  map<int, list<Message*> >::iterator p = out_q.find(m->get_priority());
+  if (p == out_q.end() || p->second.empty() || !_can_batch(p->second.front()))
+    return m;
+
+  MMsgBatch *b = new MMsgBatch;
+  b->set_priority(m->get_priority());
+  b->get_header().src = m->get_header().src;
+  b->set_queue_stamp(m->get_queue_stamp());
+  b->add(m);
+  while ((int)b->get_num_msgs() < max &&
+	 !p->second.empty() &&
+	 _can_batch(p->second.front())) {
+    b->add(p->second.front());
+    p->second.pop_front();
+  }
+  if (p->second.empty())
+    out_q.erase(p);
+
+  // associate inner messages with the Connection, as the writer does
+  for (list<Message*>::iterator q = b->pending.begin(); q != b->pending.end(); ++q)
+    (*q)->set_connection(connection_state->get());
+
+  ldout(msgr->cct,20) << "writer batched " << b->get_num_msgs() << " messages into " << b << dendl;
+  return b;
+}
+
 void Pipe::start_reader()
 {
   assert(pipe_lock.is_locked());
@@ -476,6 +608,7 @@ int Pipe::accept()
 
     // steal outgoing queue and out_seq
     existing->requeue_sent();
+    existing->_take_out_incoming();
     out_seq = existing->out_seq;
     ldout(msgr->cct,10) << "accept re-queuing on out_seq " << out_seq << " in_seq " << in_seq << dendl;
     for (map<int, list<Message*> >::iterator p = existing->out_q.begin();
@@ -918,6 +1051,7 @@ void Pipe::unregister_pipe()
 
 void Pipe::requeue_sent(uint64_t max_acked)
 {
+  _take_out_incoming();
   if (sent.empty())
     return;
 
@@ -942,6 +1076,7 @@ void Pipe::requeue_sent(uint64_t max_acked)
 void Pipe::discard_out_queue()
 {
   ldout(msgr->cct,10) << "discard_queue" << dendl;
+  _take_out_incoming();
 
   for (list<Message*>::iterator p = sent.begin(); p != sent.end(); p++) {
     if (*p < (void *) DispatchQueue::D_NUM_CODES) {
@@ -1176,7 +1311,10 @@ void Pipe::reader()
       ldout(msgr->cct,10) << "reader got message "
 	       << m->get_seq() << " " << m << " " << *m
 	       << dendl;
-      queue_received(m);
+      if (m->get_type() == MSG_MSGR_BATCH)
+	queue_received_batch((MMsgBatch*)m);
+      else
+	queue_received(m);
     } 
     
     else if (tag == CEPH_MSGR_TAG_CLOSE) {
@@ -1275,7 +1413,15 @@ void Pipe::writer()
 
       // grab outgoing message
       Message *m = _get_next_outgoing();
+      if (m)
+	m = _batch_outgoing(m);
       if (m) {
+	utime_t send_start;
+	if (connection_state->get_latency()) {
+	  send_start = ceph_clock_now(msgr->cct);
+	  if (m->get_queue_stamp() != utime_t())
+	    note_latency(msgr_latency_t::OUT_Q, send_start - m->get_queue_stamp());
+	}
 	m->set_seq(++out_seq);
 	if (!policy.lossy || close_on_empty) {
 	  // put on sent list
@@ -1294,6 +1440,8 @@ void Pipe::writer()
 
         ldout(msgr->cct,20) << "writer sending " << m->get_seq() << " " << m << dendl;
 	int rc = write_message(m);
+	if (send_start != utime_t())
+	  note_latency(msgr_latency_t::SEND, ceph_clock_now(msgr->cct) - send_start);
 
 	pipe_lock.Lock();
 	if (rc < 0) {
@@ -1537,6 +1685,9 @@ int Pipe::read_message(Message **pm)
   message->set_throttle_stamp(throttle_stamp);
   message->set_recv_complete_stamp(ceph_clock_now(msgr->cct));
 
+  note_latency(msgr_latency_t::THROTTLE, throttle_stamp - recv_stamp);
+  note_latency(msgr_latency_t::RECV, message->get_recv_complete_stamp() - throttle_stamp);
+
   *pm = message;
   return 0;
 
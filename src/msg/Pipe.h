@@ -21,6 +21,7 @@
 class SimpleMessenger;
 class IncomingQueue;
 class DispatchQueue;
+class MMsgBatch;
 
   /**
    * The Pipe is the most complex SimpleMessenger component. It gets
@@ -104,12 +105,24 @@ class DispatchQueue;
     friend class SimpleMessenger;
     Connection *connection_state;
 
+    /// histograms shared by all Pipes to our peer type; may be NULL
+    msgr_latency_t *peer_type_latency;
+
     utime_t backoff;         // backoff time
 
     bool reader_running, reader_joining;
     bool writer_running;
 
     map<int, list<Message*> > out_q;  // priority queue for outbound msgs
+
+    /**
+     * Messages handed to send() are pushed onto this lock-free stack
+     * (linked through Message::out_next) so senders need not take
+     * pipe_lock.  Anyone holding pipe_lock moves them into out_q with
+     * _take_out_incoming() before looking at out_q.
+     */
+    Message * volatile out_incoming;
+    void _take_out_incoming();
     IncomingQueue *in_q;
     list<Message*> sent;
     Cond cond;
@@ -176,9 +189,15 @@ class DispatchQueue;
       queue_received(m, m->get_priority());
     }
 
+    /// unpack an MMsgBatch and queue its messages for dispatch
+    void queue_received_batch(MMsgBatch *b);
+
     __u32 get_out_seq() { return out_seq; }
 
-    bool is_queued() { return !out_q.empty() || keepalive; }
+    bool is_queued() {
+      _take_out_incoming();
+      return !out_q.empty() || keepalive;
+    }
 
     entity_addr_t& get_peer_addr() { return peer_addr; }
 
@@ -187,9 +206,15 @@ class DispatchQueue;
         peer_addr = a;
       connection_state->set_peer_addr(a);
     }
-    void set_peer_type(int t) {
-      peer_type = t;
-      connection_state->set_peer_type(t);
+    void set_peer_type(int t);
+
+    /// account a latency sample to our Connection and peer type
+    void note_latency(int which, utime_t lat) {
+      msgr_latency_t *l = connection_state->get_latency();
+      if (l)
+	l->add(which, lat);
+      if (peer_type_latency)
+	peer_type_latency->add(which, lat);
     }
 
     void register_pipe();
@@ -202,21 +227,24 @@ class DispatchQueue;
     }
     void stop();
 
-    void send(Message *m) {
-      pipe_lock.Lock();
-      _send(m);
-      pipe_lock.Unlock();
-    }
-    void _send(Message *m) {
-      out_q[m->get_priority()].push_back(m);
-      cond.Signal();
-    }
+    /// queue a message for the writer; does not take pipe_lock
+    void send(Message *m);
     void _send_keepalive() {
       keepalive = true;
       cond.Signal();
     }
+    bool _can_batch(Message *m);
+    /**
+     * if policy allows, pull more messages queued right behind m (at the
+     * same priority) and return them with m as one MMsgBatch.
+     *
+     * @return m, or an MMsgBatch holding m and its followers
+     */
+    Message *_batch_outgoing(Message *m);
+
     Message *_get_next_outgoing() {
       Message *m = 0;
+      _take_out_incoming();
       while (!m && !out_q.empty()) {
         map<int, list<Message*> >::reverse_iterator p = out_q.rbegin();
         if (!p->second.empty()) {
@@ -22,6 +22,8 @@
 #include "common/config.h"
 #include "common/Timer.h"
 #include "common/errno.h"
+#include "common/admin_socket.h"
+#include "common/Formatter.h"
 
 #define dout_subsys ceph_subsys_ms
 #undef dout_prefix
@@ -48,12 +50,21 @@ SimpleMessenger::SimpleMessenger(CephContext *cct, entity_name_t name,
     cluster_protocol(0),
     policy_lock("SimpleMessenger::policy_lock"),
     dispatch_throttler(cct, string("msgr_dispatch_throttler-") + mname, cct->_conf->ms_dispatch_throttle_bytes),
+    mname(mname),
+    latency_hook(NULL),
     reaper_started(false), reaper_stop(false),
     timeout(0),
     local_connection(new Connection)
 {
   pthread_spin_init(&global_seq_lock, PTHREAD_PROCESS_PRIVATE);
   init_local_connection();
+
+  if (cct->_conf->ms_latency_stats) {
+    peer_type_latency[CEPH_ENTITY_TYPE_MON] = new msgr_latency_t;
+    peer_type_latency[CEPH_ENTITY_TYPE_MDS] = new msgr_latency_t;
+    peer_type_latency[CEPH_ENTITY_TYPE_OSD] = new msgr_latency_t;
+    peer_type_latency[CEPH_ENTITY_TYPE_CLIENT] = new msgr_latency_t;
+  }
 }
 
 /**
@@ -65,7 +76,59 @@ SimpleMessenger::~SimpleMessenger()
   assert(!did_bind); // either we didn't bind or we shut down the Accepter
   assert(rank_pipe.empty()); // we don't have any running Pipes.
   assert(reaper_stop && !reaper_started); // the reaper thread is stopped
+  assert(!latency_hook);
   delete local_connection;
+  for (map<int, msgr_latency_t*>::iterator p = peer_type_latency.begin();
+       p != peer_type_latency.end();
+       ++p)
+    delete p->second;
+}
+
+class MsgrLatencySocketHook : public AdminSocketHook {
+  SimpleMessenger *msgr;
+public:
+  MsgrLatencySocketHook(SimpleMessenger *m) : msgr(m) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    JSONFormatter f(true);
+    msgr->dump_latency(&f);
+    f.flush(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
+void SimpleMessenger::dump_latency(Formatter *f)
+{
+  f->open_object_section("msgr_latency");
+  f->dump_string("messenger", mname);
+
+  f->open_object_section("peer_types");
+  for (map<int, msgr_latency_t*>::iterator p = peer_type_latency.begin();
+       p != peer_type_latency.end();
+       ++p) {
+    f->open_object_section(ceph_entity_type_name(p->first));
+    p->second->dump(f);
+    f->close_section();
+  }
+  f->close_section();
+
+  f->open_array_section("connections");
+  lock.Lock();
+  for (set<Pipe*>::iterator p = pipes.begin(); p != pipes.end(); ++p) {
+    Connection *con = (*p)->connection_state;
+    if (!con || !con->get_latency())
+      continue;
+    f->open_object_section("connection");
+    f->dump_stream("peer_addr") << con->get_peer_addr();
+    f->dump_string("peer_type", ceph_entity_type_name(con->get_peer_type()));
+    con->get_latency()->dump(f);
+    f->close_section();
+  }
+  lock.Unlock();
+  f->close_section();
+
+  f->close_section();
 }
 
 void SimpleMessenger::ready()
@@ -291,6 +354,21 @@ int SimpleMessenger::start()
 
   reaper_started = true;
   reaper_thread.create();
+
+  if (!peer_type_latency.empty()) {
+    // several messengers in one process (e.g. librados instances) may
+    // share a name; only the first one gets the command.
+    latency_hook = new MsgrLatencySocketHook(this);
+    int r = cct->get_admin_socket()->register_command("dump_msgr_latency " + mname,
+						      latency_hook,
+						      "dump " + mname + " messenger latency histograms");
+    if (r < 0) {
+      ldout(cct,10) << "start: could not register dump_msgr_latency " << mname
+		    << ": " << cpp_strerror(r) << dendl;
+      delete latency_hook;
+      latency_hook = NULL;
+    }
+  }
   return 0;
 }
 
@@ -530,6 +608,12 @@ void SimpleMessenger::wait()
   }
   lock.Unlock();
 
+  if (latency_hook) {
+    cct->get_admin_socket()->unregister_command("dump_msgr_latency " + mname);
+    delete latency_hook;
+    latency_hook = NULL;
+  }
+
   ldout(cct,10) << "wait: done." << dendl;
   ldout(cct,1) << "shutdown complete." << dendl;
   started = false;
@@ -596,6 +680,7 @@ void SimpleMessenger::mark_down_on_empty(Connection *con)
     assert(p->msgr == this);
     p->pipe_lock.Lock();
     p->unregister_pipe();
+    p->_take_out_incoming();
     if (p->out_q.empty()) {
       ldout(cct,1) << "mark_down_on_empty " << con << " -- " << p << " closing (queue is empty)" << dendl;
       p->stop();
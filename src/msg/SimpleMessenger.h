@@ -39,6 +39,8 @@ using namespace __gnu_cxx;
 #include "Pipe.h"
 #include "Accepter.h"
 
+class AdminSocketHook;
+
 /*
  * This class handles transmission and reception of messages. Generally
  * speaking, there are several major components:
@@ -515,6 +517,19 @@ private:
   /// Throttle preventing us from building up a big backlog waiting for dispatch
   Throttle dispatch_throttler;
 
+  /// name given at construction ("client", "cluster", ...)
+  string mname;
+
+  /**
+   * latency histograms aggregated by peer type; filled in by the
+   * constructor when ms_latency_stats is set and never modified
+   * afterwards, so lookups need no lock.
+   */
+  map<int, msgr_latency_t*> peer_type_latency;
+
+  /// admin socket hook for dump_msgr_latency, if registered
+  AdminSocketHook *latency_hook;
+
   bool reaper_started, reaper_stop;
   Cond reaper_cond;
 
@@ -604,6 +619,23 @@ public:
     return default_policy;
   }
 
+  /**
+   * Get the latency histograms shared by all connections to the given
+   * peer type.
+   *
+   * @return the histograms, or NULL if latency stats are disabled
+   */
+  msgr_latency_t *get_peer_type_latency(int type) {
+    map<int, msgr_latency_t*>::iterator p = peer_type_latency.find(type);
+    if (p == peer_type_latency.end())
+      return NULL;
+    return p->second;
+  }
+  /**
+   * Dump per-peer-type and per-connection latency histograms.
+   */
+  void dump_latency(ceph::Formatter *f);
+
   /**
    * Release memory accounting back to the dispatch throttler.
    *
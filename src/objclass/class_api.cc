@@ -456,7 +456,7 @@ int cls_cxx_map_get_val(cls_method_context_t hctx, const string &key,
     if (iter == m.end())
       return -ENOENT;
 
-    *outbl = iter->second;
+    outbl->claim(iter->second);
   } catch (buffer::error& e) {
     return -EIO;
   }
@@ -90,6 +90,12 @@ extern void class_fini(void);
 #ifdef __cplusplus
 }
 
+/*
+ * inbl shares the request's buffers, and whatever the method leaves
+ * in outbl is handed to the reply as is; neither is copied.  Methods
+ * should decode from inbl in place and build outbl by appending or
+ * claiming, not by flattening with c_str().
+ */
 typedef int (*cls_method_cxx_call_t)(cls_method_context_t ctx,
 				     class buffer::list *inbl, class buffer::list *outbl);
 
@@ -851,7 +851,7 @@ void FileJournal::queue_completions_thru(uint64_t seq)
     if (completions.front().finish)
       finisher->queue(completions.front().finish);
     if (completions.front().tracked_op)
-      completions.front().tracked_op->mark_event("journaled_completion_queued");
+      completions.front().tracked_op->mark_event(TrackedOp::EVENT_JOURNALED_COMPLETION_QUEUED);
     completions.pop_front();
   }
   queue_cond.Signal();
@@ -912,7 +912,7 @@ int FileJournal::prepare_single_write(bufferlist& bl, off64_t& queue_pos, uint64
   bl.append((const char*)&h, sizeof(h));
 
   if (next_write.tracked_op)
-    next_write.tracked_op->mark_event("write_thread_in_journal_buffer");
+    next_write.tracked_op->mark_event(TrackedOp::EVENT_WRITE_THREAD_IN_JOURNAL_BUFFER);
 
   // pop from writeq
   pop_write();
@@ -1407,7 +1407,7 @@ void FileJournal::submit_entry(uint64_t seq, bufferlist& e, int alignment,
 
   if (full_state == FULL_NOTFULL) {
     if (osd_op)
-      osd_op->mark_event("commit_queued_for_journal_write");
+      osd_op->mark_event(TrackedOp::EVENT_COMMIT_QUEUED_FOR_JOURNAL_WRITE);
     // queue and kick writer thread
     dout(30) << "XXX throttle take " << e.length() << dendl;
     throttle_ops.take(1);
@@ -1424,7 +1424,7 @@ void FileJournal::submit_entry(uint64_t seq, bufferlist& e, int alignment,
     queue_cond.Signal();
   } else {
     if (osd_op)
-      osd_op->mark_event("commit_blocked_by_journal_full");
+      osd_op->mark_event(TrackedOp::EVENT_COMMIT_BLOCKED_BY_JOURNAL_FULL);
     // not journaling this.  restart writing no sooner than seq + 1.
     dout(10) << " journal is/was full" << dendl;
   }
@@ -31,6 +31,47 @@ int ClassHandler::open_class(const string& cname, ClassData **pcls)
   return 0;
 }
 
+int ClassHandler::get_method(const string& cname, const string& mname,
+			     ClassMethod **pmethod)
+{
+  string key;
+  key.reserve(cname.length() + 1 + mname.length());
+  key.append(cname);
+  key.push_back('.');
+  key.append(mname);
+
+  method_cache_lock.get_read();
+  __gnu_cxx::hash_map<string, ClassMethod*>::iterator p = method_cache.find(key);
+  if (p != method_cache.end()) {
+    *pmethod = p->second;
+    method_cache_lock.put_read();
+    return 0;
+  }
+  method_cache_lock.put_read();
+
+  ClassData *cls;
+  int r = open_class(cname, &cls);
+  if (r)
+    return r;
+
+  Mutex::Locker lock(mutex);
+  *pmethod = cls->_get_method(mname.c_str());
+  if (*pmethod && cls->status == ClassData::CLASS_OPEN) {
+    dout(10) << "get_method caching " << key << dendl;
+    method_cache_lock.get_write();
+    method_cache[key] = *pmethod;
+    method_cache_lock.put_write();
+  }
+  return 0;
+}
+
+void ClassHandler::_invalidate_method_cache()
+{
+  method_cache_lock.get_write();
+  method_cache.clear();
+  method_cache_lock.put_write();
+}
+
 ClassHandler::ClassData *ClassHandler::_get_class(const string& cname)
 {
   ClassData *cls;
@@ -183,6 +224,7 @@ void ClassHandler::ClassData::unregister_method(ClassHandler::ClassMethod *metho
    map<string, ClassMethod>::iterator iter = methods_map.find(method->name);
    if (iter == methods_map.end())
      return;
+   handler->_invalidate_method_cache();
    methods_map.erase(iter);
 }
 
@@ -7,6 +7,9 @@
 
 #include "common/Cond.h"
 #include "common/Mutex.h"
+#include "common/RWLock.h"
+
+#include <ext/hash_map>
 
 
 class ClassHandler
@@ -21,11 +24,15 @@ public:
     cls_method_call_t func;
     cls_method_cxx_call_t cxx_func;
 
+    /**
+     * indata shares the request's buffers and is not copied; whatever
+     * the method leaves in outdata is claimed by the reply, not copied.
+     */
     int exec(cls_method_context_t ctx, bufferlist& indata, bufferlist& outdata);
     void unregister();
 
     int get_flags() {
-      Mutex::Locker l(cls->handler->mutex);
+      // set at registration, before the class is open; no lock needed
       return flags;
     }
 
@@ -71,13 +78,32 @@ private:
   Mutex mutex;
   map<string, ClassData> classes;
 
+  /// "class.method" -> method, for methods of open classes
+  RWLock method_cache_lock;
+  __gnu_cxx::hash_map<string, ClassMethod*> method_cache;
+  void _invalidate_method_cache();
+  friend struct ClassData;
+
   ClassData *_get_class(const string& cname);
   int _load_class(ClassData *cls);
 
 public:
-  ClassHandler() : mutex("ClassHandler") {}
+  ClassHandler() : mutex("ClassHandler"),
+		   method_cache_lock("ClassHandler::method_cache_lock") {}
   
   int open_class(const string& cname, ClassData **pcls);
+
+  /**
+   * look up a method by class and method name, loading the class if
+   * needed.  Resolved methods are cached, so hot calls take a read
+   * lock and one hash lookup instead of open_class() and the class's
+   * method map.
+   *
+   * @return 0, with *pmethod NULL if the class has no such method, or
+   *         the error from open_class()
+   */
+  int get_method(const string& cname, const string& mname,
+		 ClassMethod **pmethod);
   
   ClassData *register_class(const char *cname);
   void unregister_class(ClassData *cls);
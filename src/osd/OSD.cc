@@ -85,6 +85,7 @@
 #include "messages/MPGStatsAck.h"
 
 #include "messages/MWatchNotify.h"
+#include "messages/MMsgBatch.h"
 
 #include "common/perf_counters.h"
 #include "common/Timer.h"
@@ -159,8 +160,10 @@ OSDService::OSDService(OSD *osd) :
   sched_scrub_lock("OSDService::sched_scrub_lock"), scrubs_pending(0),
   scrubs_active(0),
   watch_lock("OSD::watch_lock"),
-  watch_timer(osd->client_messenger->cct, watch_lock),
+  watch_timer(osd->client_messenger->cct, watch_lock,
+	      g_conf->osd_watch_timer_tick),
   watch(NULL),
+  work_sched(osd->client_messenger->cct),
   last_tid(0),
   tid_lock("OSDService::tid_lock"),
   pg_temp_lock("OSDService::pg_temp_lock"),
@@ -684,14 +687,17 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   whoami(id),
   dev_path(dev), journal_path(jdev),
   dispatch_running(false),
+  map_decode_running(false),
   osd_compat(get_osd_compat_set()),
   state(STATE_BOOTING), boot_epoch(0), up_epoch(0), bind_epoch(0),
-  op_tp(external_messenger->cct, "OSD::op_tp", g_conf->osd_op_threads),
+  op_tp(external_messenger->cct, "OSD::op_tp", g_conf->osd_peering_threads),
   recovery_tp(external_messenger->cct, "OSD::recovery_tp", g_conf->osd_recovery_threads),
   disk_tp(external_messenger->cct, "OSD::disk_tp", g_conf->osd_disk_threads),
   command_tp(external_messenger->cct, "OSD::command_tp", 1),
   heartbeat_lock("OSD::heartbeat_lock"),
   heartbeat_stop(false), heartbeat_need_update(true), heartbeat_epoch(0),
+  heartbeat_timer(g_ceph_context, heartbeat_lock,
+		  g_conf->osd_heartbeat_timer_tick),
   hbclient_messenger(hbclientm),
   hbserver_messenger(hbserverm),
   heartbeat_thread(this),
@@ -700,11 +706,17 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   finished_lock("OSD::finished_lock"),
   admin_ops_hook(NULL),
   historic_ops_hook(NULL),
-  op_queue_len(0),
-  op_wq(this, g_conf->osd_op_thread_timeout, &op_tp),
-  peering_wq(this, g_conf->osd_op_thread_timeout, &op_tp, 200),
+  op_latency_hook(NULL),
+  notify_latency_hook(NULL),
+  heartbeat_latency_hook(NULL),
+  op_wq(external_messenger->cct, this, g_conf->osd_op_num_shards,
+	g_conf->osd_op_threads, g_conf->osd_op_thread_timeout),
+  peering_wq(this, g_conf->osd_op_thread_timeout, &op_tp,
+	     g_conf->osd_peering_wq_batch_size),
   map_lock("OSD::map_lock"),
   peer_map_epoch_lock("OSD::peer_map_epoch_lock"),
+  load_pgs_lock("OSD::load_pgs_lock"),
+  load_pgs_hook(NULL),
   debug_drop_pg_create_probability(g_conf->osd_debug_drop_pg_create_probability),
   debug_drop_pg_create_duration(g_conf->osd_debug_drop_pg_create_duration),
   debug_drop_pg_create_left(-1),
@@ -792,6 +804,63 @@ public:
   }
 };
 
+class OpLatencySocketHook : public AdminSocketHook {
+  OSD *osd;
+public:
+  OpLatencySocketHook(OSD *o) : osd(o) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    if (command == "reset_op_latency")
+      osd->op_tracker.reset_latency();
+    else
+      osd->op_tracker.dump_latency(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
+class NotifyLatencySocketHook : public AdminSocketHook {
+  OSD *osd;
+public:
+  NotifyLatencySocketHook(OSD *o) : osd(o) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    if (command == "reset_notify_latency")
+      osd->service.watch->reset_latency();
+    else
+      osd->service.watch->dump_latency(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
+class HeartbeatLatencySocketHook : public AdminSocketHook {
+  OSD *osd;
+public:
+  HeartbeatLatencySocketHook(OSD *o) : osd(o) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    if (command == "reset_heartbeat_latency")
+      osd->reset_heartbeat_latency();
+    else
+      osd->dump_heartbeat_latency(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
+class LoadPGsSocketHook : public AdminSocketHook {
+  OSD *osd;
+public:
+  LoadPGsSocketHook(OSD *o) : osd(o) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    osd->dump_load_pgs(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
 int OSD::init()
 {
   Mutex::Locker lock(osd_lock);
@@ -851,6 +920,10 @@ int OSD::init()
   bind_epoch = osdmap->get_epoch();
 
   // load up pgs (as they previously existed)
+  load_pgs_hook = new LoadPGsSocketHook(this);
+  r = cct->get_admin_socket()->register_command("dump_load_pgs", load_pgs_hook,
+					       "show pg loading progress and timing");
+  assert(r == 0);
   load_pgs();
 
   dout(2) << "superblock: i am osd." << superblock.whoami << dendl;
@@ -858,6 +931,7 @@ int OSD::init()
   if (whoami != superblock.whoami) {
     derr << "OSD::init: logic error: superblock says osd"
 	 << superblock.whoami << " but i am osd." << whoami << dendl;
+    remove_load_pgs_hook();
     return -EINVAL;
   }
 
@@ -872,8 +946,10 @@ int OSD::init()
 
   monc->set_want_keys(CEPH_ENTITY_TYPE_MON | CEPH_ENTITY_TYPE_OSD);
   r = monc->init();
-  if (r < 0)
+  if (r < 0) {
+    remove_load_pgs_hook();
     return r;
+  }
 
   // tell monc about log_client so it will know about mon session resets
   monc->set_log_client(&clog);
@@ -885,6 +961,7 @@ int OSD::init()
     monc->shutdown();
     store->umount();
     osd_lock.Lock(); // locker is going to unlock this on function exit
+    remove_load_pgs_hook();
     return r;
   }
 
@@ -893,11 +970,13 @@ int OSD::init()
   osd_lock.Lock();
 
   op_tp.start();
+  op_wq.start();
   recovery_tp.start();
   disk_tp.start();
   command_tp.start();
 
   // start the heartbeat
+  heartbeat_timer.init();
   heartbeat_thread.create();
 
   // tick
@@ -920,6 +999,27 @@ int OSD::init()
   r = admin_socket->register_command("dump_historic_ops", historic_ops_hook,
                                          "show slowest recent ops");
   assert(r == 0);
+  op_latency_hook = new OpLatencySocketHook(this);
+  r = admin_socket->register_command("dump_op_latency", op_latency_hook,
+				     "show op latency histograms by op type and phase");
+  assert(r == 0);
+  r = admin_socket->register_command("reset_op_latency", op_latency_hook,
+				     "clear the op latency histograms");
+  assert(r == 0);
+  notify_latency_hook = new NotifyLatencySocketHook(this);
+  r = admin_socket->register_command("dump_notify_latency", notify_latency_hook,
+				     "show watch/notify ack and completion latency");
+  assert(r == 0);
+  r = admin_socket->register_command("reset_notify_latency", notify_latency_hook,
+				     "clear the notify latency histograms");
+  assert(r == 0);
+  heartbeat_latency_hook = new HeartbeatLatencySocketHook(this);
+  r = admin_socket->register_command("dump_heartbeat_latency", heartbeat_latency_hook,
+				     "show heartbeat ping round trip times by peer");
+  assert(r == 0);
+  r = admin_socket->register_command("reset_heartbeat_latency", heartbeat_latency_hook,
+				     "clear the heartbeat round trip histograms");
+  assert(r == 0);
 
   return 0;
 }
@@ -967,8 +1067,13 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_pull,      "pull");       // pull requests sent
   osd_plb.add_u64_counter(l_osd_push,      "push");       // push messages
   osd_plb.add_u64_counter(l_osd_push_outb, "push_out_bytes");  // pushed bytes
+  osd_plb.add_u64_counter(l_osd_push_delta, "push_delta");  // pushes of just the extents dirtied since the peer's version
 
   osd_plb.add_u64_counter(l_osd_rop, "recovery_ops");       // recovery ops (started)
+  osd_plb.add_u64_counter(l_osd_rop_demand, "recovery_ops_demand"); // ... of those, for objects client ops wait on
+  osd_plb.add_u64(l_osd_rop_active, "recovery_ops_active");  // recovery ops in flight
+  osd_plb.add_u64(l_osd_rq, "recovery_queue");               // pgs waiting to recover
+  osd_plb.add_fl_avg(l_osd_rop_blocked_lat, "recovery_blocked_latency"); // client ops held for a degraded object
 
   osd_plb.add_fl(l_osd_loadavg, "loadavg");
   osd_plb.add_u64(l_osd_buf, "buffer_bytes");       // total ceph::buffer bytes
@@ -983,8 +1088,21 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_mape, "map_message_epochs");         // osdmap epochs
   osd_plb.add_u64_counter(l_osd_mape_dup, "map_message_epoch_dups"); // dup osdmap epochs
 
+  osd_plb.add_u64(l_osd_load_pgs, "load_pgs");                      // pgs loaded at startup
+  osd_plb.add_fl(l_osd_load_pgs_lat, "load_pgs_time");              // wall clock
+  osd_plb.add_fl(l_osd_load_pgs_list_lat, "load_pgs_list_time");    // listing collections
+  osd_plb.add_fl(l_osd_load_pgs_read_lat, "load_pgs_read_time");    // info+log, summed over pgs
+  osd_plb.add_fl(l_osd_load_pgs_missing_lat, "load_pgs_missing_time"); // missing, summed over pgs
+
   logger = osd_plb.create_perf_counters();
   g_ceph_context->get_perfcounters_collection()->add(logger);
+
+  // load_pgs() ran before we existed
+  logger->set(l_osd_load_pgs, load_pgs_done.read());
+  logger->fset(l_osd_load_pgs_lat, (double)load_pgs_time);
+  logger->fset(l_osd_load_pgs_list_lat, (double)load_pgs_list_time);
+  logger->fset(l_osd_load_pgs_read_lat, (double)load_pgs_read_time);
+  logger->fset(l_osd_load_pgs_missing_lat, (double)load_pgs_missing_time);
 }
 
 void OSD::suicide(int exitcode)
@@ -999,6 +1117,7 @@ void OSD::suicide(int exitcode)
 
   derr << " pausing thread pools" << dendl;
   op_tp.pause();
+  op_wq.pause();
   disk_tp.pause();
   recovery_tp.pause();
   command_tp.pause();
@@ -1025,6 +1144,10 @@ int OSD::shutdown()
 
   state = STATE_STOPPING;
 
+  // handle_osd_map may be reading the store and map cache unlocked
+  while (map_decode_running)
+    map_decode_cond.Wait(osd_lock);
+
   timer.shutdown();
 
   service.watch_lock.Lock();
@@ -1032,10 +1155,16 @@ int OSD::shutdown()
   service.watch_lock.Unlock();
 
   heartbeat_lock.Lock();
-  heartbeat_stop = true;
+  heartbeat_stop = true;  // nothing arms a new deadline past here
   heartbeat_cond.Signal();
+  heartbeat_timer.shutdown();
+  for (map<int,HeartbeatInfo>::iterator p = heartbeat_peers.begin();
+       p != heartbeat_peers.end();
+       ++p)
+    p->second.deadline = NULL;  // freed by the timer
   heartbeat_lock.Unlock();
   heartbeat_thread.join();
+  reset_heartbeat_peers();
 
   command_tp.stop();
 
@@ -1044,13 +1173,28 @@ int OSD::shutdown()
   dout(10) << "no ops" << dendl;
 
   cct->get_admin_socket()->unregister_command("dump_ops_in_flight");
+  cct->get_admin_socket()->unregister_command("dump_historic_ops");
+  cct->get_admin_socket()->unregister_command("dump_op_latency");
+  cct->get_admin_socket()->unregister_command("reset_op_latency");
+  cct->get_admin_socket()->unregister_command("dump_notify_latency");
+  cct->get_admin_socket()->unregister_command("reset_notify_latency");
+  cct->get_admin_socket()->unregister_command("dump_heartbeat_latency");
+  cct->get_admin_socket()->unregister_command("reset_heartbeat_latency");
+  remove_load_pgs_hook();
   delete admin_ops_hook;
   delete historic_ops_hook;
   admin_ops_hook = NULL;
   historic_ops_hook = NULL;
+  delete op_latency_hook;
+  op_latency_hook = NULL;
+  delete notify_latency_hook;
+  notify_latency_hook = NULL;
+  delete heartbeat_latency_hook;
+  heartbeat_latency_hook = NULL;
 
   recovery_tp.stop();
   dout(10) << "recovery tp stopped" << dendl;
+  op_wq.stop();
   op_tp.stop();
   dout(10) << "op tp stopped" << dendl;
 
@@ -1239,13 +1383,11 @@ PGPool OSD::_get_pool(int id, OSDMapRef createmap)
   return p;
 }
 
-PG *OSD::_open_lock_pg(
-  OSDMapRef createmap,
-  pg_t pgid, bool no_lockdep_check, bool hold_map_lock)
+PG *OSD::_open_pg(OSDMapRef createmap, pg_t pgid)
 {
   assert(osd_lock.is_locked());
 
-  dout(10) << "_open_lock_pg " << pgid << dendl;
+  dout(10) << "_open_pg " << pgid << dendl;
   PGPool pool = _get_pool(pgid.pool(), createmap);
 
   // create
@@ -1259,12 +1401,19 @@ PG *OSD::_open_lock_pg(
 
   assert(pg_map.count(pgid) == 0);
   pg_map[pgid] = pg;
+  pg->get();  // because it's in pg_map
+  return pg;
+}
 
+PG *OSD::_open_lock_pg(
+  OSDMapRef createmap,
+  pg_t pgid, bool no_lockdep_check, bool hold_map_lock)
+{
+  PG *pg = _open_pg(createmap, pgid);
   if (hold_map_lock)
     pg->lock_with_map_lock_held(no_lockdep_check);
   else
     pg->lock(no_lockdep_check);
-  pg->get();  // because it's in pg_map
   return pg;
 }
 
@@ -1337,12 +1486,97 @@ PG *OSD::lookup_lock_raw_pg(pg_t pgid)
 }
 
 
+/*
+ * Reads pg state and logs for load_pgs() on a temporary thread pool.
+ * Each worker takes the pg lock only while it reads that pg.
+ */
+struct OSD::LoadPGsWQ : public ThreadPool::WorkQueue<PG> {
+  OSD *osd;
+  list<PG*> pgs;
+
+  LoadPGsWQ(OSD *o, ThreadPool *tp)
+    : ThreadPool::WorkQueue<PG>("OSD::LoadPGsWQ",
+				g_conf->osd_op_thread_timeout, 0, tp),
+      osd(o) {}
+
+  bool _enqueue(PG *pg) {
+    pgs.push_back(pg);
+    return true;
+  }
+  void _dequeue(PG *pg) {
+    pgs.remove(pg);
+  }
+  PG *_dequeue() {
+    if (pgs.empty())
+      return NULL;
+    PG *pg = pgs.front();
+    pgs.pop_front();
+    return pg;
+  }
+  bool _empty() {
+    return pgs.empty();
+  }
+  void _clear() {
+    pgs.clear();
+  }
+  void _process(PG *pg) {
+    osd->load_pg_state(pg);
+  }
+};
+
+void OSD::load_pg_state(PG *pg)
+{
+  utime_t start = ceph_clock_now(g_ceph_context);
+  utime_t missing_time;
+  pg->lock();
+  pg->read_state(store, &missing_time);
+  pg->unlock();
+  utime_t dur = ceph_clock_now(g_ceph_context) - start;
+
+  Mutex::Locker l(load_pgs_lock);
+  load_pgs_read_time += dur - missing_time;
+  load_pgs_missing_time += missing_time;
+  unsigned done = load_pgs_done.inc();
+  unsigned total = load_pgs_total.read();
+  if (done == total || done % 100 == 0)
+    dout(1) << "load_pgs read " << done << "/" << total << " pgs" << dendl;
+}
+
+void OSD::remove_load_pgs_hook()
+{
+  if (!load_pgs_hook)
+    return;
+  cct->get_admin_socket()->unregister_command("dump_load_pgs");
+  delete load_pgs_hook;
+  load_pgs_hook = NULL;
+}
+
+void OSD::dump_load_pgs(ostream& ss)
+{
+  JSONFormatter jf(true);
+  jf.open_object_section("load_pgs");
+  jf.dump_unsigned("total", load_pgs_total.read());
+  jf.dump_unsigned("done", load_pgs_done.read());
+  {
+    Mutex::Locker l(load_pgs_lock);
+    jf.dump_float("time", load_pgs_time);
+    jf.dump_float("list_time", load_pgs_list_time);
+    jf.dump_float("read_time", load_pgs_read_time);
+    jf.dump_float("missing_time", load_pgs_missing_time);
+  }
+  jf.close_section();
+  jf.flush(ss);
+}
+
 void OSD::load_pgs()
 {
   assert(osd_lock.is_locked());
   dout(10) << "load_pgs" << dendl;
   assert(pg_map.empty());
 
+  utime_t start = ceph_clock_now(g_ceph_context);
+  vector<PG*> pgs;
+
   vector<coll_t> ls;
   int r = store->list_collections(ls);
   if (r < 0) {
@@ -1397,10 +1631,36 @@ void OSD::load_pgs()
       continue;
     }
 
-    PG *pg = _open_lock_pg(osdmap, pgid);
+    // opened unlocked: we'd otherwise hold every pg lock at once while
+    // the workers read them
+    pgs.push_back(_open_pg(osdmap, pgid));
+  }
+  {
+    Mutex::Locker l(load_pgs_lock);
+    load_pgs_list_time = ceph_clock_now(g_ceph_context) - start;
+  }
+  load_pgs_total.set(pgs.size());
+  dout(1) << "load_pgs reading " << pgs.size() << " pgs with "
+	  << g_conf->osd_load_pgs_threads << " threads" << dendl;
+
+  // read pg state, log
+  if (g_conf->osd_load_pgs_threads > 1 && pgs.size() > 1) {
+    ThreadPool load_tp(g_ceph_context, "OSD::load_tp", g_conf->osd_load_pgs_threads);
+    LoadPGsWQ load_wq(this, &load_tp);
+    for (vector<PG*>::iterator p = pgs.begin(); p != pgs.end(); ++p)
+      load_wq.queue(*p);
+    load_tp.start();
+    load_wq.drain();
+    load_tp.stop();
+  } else {
+    for (vector<PG*>::iterator p = pgs.begin(); p != pgs.end(); ++p)
+      load_pg_state(*p);
+  }
 
-    // read pg state, log
-    pg->read_state(store);
+  for (vector<PG*>::iterator p = pgs.begin(); p != pgs.end(); ++p) {
+    PG *pg = *p;
+    pg->lock();
+    pg_t pgid = pg->info.pgid;
 
     service.reg_last_pg_scrub(pg->info.pgid, pg->info.history.last_scrub_stamp);
 
@@ -1415,6 +1675,10 @@ void OSD::load_pgs()
     dout(10) << "load_pgs loaded " << *pg << " " << pg->log << dendl;
     pg->unlock();
   }
+  {
+    Mutex::Locker l(load_pgs_lock);
+    load_pgs_time = ceph_clock_now(g_ceph_context) - start;
+  }
   dout(10) << "load_pgs done" << dendl;
 
   build_past_intervals_parallel();
@@ -1525,6 +1789,7 @@ void OSD::build_past_intervals_parallel()
   int num = 0;
   for (map<PG*,pistate>::iterator i = pis.begin(); i != pis.end(); ++i) {
     PG *pg = i->first;
+    pg->dirty_big_info = true;
     pg->write_info(t);
 
     // don't let the transaction get too big
@@ -1728,11 +1993,6 @@ void OSD::update_osd_stat()
   osd_stat.kb_used = (stbuf.f_blocks - stbuf.f_bfree) * stbuf.f_bsize / 1024;
   osd_stat.kb_avail = stbuf.f_bavail * stbuf.f_bsize / 1024;
 
-  osd_stat.hb_in.clear();
-  for (map<int,HeartbeatInfo>::iterator p = heartbeat_peers.begin(); p != heartbeat_peers.end(); p++)
-    osd_stat.hb_in.push_back(p->first);
-  osd_stat.hb_out.clear();
-
   dout(20) << "update_osd_stat " << osd_stat << dendl;
 }
 
@@ -1748,14 +2008,40 @@ void OSD::_add_heartbeat_peer(int p)
     hi->inst = osdmap->get_hb_inst(p);
     hi->con = hbclient_messenger->get_connection(hi->inst);
     hi->con->set_priv(new HeartbeatSession(p));
+    hi->rtt = new LatencyHistogram;
     dout(10) << "_add_heartbeat_peer: new peer osd." << p
 	     << " " << hi->con->get_peer_addr() << dendl;
+    utime_t due = ceph_clock_now(g_ceph_context);
+    due += g_conf->osd_heartbeat_grace;
+    _schedule_heartbeat_deadline(p, hi, due);
   } else {
     hi = &i->second;
   }
   hi->epoch = osdmap->get_epoch();
 }
 
+void OSD::_remove_heartbeat_peer(map<int,HeartbeatInfo>::iterator p)
+{
+  assert(heartbeat_lock.is_locked());
+  dout(20) << "_remove_heartbeat_peer osd." << p->first
+	   << " " << p->second.con->get_peer_addr() << dendl;
+  hbclient_messenger->mark_down(p->second.con);
+  p->second.con->put();
+  if (p->second.deadline)
+    heartbeat_timer.cancel_event(p->second.deadline);
+  delete p->second.rtt;
+  heartbeat_peers.erase(p);
+}
+
+void OSD::_schedule_heartbeat_deadline(int p, HeartbeatInfo *hi, utime_t when)
+{
+  assert(hi->deadline == NULL);
+  if (heartbeat_stop)
+    return;
+  hi->deadline = new C_HeartbeatDeadline(this, p);
+  heartbeat_timer.add_event_at(when, hi->deadline);
+}
+
 void OSD::need_heartbeat_peer_update()
 {
   heartbeat_lock.Lock();
@@ -1797,16 +2083,10 @@ void OSD::maybe_update_heartbeat_peers()
 
   map<int,HeartbeatInfo>::iterator p = heartbeat_peers.begin();
   while (p != heartbeat_peers.end()) {
-    if (p->second.epoch < osdmap->get_epoch()) {
-      dout(20) << " removing heartbeat peer osd." << p->first
-	       << " " << p->second.con->get_peer_addr()
-	       << dendl;
-      hbclient_messenger->mark_down(p->second.con);
-      p->second.con->put();
-      heartbeat_peers.erase(p++);
-    } else {
+    if (p->second.epoch < osdmap->get_epoch())
+      _remove_heartbeat_peer(p++);
+    else
       ++p;
-    }
   }
   dout(10) << "maybe_update_heartbeat_peers " << heartbeat_peers.size() << " peers" << dendl;
 }
@@ -1815,11 +2095,8 @@ void OSD::reset_heartbeat_peers()
 {
   dout(10) << "reset_heartbeat_peers" << dendl;
   heartbeat_lock.Lock();
-  while (!heartbeat_peers.empty()) {
-    hbclient_messenger->mark_down(heartbeat_peers.begin()->second.con);
-    heartbeat_peers.begin()->second.con->put();
-    heartbeat_peers.erase(heartbeat_peers.begin());
-  }
+  while (!heartbeat_peers.empty())
+    _remove_heartbeat_peer(heartbeat_peers.begin());
   failure_queue.clear();
   heartbeat_lock.Unlock();
 }
@@ -1888,6 +2165,11 @@ void OSD::handle_osd_ping(MOSDPing *m)
 		 << " last_rx " << i->second.last_rx << " -> " << m->stamp
 		 << dendl;
 	i->second.last_rx = m->stamp;
+
+	// the reply echoes the stamp from our ping
+	utime_t rtt = ceph_clock_now(g_ceph_context) - m->stamp;
+	i->second.rtt->add(rtt);
+	heartbeat_rtt.add(rtt);
       }
 
       if (m->map_epoch &&
@@ -1921,6 +2203,16 @@ void OSD::heartbeat_entry()
 {
   heartbeat_lock.Lock();
   while (!heartbeat_stop) {
+    // statfs can stall behind a busy disk; don't hold up ping replies
+    heartbeat_lock.Unlock();
+    {
+      Mutex::Locker lock(stat_lock);
+      update_osd_stat();
+    }
+    heartbeat_lock.Lock();
+    if (heartbeat_stop)
+      break;
+
     heartbeat();
 
     double wait = .5 + ((float)(rand() % 10)/10.0) * (float)g_conf->osd_heartbeat_interval;
@@ -1933,39 +2225,50 @@ void OSD::heartbeat_entry()
   heartbeat_lock.Unlock();
 }
 
-void OSD::heartbeat_check()
+void OSD::heartbeat_deadline(int peer)
 {
   assert(heartbeat_lock.is_locked());
+  map<int,HeartbeatInfo>::iterator p = heartbeat_peers.find(peer);
+  if (p == heartbeat_peers.end())
+    return;
+  HeartbeatInfo& hi = p->second;
+  hi.deadline = NULL;
 
-  // check for incoming heartbeats (move me elsewhere?)
-  utime_t cutoff = ceph_clock_now(g_ceph_context);
+  utime_t now = ceph_clock_now(g_ceph_context);
+  utime_t cutoff = now;
   cutoff -= g_conf->osd_heartbeat_grace;
-  for (map<int,HeartbeatInfo>::iterator p = heartbeat_peers.begin();
-       p != heartbeat_peers.end();
-       p++) {
-    dout(25) << "heartbeat_check osd." << p->first
-	     << " first_rx " << p->second.first_tx
-	     << " last_tx " << p->second.last_tx
-	     << " last_rx " << p->second.last_rx
-	     << dendl;
-    if (p->second.last_rx == utime_t()) {
-      if (p->second.last_tx == utime_t() ||
-	  p->second.last_tx > cutoff)
-	continue;  // just started sending recently
-      derr << "heartbeat_check: no reply from osd." << p->first
-	   << " ever, first ping sent " << p->second.first_tx
-	   << " (cutoff " << cutoff << ")" << dendl;
-    } else {
-      if (p->second.last_rx > cutoff)
-	continue;  // got recent reply
-      derr << "heartbeat_check: no reply from osd." << p->first
-	   << " since " << p->second.last_rx
-	   << " (cutoff " << cutoff << ")" << dendl;
-    }
+  dout(25) << "heartbeat_deadline osd." << peer
+	   << " first_tx " << hi.first_tx
+	   << " last_tx " << hi.last_tx
+	   << " last_rx " << hi.last_rx
+	   << dendl;
 
-    // fail!
-    queue_failure(p->first);
+  // replies only push the deadline out; we look at them when it comes due
+  utime_t since = hi.last_rx;
+  if (since == utime_t())
+    since = hi.first_tx;
+  if (since == utime_t())
+    since = now;  // haven't pinged it yet
+  if (since > cutoff) {
+    since += g_conf->osd_heartbeat_grace;
+    _schedule_heartbeat_deadline(peer, &hi, since);
+    return;
   }
+
+  if (hi.last_rx == utime_t())
+    derr << "heartbeat_deadline: no reply from osd." << peer
+	 << " ever, first ping sent " << hi.first_tx
+	 << " (cutoff " << cutoff << ")" << dendl;
+  else
+    derr << "heartbeat_deadline: no reply from osd." << peer
+	 << " since " << hi.last_rx
+	 << " (cutoff " << cutoff << ")" << dendl;
+
+  // fail!  and keep reporting until it answers or is marked down
+  queue_failure(peer);
+  utime_t due = now;
+  due += g_conf->osd_heartbeat_interval;
+  _schedule_heartbeat_deadline(peer, &hi, due);
 }
 
 void OSD::heartbeat()
@@ -1977,16 +2280,15 @@ void OSD::heartbeat()
   if (getloadavg(loadavgs, 1) == 1)
     logger->fset(l_osd_loadavg, loadavgs[0]);
 
-  dout(30) << "heartbeat checking stats" << dendl;
-
-  // refresh stats?
   {
     Mutex::Locker lock(stat_lock);
-    update_osd_stat();
+    osd_stat.hb_in.clear();
+    for (map<int,HeartbeatInfo>::iterator p = heartbeat_peers.begin(); p != heartbeat_peers.end(); p++)
+      osd_stat.hb_in.push_back(p->first);
+    osd_stat.hb_out.clear();
+    dout(5) << "heartbeat: " << osd_stat << dendl;
   }
 
-  dout(5) << "heartbeat: " << osd_stat << dendl;
-
   utime_t now = ceph_clock_now(g_ceph_context);
 
   // send heartbeats
@@ -2006,9 +2308,6 @@ void OSD::heartbeat()
     hbclient_messenger->send_message(m, i->second.con);
   }
 
-  dout(30) << "heartbeat check" << dendl;
-  heartbeat_check();
-
   if (logger) {
     logger->set(l_osd_hb_to, heartbeat_peers.size());
     logger->set(l_osd_hb_from, 0);
@@ -2049,6 +2348,43 @@ bool OSD::heartbeat_reset(Connection *con)
   return true;
 }
 
+void OSD::dump_heartbeat_latency(ostream& ss)
+{
+  JSONFormatter jf(true);
+  jf.open_object_section("heartbeat_latency");
+  jf.open_object_section("all");
+  heartbeat_rtt.dump(&jf);
+  jf.close_section();
+  jf.open_array_section("peers");
+  heartbeat_lock.Lock();
+  for (map<int,HeartbeatInfo>::iterator p = heartbeat_peers.begin();
+       p != heartbeat_peers.end();
+       ++p) {
+    jf.open_object_section("peer");
+    jf.dump_int("osd", p->first);
+    jf.dump_stream("addr") << p->second.con->get_peer_addr();
+    jf.dump_stream("last_rx") << p->second.last_rx;
+    jf.open_object_section("rtt");
+    p->second.rtt->dump(&jf);
+    jf.close_section();
+    jf.close_section();
+  }
+  heartbeat_lock.Unlock();
+  jf.close_section();
+  jf.close_section();
+  jf.flush(ss);
+}
+
+void OSD::reset_heartbeat_latency()
+{
+  Mutex::Locker l(heartbeat_lock);
+  heartbeat_rtt.reset();
+  for (map<int,HeartbeatInfo>::iterator p = heartbeat_peers.begin();
+       p != heartbeat_peers.end();
+       ++p)
+    p->second.rtt->reset();
+}
+
 
 
 // =========================================
@@ -2060,6 +2396,10 @@ void OSD::tick()
 
   logger->set(l_osd_buf, buffer::get_total_alloc());
 
+  recovery_wq.lock();
+  logger->set(l_osd_rq, recovery_queue.size());
+  recovery_wq.unlock();
+
   if (is_active()) {
     // periodically kick recovery work queue
     recovery_tp.wake();
@@ -2072,10 +2412,6 @@ void OSD::tick()
 
     maybe_update_heartbeat_peers();
 
-    heartbeat_lock.Lock();
-    heartbeat_check();
-    heartbeat_lock.Unlock();
-
     check_replay_queue();
 
     // mon report?
@@ -2176,7 +2512,19 @@ void OSD::do_mon_report()
   send_alive();
   service.send_pg_temp();
   send_failures();
-  send_pg_stats(now);
+
+  // while the mon is still working through our last report, let pg
+  // stat updates pile into the next one instead of sending them again
+  bool backoff = false;
+  if (g_conf->osd_mon_report_backoff &&
+      now - last_pg_stats_sent < g_conf->osd_mon_report_interval_max) {
+    Mutex::Locker l(pg_stat_queue_lock);
+    backoff = pg_stat_tid_flushed < pg_stat_tid;
+  }
+  if (backoff)
+    dout(10) << "do_mon_report pg stats tid " << pg_stat_tid << " still unacked, holding" << dendl;
+  else
+    send_pg_stats(now);
 }
 
 void OSD::ms_handle_connect(Connection *con)
@@ -2215,6 +2563,7 @@ void OSD::complete_notify(void *_notif, void *_obc)
   ReplicatedPG::ObjectContext *obc = (ReplicatedPG::ObjectContext *)_obc;
   Watch::Notification *notif = (Watch::Notification *)_notif;
   dout(10) << "complete_notify " << notif << " got the last reply from pending watchers, can send response now" << dendl;
+  service.watch->note_complete(notif);
   MWatchNotify *reply = notif->reply;
   client_messenger->send_message(reply, notif->session->con);
   notif->session->put();
@@ -2450,6 +2799,39 @@ void OSDService::send_pg_temp()
   monc->send_mon_message(m);
 }
 
+void OSDService::send_watch_notifies(map<Connection*, list<Message*> >& notifies)
+{
+  int max = g_conf->ms_batch_max_msgs;
+  for (map<Connection*, list<Message*> >::iterator p = notifies.begin();
+       p != notifies.end();
+       ++p) {
+    Connection *con = p->first;
+    list<Message*>& ls = p->second;
+    // clients that understand MMsgBatch get one message per max notifies
+    if (max < 2 || ls.size() < 2 ||
+	!con->has_feature(CEPH_FEATURE_MSG_BATCH)) {
+      for (list<Message*>::iterator q = ls.begin(); q != ls.end(); ++q)
+	client_messenger->send_message(*q, con);
+    } else {
+      dout(20) << "send_watch_notifies batching " << ls.size()
+	       << " notifies to " << con->get_peer_addr() << dendl;
+      while (!ls.empty()) {
+	MMsgBatch *b = new MMsgBatch;
+	b->get_header().src = client_messenger->get_myname();
+	while (!ls.empty() && (int)b->get_num_msgs() < max) {
+	  Message *m = ls.front();
+	  ls.pop_front();
+	  m->get_header().src = client_messenger->get_myname();
+	  b->add(m);
+	}
+	client_messenger->send_message(b, con);
+      }
+    }
+    con->put();
+  }
+  notifies.clear();
+}
+
 void OSD::send_failures()
 {
   bool locked = false;
@@ -2498,6 +2880,7 @@ void OSD::send_pg_stats(const utime_t &now)
     MPGStats *m = new MPGStats(monc->get_fsid(), osdmap->get_epoch(), had_for);
     m->set_tid(++pg_stat_tid);
     m->osd_stat = cur_stat;
+    bool use_delta = g_conf->osd_pg_stat_delta;
 
     xlist<PG*>::iterator p = pg_stat_queue.begin();
     while (!p.end()) {
@@ -2511,7 +2894,16 @@ void OSD::send_pg_stats(const utime_t &now)
       pg->pg_stats_lock.Lock();
       if (pg->pg_stats_valid) {
 	m->pg_stat[pg->info.pgid] = pg->pg_stats_stable;
-	dout(25) << " sending " << pg->info.pgid << " " << pg->pg_stats_stable.reported << dendl;
+	pg->pg_stats_sent = pg->pg_stats_stable;
+	pg_stat_delta_t d;
+	if (use_delta && pg->pg_stats_acked_valid &&
+	    d.build(pg->pg_stats_acked, pg->pg_stats_stable)) {
+	  m->pg_stat_delta[pg->info.pgid] = d;
+	  dout(25) << " sending " << pg->info.pgid << " " << pg->pg_stats_stable.reported
+		   << " as delta from " << pg->pg_stats_acked.reported << dendl;
+	} else {
+	  dout(25) << " sending " << pg->info.pgid << " " << pg->pg_stats_stable.reported << dendl;
+	}
       } else {
 	dout(25) << " NOT sending " << pg->info.pgid << " " << pg->pg_stats_stable.reported << ", not valid" << dendl;
       }
@@ -2554,6 +2946,14 @@ void OSD::handle_pg_stats_ack(MPGStatsAck *ack)
     if (ack->pg_stat.count(pg->info.pgid)) {
       eversion_t acked = ack->pg_stat[pg->info.pgid];
       pg->pg_stats_lock.Lock();
+      if (acked == pg->pg_stats_sent.reported) {
+	pg->pg_stats_acked = pg->pg_stats_sent;
+	pg->pg_stats_acked_valid = true;
+      } else if (acked == eversion_t()) {
+	// the mon couldn't apply our delta; send it all next time
+	dout(20) << " mon has no base for " << pg->info.pgid << dendl;
+	pg->pg_stats_acked_valid = false;
+      }
       if (acked == pg->pg_stats_stable.reported) {
 	dout(25) << " ack on " << pg->info.pgid << " " << pg->pg_stats_stable.reported << dendl;
 	pg->stat_queue_item.remove_myself();
@@ -3209,7 +3609,7 @@ void OSD::_dispatch(Message *m)
   default:
     {
       OpRequestRef op = op_tracker.create_request(m);
-      op->mark_event("waiting_for_osdmap");
+      op->mark_event(OpRequest::EVENT_WAITING_FOR_OSDMAP);
       // no map?  starting up?
       if (!osdmap) {
         dout(7) << "no OSDMap, not booted" << dendl;
@@ -3416,11 +3816,8 @@ void OSD::note_down_osd(int peer)
   failure_queue.erase(peer);
   failure_pending.erase(peer);
   map<int,HeartbeatInfo>::iterator p = heartbeat_peers.find(peer);
-  if (p != heartbeat_peers.end()) {
-    hbclient_messenger->mark_down(p->second.con);
-    p->second.con->put();
-    heartbeat_peers.erase(p);
-  }
+  if (p != heartbeat_peers.end())
+    _remove_heartbeat_peer(p);
   heartbeat_lock.Unlock();
 }
 
@@ -3487,8 +3884,15 @@ void OSD::handle_osd_map(MOSDMap *m)
 
   ObjectStore::Transaction t;
 
-  // store new maps: queue for disk and put in the osdmap cache
+  // store new maps: queue for disk and put in the osdmap cache.
+  // decoding, applying and re-encoding hundreds of maps is slow, and
+  // needs nothing but the map cache, so do it without osd_lock.
+  // dispatch_running keeps other dispatchers (and any other map
+  // message) out until we're done; map_decode_running keeps shutdown
+  // from tearing down the store and map cache under us.
   epoch_t start = MAX(osdmap->get_epoch() + 1, first);
+  map_decode_running = true;
+  osd_lock.Unlock();
   for (epoch_t e = start; e <= last; e++) {
     map<epoch_t,bufferlist>::iterator p;
     p = m->maps.find(e);
@@ -3498,6 +3902,8 @@ void OSD::handle_osd_map(MOSDMap *m)
       bufferlist& bl = p->second;
       
       o->decode(bl);
+      if (g_conf->osd_map_pg_mappings)
+	o->build_pg_mappings();
       pinned_maps.push_back(add_map(o));
 
       hobject_t fulloid = get_osdmap_pobject_name(e);
@@ -3516,17 +3922,17 @@ void OSD::handle_osd_map(MOSDMap *m)
 
       OSDMap *o = new OSDMap;
       if (e > 1) {
-	bufferlist obl;
 	OSDMapRef prev = get_map(e - 1);
-	prev->encode(obl);
-	o->decode(obl);
+	o->deepish_copy_from(*prev);
+	if (g_conf->osd_map_pg_mappings)
+	  o->share_pg_mappings(*prev);
       }
 
       OSDMap::Incremental inc;
       bufferlist::iterator p = bl.begin();
       inc.decode(p);
       if (o->apply_incremental(inc) < 0) {
-	derr << "ERROR: bad fsid?  i have " << osdmap->get_fsid() << " and inc has " << inc.fsid << dendl;
+	derr << "ERROR: bad fsid?  i have " << monc->get_fsid() << " and inc has " << inc.fsid << dendl;
 	assert(0 == "bad fsid");
       }
 
@@ -3543,6 +3949,15 @@ void OSD::handle_osd_map(MOSDMap *m)
 
     assert(0 == "MOSDMap lied about what maps it had?");
   }
+  osd_lock.Lock();
+  map_decode_running = false;
+  map_decode_cond.Signal();
+
+  if (is_stopping()) {
+    clear_map_bl_cache_pins();
+    m->put();
+    return;
+  }
 
   if (superblock.oldest_map) {
     int num = 0;
@@ -5080,14 +5495,27 @@ bool OSDService::queue_for_recovery(PG *pg)
   return b;
 }
 
-bool OSD::_recover_now()
+void OSDService::expedite_recovery(PG *pg)
+{
+  osd->recovery_wq.lock();
+  dout(10) << "expedite_recovery " << *pg << dendl;
+  osd->recovery_wq._queue_demand(pg);
+  osd->recovery_wq._wake();
+  osd->recovery_wq.unlock();
+}
+
+/*
+ * a pg that client ops are waiting on doesn't wait out
+ * osd_recovery_delay_start
+ */
+bool OSD::_recover_now(bool demanded)
 {
   if (recovery_ops_active >= g_conf->osd_recovery_max_active) {
     dout(15) << "_recover_now active " << recovery_ops_active
 	     << " >= max " << g_conf->osd_recovery_max_active << dendl;
     return false;
   }
-  if (ceph_clock_now(g_ceph_context) < defer_recovery_until) {
+  if (!demanded && ceph_clock_now(g_ceph_context) < defer_recovery_until) {
     dout(15) << "_recover_now defer until " << defer_recovery_until << dendl;
     return false;
   }
@@ -5110,6 +5538,18 @@ void OSD::do_recovery(PG *pg)
       pg->unlock();
       return;
     }
+
+    // leave room for other pgs; finish_recovery_op requeues us
+    int pg_max = g_conf->osd_recovery_max_active_per_pg;
+    if (pg_max > 0 && max > pg_max - pg->recovery_ops_active) {
+      max = pg_max - pg->recovery_ops_active;
+      if (max <= 0) {
+	dout(10) << "do_recovery " << pg->recovery_ops_active << " already active on "
+		 << *pg << dendl;
+	pg->unlock();
+	return;
+      }
+    }
     
     dout(10) << "do_recovery starting " << max
 	     << " (" << recovery_ops_active << "/" << g_conf->osd_recovery_max_active << " rops) on "
@@ -5140,10 +5580,20 @@ void OSD::do_recovery(PG *pg)
       }
     }
 
+    bool demanded = pg->is_recovery_demanded();
+    recovery_wq.lock();
+    pg->recovery_demanded = demanded;
+    recovery_wq.unlock();
+
     pg->write_if_dirty(*rctx.transaction);
     OSDMapRef curmap = pg->get_osdmap();
     pg->unlock();
     dispatch_context(rctx, pg, curmap);
+
+    // charge after the fact so we don't stall holding the pg lock
+    if (started)
+      service.work_sched.get(WorkScheduler::CLASS_RECOVERY,
+			     started * WorkScheduler::io_cost(g_conf->osd_sched_recovery_op_bytes));
   }
 }
 
@@ -5155,6 +5605,7 @@ void OSD::start_recovery_op(PG *pg, const hobject_t& soid)
 	   << dendl;
   assert(recovery_ops_active >= 0);
   recovery_ops_active++;
+  logger->set(l_osd_rop_active, recovery_ops_active);
 
 #ifdef DEBUG_RECOVERY_OIDS
   dout(20) << "  active was " << recovery_oids[pg->info.pgid] << dendl;
@@ -5176,6 +5627,7 @@ void OSD::finish_recovery_op(PG *pg, const hobject_t& soid, bool dequeue)
   // adjust count
   recovery_ops_active--;
   assert(recovery_ops_active >= 0);
+  logger->set(l_osd_rop_active, recovery_ops_active);
 
 #ifdef DEBUG_RECOVERY_OIDS
   dout(20) << "  active oids was " << recovery_oids[pg->info.pgid] << dendl;
@@ -5480,37 +5932,134 @@ void OSD::enqueue_op(PG *pg, OpRequestRef op)
 {
   dout(15) << *pg << " enqueue_op " << op << " " << *(op->request) << dendl;
   assert(pg->is_locked());
+  op->mark_queued_for_pg();
   pg->queue_op(op);
 }
 
-bool OSD::OpWQ::_enqueue(PG *pg)
+ShardedOpWQ::ShardedOpWQ(CephContext *cct, OSD *o, int num_shards,
+			 int num_threads, time_t ti)
+  : osd(o)
+{
+  if (num_shards < 1)
+    num_shards = 1;
+  int per_shard = num_threads / num_shards;
+  if (per_shard < 1)
+    per_shard = 1;
+  for (int i = 0; i < num_shards; i++) {
+    stringstream ss;
+    ss << "OSD::op_tp." << i;
+    shards.push_back(new Shard(cct, ss.str(), per_shard, ti, this));
+  }
+}
+
+ShardedOpWQ::~ShardedOpWQ()
+{
+  for (vector<Shard*>::iterator p = shards.begin(); p != shards.end(); ++p)
+    delete *p;
+}
+
+ShardedOpWQ::Shard *ShardedOpWQ::shard_of(PG *pg)
+{
+  return shards[__gnu_cxx::hash<pg_t>()(pg->info.pgid) % shards.size()];
+}
+
+void ShardedOpWQ::queue(PG *pg, unsigned priority)
+{
+  shard_of(pg)->wq.queue_prio(pg, priority);
+}
+
+void ShardedOpWQ::dequeue(PG *pg)
+{
+  shard_of(pg)->wq.dequeue(pg);
+}
+
+void ShardedOpWQ::drain()
+{
+  for (vector<Shard*>::iterator p = shards.begin(); p != shards.end(); ++p)
+    (*p)->wq.drain();
+}
+
+void ShardedOpWQ::start()
+{
+  for (vector<Shard*>::iterator p = shards.begin(); p != shards.end(); ++p)
+    (*p)->tp.start();
+}
+
+void ShardedOpWQ::stop()
+{
+  for (vector<Shard*>::iterator p = shards.begin(); p != shards.end(); ++p)
+    (*p)->tp.stop();
+}
+
+void ShardedOpWQ::pause()
+{
+  for (vector<Shard*>::iterator p = shards.begin(); p != shards.end(); ++p)
+    (*p)->tp.pause();
+}
+
+void ShardedOpWQ::ShardWQ::_enqueue_prio(PG *pg, unsigned priority)
 {
   pg->get();
-  osd->op_queue.push_back(pg);
-  osd->op_queue_len++;
-  osd->logger->set(l_osd_opq, osd->op_queue_len);
-  return true;
+  queue[priority].push_back(pg);
+  parent->osd->logger->set(l_osd_opq, parent->len.inc());
+  parent->osd->service.work_sched.add_client_queued(1);
 }
 
-PG *OSD::OpWQ::_dequeue()
+void ShardedOpWQ::ShardWQ::_dequeue(PG *pg)
 {
-  if (osd->op_queue.empty())
+  int removed = 0;
+  for (map<unsigned, list<PG*> >::iterator p = queue.begin();
+       p != queue.end();
+       ) {
+    for (list<PG*>::iterator i = p->second.begin();
+	 i != p->second.end();
+	 ) {
+      if (*i == pg) {
+	p->second.erase(i++);
+	parent->len.dec();
+	removed++;
+	pg->put();
+      } else {
+	++i;
+      }
+    }
+    if (p->second.empty())
+      queue.erase(p++);
+    else
+      ++p;
+  }
+  parent->osd->logger->set(l_osd_opq, parent->len.read());
+  if (removed)
+    parent->osd->service.work_sched.add_client_queued(-removed);
+}
+
+PG *ShardedOpWQ::ShardWQ::_dequeue()
+{
+  if (queue.empty())
     return NULL;
-  PG *pg = osd->op_queue.front();
-  osd->op_queue.pop_front();
-  osd->op_queue_len--;
-  osd->logger->set(l_osd_opq, osd->op_queue_len);
+  map<unsigned, list<PG*> >::iterator p = --queue.end();
+  PG *pg = p->second.front();
+  p->second.pop_front();
+  if (p->second.empty())
+    queue.erase(p);
+  parent->osd->logger->set(l_osd_opq, parent->len.dec());
+  parent->osd->service.work_sched.add_client_queued(-1);
   return pg;
 }
 
+void ShardedOpWQ::ShardWQ::_process(PG *pg)
+{
+  parent->osd->dequeue_op(pg);
+}
+
 void OSDService::queue_for_peering(PG *pg)
 {
   peering_wq.queue(pg);
 }
 
-void OSDService::queue_for_op(PG *pg)
+void OSDService::queue_for_op(PG *pg, unsigned priority)
 {
-  op_wq.queue(pg);
+  op_wq.queue(pg, priority);
 }
 
 void OSD::process_peering_events(const list<PG*> &pgs)
@@ -5552,6 +6101,21 @@ void OSD::process_peering_events(const list<PG*> &pgs)
 /*
  * NOTE: dequeue called in worker thread, without osd_lock
  */
+/*
+ * bytes the op will move: write data, plus the extents of any reads
+ */
+static uint64_t op_io_cost(OpRequestRef op)
+{
+  uint64_t bytes = op->request->get_data().length();
+  if (op->request->get_type() == CEPH_MSG_OSD_OP) {
+    MOSDOp *m = static_cast<MOSDOp*>(op->request);
+    for (vector<OSDOp>::iterator p = m->ops.begin(); p != m->ops.end(); ++p)
+      if (p->op.op == CEPH_OSD_OP_READ || p->op.op == CEPH_OSD_OP_SPARSE_READ)
+	bytes += p->op.extent.length;
+  }
+  return WorkScheduler::io_cost(bytes);
+}
+
 void OSD::dequeue_op(PG *pg)
 {
   OpRequestRef op;
@@ -5570,11 +6134,16 @@ void OSD::dequeue_op(PG *pg)
 
   op->mark_reached_pg();
 
+  uint64_t cost = op_io_cost(op);
   pg->do_request(op);
 
   // unlock and put pg
   pg->unlock();
   pg->put();
+
+  // client ops are never made to wait; what is still queued behind us
+  // is what holds background work back
+  service.work_sched.charge_client(cost);
   
   //#warning foo
   //scrub_wq.queue(pg);
@@ -5617,11 +6186,11 @@ int OSD::init_op_flags(MOSDOp *op)
 	bp.copy(iter->op.cls.class_len, cname);
 	bp.copy(iter->op.cls.method_len, mname);
 
-	ClassHandler::ClassData *cls;
-	int r = class_handler->open_class(cname, &cls);
+	ClassHandler::ClassMethod *method;
+	int r = class_handler->get_method(cname, mname, &method);
 	if (r)
 	  return r;
-	int flags = cls->get_method_flags(mname.c_str());
+	int flags = method ? method->get_flags() : 0;
 	is_read = flags & CLS_METHOD_RD;
 	is_write = flags & CLS_METHOD_WR;
         is_public = flags & CLS_METHOD_PUBLIC;
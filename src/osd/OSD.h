@@ -24,14 +24,17 @@
 #include "common/Mutex.h"
 #include "common/RWLock.h"
 #include "common/Timer.h"
+#include "common/TimerWheel.h"
 #include "common/WorkQueue.h"
 #include "common/LogClient.h"
+#include "common/LatencyHistogram.h"
 
 #include "os/ObjectStore.h"
 #include "OSDCap.h"
 
 #include "common/DecayCounter.h"
 #include "osd/ClassHandler.h"
+#include "osd/WorkScheduler.h"
 
 #include "include/CompatSet.h"
 
@@ -92,8 +95,13 @@ enum {
   l_osd_pull,
   l_osd_push,
   l_osd_push_outb,
+  l_osd_push_delta,
 
   l_osd_rop,
+  l_osd_rop_demand,
+  l_osd_rop_active,
+  l_osd_rq,
+  l_osd_rop_blocked_lat,
 
   l_osd_loadavg,
   l_osd_buf,
@@ -108,6 +116,12 @@ enum {
   l_osd_mape,
   l_osd_mape_dup,
 
+  l_osd_load_pgs,
+  l_osd_load_pgs_lat,
+  l_osd_load_pgs_list_lat,
+  l_osd_load_pgs_read_lat,
+  l_osd_load_pgs_missing_lat,
+
   l_osd_last,
 };
 
@@ -129,6 +143,10 @@ class AuthAuthorizeHandlerRegistry;
 
 class OpsFlightSocketHook;
 class HistoricOpsSocketHook;
+class OpLatencySocketHook;
+class NotifyLatencySocketHook;
+class HeartbeatLatencySocketHook;
+class LoadPGsSocketHook;
 
 extern const coll_t meta_coll;
 
@@ -155,6 +173,77 @@ public:
 typedef std::tr1::shared_ptr<DeletingState> DeletingStateRef;
 
 class OSD;
+
+/**
+ * ShardedOpWQ
+ *
+ * PGs with queued ops, spread over shards by pgid.  Each shard is its
+ * own ThreadPool (lock, worker threads, heartbeat) with a single work
+ * queue ordered by op priority, so enqueue and dequeue from different
+ * shards never contend.  A PG always maps to the same shard, and is
+ * queued once per op in pg->op_queue just as with a single queue;
+ * pg->op_queue is kept in priority order, so each dequeue serves that
+ * PG's highest priority op.
+ */
+class ShardedOpWQ {
+  struct ShardWQ : public ThreadPool::WorkQueue<PG> {
+    ShardedOpWQ *parent;
+    map<unsigned, list<PG*> > queue;  ///< priority -> pgs; highest first
+
+    ShardWQ(ShardedOpWQ *p, time_t ti, ThreadPool *tp)
+      : ThreadPool::WorkQueue<PG>("OSD::OpWQ", ti, ti*10, tp),
+	parent(p) {}
+
+    void queue_prio(PG *pg, unsigned priority) {
+      lock();
+      _enqueue_prio(pg, priority);
+      _wake();
+      unlock();
+    }
+    void _enqueue_prio(PG *pg, unsigned priority);
+    bool _enqueue(PG *pg) {
+      _enqueue_prio(pg, CEPH_MSG_PRIO_DEFAULT);
+      return true;
+    }
+    void _dequeue(PG *pg);
+    PG *_dequeue();
+    bool _empty() {
+      return queue.empty();
+    }
+    void _process(PG *pg);
+    void _clear() {
+      assert(queue.empty());
+    }
+  };
+
+  struct Shard {
+    ThreadPool tp;
+    ShardWQ wq;
+    Shard(CephContext *cct, const string& name, int threads, time_t ti,
+	  ShardedOpWQ *parent)
+      : tp(cct, name, threads), wq(parent, ti, &tp) {}
+  };
+
+  OSD *osd;
+  vector<Shard*> shards;
+  atomic_t len;  ///< total over all shards, for l_osd_opq
+
+  Shard *shard_of(PG *pg);
+
+public:
+  ShardedOpWQ(CephContext *cct, OSD *o, int num_shards, int num_threads,
+	      time_t ti);
+  ~ShardedOpWQ();
+
+  void queue(PG *pg, unsigned priority);
+  void dequeue(PG *pg);
+  void drain();
+
+  void start();
+  void stop();
+  void pause();
+};
+
 class OSDService {
 public:
   OSD *osd;
@@ -168,7 +257,7 @@ public:
   Messenger *&client_messenger;
   PerfCounters *&logger;
   MonClient   *&monc;
-  ThreadPool::WorkQueue<PG> &op_wq;
+  ShardedOpWQ &op_wq;
   ThreadPool::BatchWorkQueue<PG> &peering_wq;
   ThreadPool::WorkQueue<PG> &recovery_wq;
   ThreadPool::WorkQueue<PG> &snap_trim_wq;
@@ -240,8 +329,13 @@ public:
 
   // -- Watch --
   Mutex watch_lock;
-  SafeTimer watch_timer;
+  TimerWheel watch_timer;
   Watch *watch;
+  /// send notifies collected under watch_lock, batched per connection
+  void send_watch_notifies(map<Connection*, list<Message*> >& notifies);
+
+  // -- disk share between client, recovery, scrub, snap trim --
+  WorkScheduler work_sched;
 
   // -- tids --
   // for ops i issue
@@ -266,8 +360,10 @@ public:
   void send_pg_temp();
 
   void queue_for_peering(PG *pg);
-  void queue_for_op(PG *pg);
+  void queue_for_op(PG *pg, unsigned priority = CEPH_MSG_PRIO_DEFAULT);
   bool queue_for_recovery(PG *pg);
+  /// put pg at the front of the recovery queue; client ops wait on it
+  void expedite_recovery(PG *pg);
   bool queue_for_snap_trim(PG *pg) {
     return snap_trim_wq.queue(pg);
   }
@@ -349,6 +445,10 @@ protected:
   Cond dispatch_cond;
   int dispatch_running;
 
+  /// handle_osd_map is decoding maps without osd_lock; shutdown waits
+  bool map_decode_running;
+  Cond map_decode_cond;
+
   void create_logger();
   void tick();
   void _dispatch(Message *m);
@@ -454,6 +554,9 @@ private:
     utime_t last_tx;    ///< last time we sent a ping request
     utime_t last_rx;    ///< last time we got a ping reply
     epoch_t epoch;      ///< most recent epoch we wanted this peer
+    Context *deadline;  ///< grace check pending in heartbeat_timer
+    LatencyHistogram *rtt;  ///< ping round trip times
+    HeartbeatInfo() : con(NULL), epoch(0), deadline(NULL), rtt(NULL) {}
   };
   /// state attached to outgoing heartbeat connections
   struct HeartbeatSession : public RefCountedObject {
@@ -467,17 +570,32 @@ private:
   bool heartbeat_need_update;   ///< true if we need to refresh our heartbeat peers
   epoch_t heartbeat_epoch;      ///< last epoch we updated our heartbeat peers
   map<int,HeartbeatInfo> heartbeat_peers;  ///< map of osd id to HeartbeatInfo
+  TimerWheel heartbeat_timer;   ///< per-peer grace deadlines, under heartbeat_lock
+  LatencyHistogram heartbeat_rtt;  ///< ping round trip times, all peers
   utime_t last_mon_heartbeat;
   Messenger *hbclient_messenger, *hbserver_messenger;
   
   void _add_heartbeat_peer(int p);
+  void _remove_heartbeat_peer(map<int,HeartbeatInfo>::iterator p);
+  void _schedule_heartbeat_deadline(int p, HeartbeatInfo *hi, utime_t when);
   bool heartbeat_reset(Connection *con);
   void maybe_update_heartbeat_peers();
   void reset_heartbeat_peers();
   void heartbeat();
-  void heartbeat_check();
+  void heartbeat_deadline(int p);
+  class C_HeartbeatDeadline : public Context {
+    OSD *osd;
+    int peer;
+  public:
+    C_HeartbeatDeadline(OSD *o, int p) : osd(o), peer(p) {}
+    void finish(int r) {
+      osd->heartbeat_deadline(peer);
+    }
+  };
   void heartbeat_entry();
   void need_heartbeat_peer_update();
+  void dump_heartbeat_latency(ostream& ss);
+  void reset_heartbeat_latency();
 
   struct T_Heartbeat : public Thread {
     OSD *osd;
@@ -541,48 +659,21 @@ private:
   }
   friend class OpsFlightSocketHook;
   friend class HistoricOpsSocketHook;
+  friend class OpLatencySocketHook;
+  friend class NotifyLatencySocketHook;
+  friend class HeartbeatLatencySocketHook;
   OpsFlightSocketHook *admin_ops_hook;
   HistoricOpsSocketHook *historic_ops_hook;
+  OpLatencySocketHook *op_latency_hook;
+  NotifyLatencySocketHook *notify_latency_hook;
+  HeartbeatLatencySocketHook *heartbeat_latency_hook;
 
   // -- op queue --
-  list<PG*> op_queue;
-  int op_queue_len;
-
-  struct OpWQ : public ThreadPool::WorkQueue<PG> {
-    OSD *osd;
-    OpWQ(OSD *o, time_t ti, ThreadPool *tp)
-      : ThreadPool::WorkQueue<PG>("OSD::OpWQ", ti, ti*10, tp), osd(o) {}
-
-    bool _enqueue(PG *pg);
-    void _dequeue(PG *pg) {
-      for (list<PG*>::iterator i = osd->op_queue.begin();
-	   i != osd->op_queue.end();
-	   ) {
-	if (*i == pg) {
-	  osd->op_queue.erase(i++);
-	  pg->put();
-	} else {
-	  ++i;
-	}
-      }
-    }
-    bool _empty() {
-      return osd->op_queue.empty();
-    }
-    PG *_dequeue();
-    void _process(PG *pg) {
-      osd->dequeue_op(pg);
-    }
-    void _clear() {
-      assert(osd->op_queue.empty());
-    }
-  } op_wq;
+  friend class ShardedOpWQ;
+  ShardedOpWQ op_wq;
 
   void enqueue_op(PG *pg, OpRequestRef op);
   void dequeue_op(PG *pg);
-  static void static_dequeueop(OSD *o, PG *pg) {
-    o->dequeue_op(pg);
-  };
 
   // -- peering queue --
   struct PeeringWQ : public ThreadPool::BatchWorkQueue<PG> {
@@ -731,6 +822,7 @@ protected:
   bool  _have_pg(pg_t pgid);
   PG   *_lookup_lock_pg(pg_t pgid);
   PG   *_lookup_lock_pg_with_map_lock_held(pg_t pgid);
+  PG   *_open_pg(OSDMapRef createmap, pg_t pg);
   PG   *_open_lock_pg(OSDMapRef createmap,
 		      pg_t pg, bool no_lockdep_check=false,
 		      bool hold_map_lock=false);
@@ -752,6 +844,20 @@ protected:
   void load_pgs();
   void build_past_intervals_parallel();
 
+  // -- pg loading --
+  struct LoadPGsWQ;
+  friend class LoadPGsSocketHook;
+  Mutex load_pgs_lock;
+  atomic_t load_pgs_total, load_pgs_done;  ///< progress, for the admin socket
+  utime_t load_pgs_time;                   ///< wall clock, whole load_pgs()
+  utime_t load_pgs_list_time;              ///< wall clock, collection listing
+  utime_t load_pgs_read_time;              ///< summed over pgs, info+log read
+  utime_t load_pgs_missing_time;           ///< summed over pgs, missing rebuild
+  LoadPGsSocketHook *load_pgs_hook;
+  void remove_load_pgs_hook();
+  void load_pg_state(PG *pg);
+  void dump_load_pgs(ostream& ss);
+
   void calc_priors_during(pg_t pgid, epoch_t start, epoch_t end, set<int>& pset);
   void project_pg_history(pg_t pgid, pg_history_t& h, epoch_t from,
 			  const vector<int>& lastup, const vector<int>& lastacting);
@@ -999,10 +1105,10 @@ protected:
       if (osd->recovery_queue.empty())
 	return NULL;
       
-      if (!osd->_recover_now())
+      PG *pg = osd->recovery_queue.front();
+      if (!osd->_recover_now(pg->recovery_demanded))
 	return NULL;
 
-      PG *pg = osd->recovery_queue.front();
       osd->recovery_queue.pop_front();
       return pg;
     }
@@ -1012,6 +1118,13 @@ protected:
 	osd->recovery_queue.push_front(&pg->recovery_item);
       }
     }
+    /// move pg to the front, queueing it if need be
+    void _queue_demand(PG *pg) {
+      pg->recovery_demanded = true;
+      if (!pg->recovery_item.is_on_list())
+	pg->get();
+      osd->recovery_queue.push_front(&pg->recovery_item);
+    }
     void _process(PG *pg) {
       osd->do_recovery(pg);
       pg->put();
@@ -1029,7 +1142,7 @@ protected:
   void finish_recovery_op(PG *pg, const hobject_t& soid, bool dequeue);
   void defer_recovery(PG *pg);
   void do_recovery(PG *pg);
-  bool _recover_now();
+  bool _recover_now(bool demanded = false);
 
   // replay / delayed pg activation
   Mutex replay_queue_lock;
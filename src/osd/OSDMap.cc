@@ -645,6 +645,14 @@ void OSDMap::dedup(const OSDMap *o, OSDMap *n)
     n->osd_uuid = o->osd_uuid;
 }
 
+void OSDMap::deepish_copy_from(const OSDMap& o)
+{
+  *this = o;
+  osd_addrs.reset(new addrs_s(*o.osd_addrs));
+  pg_temp.reset(new map<pg_t,vector<int> >(*o.pg_temp));
+  osd_uuid.reset(new vector<uuid_d>(*o.osd_uuid));
+}
+
 int OSDMap::apply_incremental(Incremental &inc)
 {
   if (inc.epoch == 1)
@@ -658,11 +666,41 @@ int OSDMap::apply_incremental(Incremental &inc)
 
   // full map?
   if (inc.fullmap.length()) {
+    crush.reset(new CrushWrapper);  // may be shared with the previous map
     decode(inc.fullmap);
     return 0;
   }
 
   // nope, incremental.
+
+  // which pools' precomputed mappings will this invalidate?
+  set<int64_t> remap_pools;
+  set<int> reweighted_up, reweighted_down;
+  bool remap_all = false;
+  if (pg_mappings_enabled) {
+    for (map<int64_t,pg_pool_t>::iterator p = inc.new_pools.begin();
+	 p != inc.new_pools.end();
+	 p++) {
+      const pg_pool_t *old = get_pg_pool(p->first);
+      if (!old ||
+	  old->get_type() != p->second.get_type() ||
+	  old->get_size() != p->second.get_size() ||
+	  old->get_crush_ruleset() != p->second.get_crush_ruleset() ||
+	  old->get_pgp_num() != p->second.get_pgp_num())
+	remap_pools.insert(p->first);
+    }
+    for (map<int32_t,uint32_t>::iterator i = inc.new_weight.begin();
+	 i != inc.new_weight.end();
+	 i++)
+      if (i->first >= max_osd || i->second > osd_weight[i->first])
+	reweighted_up.insert(i->first);
+      else if (i->second < osd_weight[i->first])
+	reweighted_down.insert(i->first);
+    if (inc.crush.length() ||
+	(inc.new_max_osd >= 0 && inc.new_max_osd < max_osd))
+      remap_all = true;
+  }
+
   if (inc.new_flags >= 0)
     flags = inc.new_flags;
 
@@ -678,6 +716,7 @@ int OSDMap::apply_incremental(Incremental &inc)
     pools.erase(*p);
     name_pool.erase(pool_name[*p]);
     pool_name.erase(*p);
+    pg_mappings.erase(*p);
   }
   for (map<int64_t,pg_pool_t>::iterator p = inc.new_pools.begin();
        p != inc.new_pools.end();
@@ -787,6 +826,22 @@ int OSDMap::apply_incremental(Incremental &inc)
   }
 
   calc_num_osds();
+
+  if (remap_all) {
+    _build_pg_mappings();
+  } else if (pg_mappings_enabled) {
+    for (map<int64_t,pg_pool_t>::iterator p = pools.begin(); p != pools.end(); p++) {
+      // an osd weighted up may now be chosen for any seed; one weighted
+      // down only moves the seeds it was chosen for
+      if (remap_pools.count(p->first) ||
+	  (!reweighted_up.empty() && _rule_reaches_osds(p->second, reweighted_up)))
+	pg_mappings[p->first] = _build_pg_mapping(p->first, p->second);
+      else if (!reweighted_down.empty() &&
+	       _rule_reaches_osds(p->second, reweighted_down))
+	pg_mappings[p->first] = _remap_pg_mapping_rows(p->first, p->second,
+						       reweighted_down);
+    }
+  }
   return 0;
 }
 
@@ -836,20 +891,142 @@ void OSDMap::_remove_nonexistent_osds(vector<int>& osds) const
 
 int OSDMap::_pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const
 {
-  // map to osds[]
-  ps_t pps = pool.raw_pg_to_pps(pg);  // placement ps
-  unsigned size = pool.get_size();
+  map<int64_t, std::tr1::shared_ptr<const pg_mapping_t> >::const_iterator m =
+    pg_mappings.find(pg.pool());
+  if (m != pg_mappings.end() && !m->second->osds.empty()) {
+    // precomputed
+    const pg_mapping_t& pm = *m->second;
+    unsigned seed = ceph_stable_mod(pg.ps(), pool.get_pgp_num(), pool.get_pgp_num_mask());
+    const int32_t *row = &pm.osds[seed * pm.size];
+    osds.clear();
+    for (unsigned i = 0; i < pm.size && row[i] >= 0; i++)
+      osds.push_back(row[i]);
+  } else {
+    // map to osds[]
+    ps_t pps = pool.raw_pg_to_pps(pg);  // placement ps
+    unsigned size = pool.get_size();
 
-  // what crush rule?
-  int ruleno = crush->find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
-  if (ruleno >= 0)
-    crush->do_rule(ruleno, pps, osds, size, osd_weight);
+    // what crush rule?
+    int ruleno = crush->find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
+    if (ruleno >= 0)
+      crush->do_rule(ruleno, pps, osds, size, osd_weight);
+  }
 
   _remove_nonexistent_osds(osds);
 
   return osds.size();
 }
 
+std::tr1::shared_ptr<const OSDMap::pg_mapping_t>
+OSDMap::_build_pg_mapping(int64_t poolid, const pg_pool_t& pool) const
+{
+  pg_mapping_t *pm = new pg_mapping_t;
+  unsigned size = pool.get_size();
+  unsigned num = pool.get_pgp_num();
+  pm->size = size;
+  pm->osds.resize(num * size, -1);
+
+  int ruleno = crush->find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
+  if (ruleno >= 0) {
+    vector<int> out;
+    for (unsigned ps = 0; ps < num; ps++) {
+      crush->do_rule(ruleno, pool.raw_pg_to_pps(pg_t(ps, poolid, -1)),
+		     out, size, osd_weight);
+      for (unsigned i = 0; i < out.size() && i < size; i++)
+	pm->osds[ps * size + i] = out[i];
+    }
+  }
+  return std::tr1::shared_ptr<const pg_mapping_t>(pm);
+}
+
+std::tr1::shared_ptr<const OSDMap::pg_mapping_t>
+OSDMap::_remap_pg_mapping_rows(int64_t poolid, const pg_pool_t& pool,
+			       const set<int>& osds) const
+{
+  map<int64_t, std::tr1::shared_ptr<const pg_mapping_t> >::const_iterator m =
+    pg_mappings.find(poolid);
+  unsigned size = pool.get_size();
+  if (m == pg_mappings.end() || m->second->size != size ||
+      m->second->osds.size() != (size_t)pool.get_pgp_num() * size)
+    return _build_pg_mapping(poolid, pool);
+
+  int ruleno = crush->find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
+  pg_mapping_t *pm = new pg_mapping_t(*m->second);
+  vector<int> out;
+  for (unsigned ps = 0; ps < pool.get_pgp_num(); ps++) {
+    int32_t *row = &pm->osds[ps * size];
+    unsigned i;
+    for (i = 0; i < size && row[i] >= 0; i++)
+      if (osds.count(row[i]))
+	break;
+    if (i == size || row[i] < 0)
+      continue;
+    for (i = 0; i < size; i++)
+      row[i] = -1;
+    if (ruleno < 0)
+      continue;
+    crush->do_rule(ruleno, pool.raw_pg_to_pps(pg_t(ps, poolid, -1)),
+		   out, size, osd_weight);
+    for (i = 0; i < out.size() && i < size; i++)
+      row[i] = out[i];
+  }
+  return std::tr1::shared_ptr<const pg_mapping_t>(pm);
+}
+
+void OSDMap::_build_pg_mappings()
+{
+  pg_mappings.clear();
+  for (map<int64_t,pg_pool_t>::iterator p = pools.begin(); p != pools.end(); p++)
+    pg_mappings[p->first] = _build_pg_mapping(p->first, p->second);
+}
+
+/*
+ * can a change to the weight of any of these osds move a pg of this
+ * pool?  only if one of them is under a bucket the pool's rule takes.
+ */
+bool OSDMap::_rule_reaches_osds(const pg_pool_t& pool, const set<int>& osds) const
+{
+  int ruleno = crush->find_rule(pool.get_crush_ruleset(), pool.get_type(),
+				pool.get_size());
+  if (ruleno < 0)
+    return false;
+  list<int> q;
+  for (int step = 0; step < crush->get_rule_len(ruleno); step++)
+    if (crush->get_rule_op(ruleno, step) == CRUSH_RULE_TAKE)
+      q.push_back(crush->get_rule_arg1(ruleno, step));
+  set<int> seen;
+  while (!q.empty()) {
+    int item = q.front();
+    q.pop_front();
+    if (item >= 0) {
+      if (osds.count(item))
+	return true;
+      continue;
+    }
+    if (!crush->bucket_exists(item) || !seen.insert(item).second)
+      continue;
+    for (int i = 0; i < crush->get_bucket_size(item); i++)
+      q.push_back(crush->get_bucket_item(item, i));
+  }
+  return false;
+}
+
+void OSDMap::build_pg_mappings()
+{
+  pg_mappings_enabled = true;
+  _build_pg_mappings();
+}
+
+void OSDMap::share_pg_mappings(const OSDMap& other)
+{
+  assert(other.epoch == epoch);
+  pg_mappings_enabled = true;
+  if (other.pg_mappings_enabled)
+    pg_mappings = other.pg_mappings;
+  else
+    _build_pg_mappings();
+}
+
 // pg -> (up osd list)
 void OSDMap::_raw_to_up_osds(pg_t pg, vector<int>& raw, vector<int>& up) const
 {
@@ -1152,6 +1329,9 @@ void OSDMap::decode(bufferlist::iterator& p)
     name_pool[i->second] = i->first;
 
   calc_num_osds();
+
+  if (pg_mappings_enabled)
+    _build_pg_mappings();
 }
 
 
@@ -183,6 +183,21 @@ private:
   epoch_t cluster_snapshot_epoch;
   string cluster_snapshot;
 
+  /*
+   * precomputed crush output for every placement seed of a pool: pgp_num
+   * rows of size osds, short rows padded with -1.  never modified once
+   * built, so maps at successive epochs share it until the pool, the
+   * crush map or the weight of an osd under the pool's rule changes.
+   * weighting an osd down only redoes the rows it appears in.
+   */
+  struct pg_mapping_t {
+    unsigned size;
+    vector<int32_t> osds;
+    pg_mapping_t() : size(0) {}
+  };
+  bool pg_mappings_enabled;   // not saved
+  map<int64_t, std::tr1::shared_ptr<const pg_mapping_t> > pg_mappings;  // not saved
+
  public:
   std::tr1::shared_ptr<CrushWrapper> crush;       // hierarchical map
 
@@ -199,6 +214,7 @@ private:
 	     pg_temp(new map<pg_t,vector<int> >),
 	     osd_uuid(new vector<uuid_d>),
 	     cluster_snapshot_epoch(0),
+	     pg_mappings_enabled(false),
 	     crush(new CrushWrapper) {
     memset(&fsid, 0, sizeof(fsid));
   }
@@ -364,6 +380,14 @@ private:
     return -1;
   }
 
+  /**
+   * become a copy of o that apply_incremental() can modify without
+   * touching o.  cheaper than an encode/decode round trip; the crush
+   * map and pg mappings stay shared, as apply_incremental() replaces
+   * rather than modifies them.
+   */
+  void deepish_copy_from(const OSDMap& o);
+
   int apply_incremental(Incremental &inc);
 
   /// try to re-use/reference addrs in oldmap from newmap
@@ -414,7 +438,27 @@ private:
 
   bool _raw_to_temp_osds(const pg_pool_t& pool, pg_t pg, vector<int>& raw, vector<int>& temp) const;
 
+  std::tr1::shared_ptr<const pg_mapping_t> _build_pg_mapping(int64_t poolid,
+							      const pg_pool_t& pool) const;
+  /// copy of the pool's table with the rows that hold any of osds redone
+  std::tr1::shared_ptr<const pg_mapping_t> _remap_pg_mapping_rows(
+    int64_t poolid, const pg_pool_t& pool, const set<int>& osds) const;
+  void _build_pg_mappings();
+  bool _rule_reaches_osds(const pg_pool_t& pool, const set<int>& osds) const;
+
 public:
+  /**
+   * precompute crush output for every pg, so pg_to_* lookups become
+   * table reads.  apply_incremental() and decode() keep the tables
+   * current, recomputing only pools whose placement may have changed.
+   */
+  void build_pg_mappings();
+  /// take the tables of the map we were decoded from, or build our own
+  void share_pg_mappings(const OSDMap& other);
+  bool have_pg_mappings() const {
+    return pg_mappings_enabled;
+  }
+
   int pg_to_osds(pg_t pg, vector<int>& raw) const;
   int pg_to_acting_osds(pg_t pg, vector<int>& acting) const;
   void pg_to_raw_up(pg_t pg, vector<int>& up) const;
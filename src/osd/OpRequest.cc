@@ -20,6 +20,138 @@ static ostream& _prefix(std::ostream* _dout)
   return *_dout << "--OSD::tracker-- ";
 }
 
+const char *op_latency_t::get_phase_name(int p)
+{
+  switch (p) {
+  case PHASE_RECV: return "recv";
+  case PHASE_DISPATCH: return "dispatch";
+  case PHASE_QUEUE: return "queue";
+  case PHASE_GET_OBC: return "get_obc";
+  case PHASE_PREPARE: return "prepare";
+  case PHASE_JOURNAL: return "journal";
+  case PHASE_APPLY: return "apply";
+  case PHASE_REPLICA_COMMIT: return "replica_commit";
+  case PHASE_REPLY: return "reply";
+  case PHASE_TOTAL: return "total";
+  default: return "unknown";
+  }
+}
+
+const char *op_latency_t::get_type_name(int t)
+{
+  switch (t) {
+  case TYPE_READ: return "read";
+  case TYPE_WRITE: return "write";
+  case TYPE_OMAP: return "omap";
+  case TYPE_CALL: return "call";
+  case TYPE_SUBOP: return "subop";
+  case TYPE_OTHER: return "other";
+  default: return "unknown";
+  }
+}
+
+int op_latency_t::get_op_type(Message *m)
+{
+  if (m->get_type() == MSG_OSD_SUBOP)
+    return TYPE_SUBOP;
+  if (m->get_type() != CEPH_MSG_OSD_OP)
+    return TYPE_OTHER;
+
+  MOSDOp *op = static_cast<MOSDOp*>(m);
+  bool omap = false;
+  for (vector<OSDOp>::iterator p = op->ops.begin(); p != op->ops.end(); ++p) {
+    switch (p->op.op) {
+    case CEPH_OSD_OP_CALL:
+      return TYPE_CALL;
+    case CEPH_OSD_OP_OMAPGETKEYS:
+    case CEPH_OSD_OP_OMAPGETVALS:
+    case CEPH_OSD_OP_OMAPGETHEADER:
+    case CEPH_OSD_OP_OMAPGETVALSBYKEYS:
+    case CEPH_OSD_OP_OMAPSETVALS:
+    case CEPH_OSD_OP_OMAPSETHEADER:
+    case CEPH_OSD_OP_OMAPCLEAR:
+    case CEPH_OSD_OP_OMAPRMKEYS:
+      omap = true;
+      break;
+    }
+  }
+  if (omap)
+    return TYPE_OMAP;
+  return (op->get_flags() & CEPH_OSD_FLAG_WRITE) ? TYPE_WRITE : TYPE_READ;
+}
+
+void op_latency_t::add(const OpRequest *op)
+{
+  static const struct {
+    int phase;
+    TrackedOp::event_t event, alt_event;
+    bool last;  ///< use the last time the event was recorded, not the first
+  } milestones[] = {
+    { PHASE_RECV, TrackedOp::EVENT_ALL_READ, TrackedOp::EVENT_NONE, false },
+    { PHASE_DISPATCH, TrackedOp::EVENT_QUEUED_FOR_PG, TrackedOp::EVENT_NONE, false },
+    { PHASE_QUEUE, TrackedOp::EVENT_REACHED_PG, TrackedOp::EVENT_NONE, false },
+    { PHASE_GET_OBC, TrackedOp::EVENT_STARTED, TrackedOp::EVENT_NONE, false },
+    { PHASE_PREPARE, TrackedOp::EVENT_TXN_SUBMITTED, TrackedOp::EVENT_NONE, false },
+    { PHASE_JOURNAL, TrackedOp::EVENT_OP_COMMIT, TrackedOp::EVENT_SUB_OP_COMMIT, false },
+    { PHASE_APPLY, TrackedOp::EVENT_OP_APPLIED, TrackedOp::EVENT_SUB_OP_APPLIED, false },
+    { PHASE_REPLICA_COMMIT, TrackedOp::EVENT_SUB_OP_COMMIT_REC, TrackedOp::EVENT_NONE, true },
+    { PHASE_REPLY, TrackedOp::EVENT_REPLY_SENT, TrackedOp::EVENT_NONE, true },
+  };
+
+  utime_t first[TrackedOp::NUM_EVENTS], last[TrackedOp::NUM_EVENTS];
+  unsigned n = MIN((unsigned)op->num_events.read(), OpRequest::MAX_EVENTS);
+  for (unsigned i = 0; i < n; i++) {
+    TrackedOp::event_t id = op->events[i].id;
+    if (id == TrackedOp::EVENT_NONE)
+      continue;
+    __sync_synchronize();
+    utime_t stamp = op->events[i].stamp;
+    if (first[id] == utime_t() || stamp < first[id])
+      first[id] = stamp;
+    if (stamp > last[id])
+      last[id] = stamp;
+  }
+
+  utime_t start = first[TrackedOp::EVENT_HEADER_READ];
+  if (start == utime_t())
+    return;
+  LatencyHistogram *h = hist[op->op_type];
+  utime_t prev = start;
+  for (unsigned i = 0; i < sizeof(milestones) / sizeof(milestones[0]); i++) {
+    utime_t *stamps = milestones[i].last ? last : first;
+    utime_t stamp = stamps[milestones[i].event];
+    if (stamp == utime_t() && milestones[i].alt_event != TrackedOp::EVENT_NONE)
+      stamp = stamps[milestones[i].alt_event];
+    if (stamp == utime_t() || stamp < prev)
+      continue;
+    h[milestones[i].phase].add(stamp - prev);
+    prev = stamp;
+  }
+  h[PHASE_TOTAL].add(prev - start);
+}
+
+void op_latency_t::reset()
+{
+  for (int t = 0; t < NUM_TYPES; t++)
+    for (int p = 0; p < NUM_PHASES; p++)
+      hist[t][p].reset();
+}
+
+void op_latency_t::dump(Formatter *f) const
+{
+  for (int t = 0; t < NUM_TYPES; t++) {
+    if (!hist[t][PHASE_TOTAL].get_count())
+      continue;
+    f->open_object_section(get_type_name(t));
+    for (int p = 0; p < NUM_PHASES; p++) {
+      f->open_object_section(get_phase_name(p));
+      hist[t][p].dump(f);
+      f->close_section();
+    }
+    f->close_section();
+  }
+}
+
 void OpHistory::insert(utime_t now, OpRequest *op)
 {
   duration.insert(make_pair(op->get_duration(), op));
@@ -71,96 +203,155 @@ void OpHistory::dump_ops(utime_t now, Formatter *f)
 void OpTracker::dump_historic_ops(ostream &ss)
 {
   JSONFormatter jf(true);
-  Mutex::Locker locker(ops_in_flight_lock);
+  Mutex::Locker locker(history_lock);
   utime_t now = ceph_clock_now(g_ceph_context);
   history.dump_ops(now, &jf);
   jf.flush(ss);
 }
 
+void OpTracker::dump_latency(ostream &ss)
+{
+  JSONFormatter jf(true);
+  jf.open_object_section("op_latency");
+  latency.dump(&jf);
+  jf.close_section();
+  jf.flush(ss);
+}
+
+void OpTracker::lock_all_shards()
+{
+  for (unsigned s = 0; s < NUM_SHARDS; s++)
+    shards[s].lock.Lock();
+}
+
+void OpTracker::unlock_all_shards()
+{
+  for (unsigned s = 0; s < NUM_SHARDS; s++)
+    shards[s].lock.Unlock();
+}
+
 void OpTracker::dump_ops_in_flight(ostream &ss)
 {
   JSONFormatter jf(true);
-  Mutex::Locker locker(ops_in_flight_lock);
+  lock_all_shards();
+  int num_ops = 0;
+  for (unsigned s = 0; s < NUM_SHARDS; s++)
+    num_ops += shards[s].ops_in_flight.size();
   jf.open_object_section("ops_in_flight"); // overall dump
-  jf.dump_int("num_ops", ops_in_flight.size());
+  jf.dump_int("num_ops", num_ops);
   jf.open_array_section("ops"); // list of OpRequests
   utime_t now = ceph_clock_now(g_ceph_context);
-  for (xlist<OpRequest*>::iterator p = ops_in_flight.begin(); !p.end(); ++p) {
-    jf.open_object_section("op");
-    (*p)->dump(now, &jf);
-    jf.close_section(); // this OpRequest
+  for (unsigned s = 0; s < NUM_SHARDS; s++) {
+    for (xlist<OpRequest*>::iterator p = shards[s].ops_in_flight.begin(); !p.end(); ++p) {
+      jf.open_object_section("op");
+      (*p)->dump(now, &jf);
+      jf.close_section(); // this OpRequest
+    }
   }
   jf.close_section(); // list of OpRequests
   jf.close_section(); // overall dump
+  unlock_all_shards();
   jf.flush(ss);
 }
 
-void OpTracker::register_inflight_op(xlist<OpRequest*>::item *i)
+void OpTracker::register_inflight_op(OpRequest *op)
 {
-  Mutex::Locker locker(ops_in_flight_lock);
-  ops_in_flight.push_back(i);
-  ops_in_flight.back()->seq = seq++;
+  op->seq = seq.inc();
+  Shard& shard = shards[op->seq % NUM_SHARDS];
+  Mutex::Locker locker(shard.lock);
+  shard.ops_in_flight.push_back(&op->xitem);
 }
 
 void OpTracker::unregister_inflight_op(OpRequest *i)
 {
-  Mutex::Locker locker(ops_in_flight_lock);
-  assert(i->xitem.get_list() == &ops_in_flight);
   utime_t now = ceph_clock_now(g_ceph_context);
-  i->xitem.remove_myself();
+  {
+    Shard& shard = shards[i->seq % NUM_SHARDS];
+    Mutex::Locker locker(shard.lock);
+    assert(i->xitem.get_list() == &shard.ops_in_flight);
+    i->xitem.remove_myself();
+  }
+  if (g_conf->osd_op_latency_stats)
+    latency.add(i);
   i->request->clear_data();
+  Mutex::Locker locker(history_lock);
   history.insert(now, i);
 }
 
 bool OpTracker::check_ops_in_flight(std::vector<string> &warning_vector)
 {
-  Mutex::Locker locker(ops_in_flight_lock);
-  if (!ops_in_flight.size())
-    return false;
-
   utime_t now = ceph_clock_now(g_ceph_context);
   utime_t too_old = now;
   too_old -= g_conf->osd_op_complaint_time;
 
-  utime_t oldest_secs = now - ops_in_flight.front()->received_time;
+  lock_all_shards();
+  int num_ops = 0;
+  utime_t oldest_received = now;
+  for (unsigned s = 0; s < NUM_SHARDS; s++) {
+    xlist<OpRequest*>& ops = shards[s].ops_in_flight;
+    num_ops += ops.size();
+    if (!ops.empty() && ops.front()->received_time < oldest_received)
+      oldest_received = ops.front()->received_time;
+  }
+  if (!num_ops) {
+    unlock_all_shards();
+    return false;
+  }
+
+  utime_t oldest_secs = now - oldest_received;
 
-  dout(10) << "ops_in_flight.size: " << ops_in_flight.size()
+  dout(10) << "ops_in_flight.size: " << num_ops
            << "; oldest is " << oldest_secs
            << " seconds old" << dendl;
 
-  if (oldest_secs < g_conf->osd_op_complaint_time)
+  if (oldest_secs < g_conf->osd_op_complaint_time) {
+    unlock_all_shards();
     return false;
+  }
 
-  xlist<OpRequest*>::iterator i = ops_in_flight.begin();
   warning_vector.reserve(g_conf->osd_op_log_threshold + 1);
 
   int slow = 0;     // total slow
   int warned = 0;   // total logged
-  while (!i.end() && (*i)->received_time < too_old) {
+  // each shard is in arrival order; merge them so we warn about the
+  // oldest ops overall, and stop once every shard's next op is young
+  xlist<OpRequest*>::iterator pos[NUM_SHARDS];
+  for (unsigned s = 0; s < NUM_SHARDS; s++)
+    pos[s] = shards[s].ops_in_flight.begin();
+  while (true) {
+    int oldest = -1;
+    for (unsigned s = 0; s < NUM_SHARDS; s++)
+      if (!pos[s].end() &&
+	  (oldest < 0 || (*pos[s])->received_time < (*pos[oldest])->received_time))
+	oldest = s;
+    if (oldest < 0 || (*pos[oldest])->received_time >= too_old)
+      break;
+    OpRequest *op = *pos[oldest];
+    ++pos[oldest];
     slow++;
 
     // exponential backoff of warning intervals
-    if (((*i)->received_time +
+    if ((op->received_time +
 	 (g_conf->osd_op_complaint_time *
-	  (*i)->warn_interval_multiplier)) < now) {
+	  op->warn_interval_multiplier)) < now) {
       // will warn
       if (warning_vector.empty())
 	warning_vector.push_back("");
       warned++;
       if (warned > g_conf->osd_op_log_threshold)
-        break;
+	break;
 
-      utime_t age = now - (*i)->received_time;
+      utime_t age = now - op->received_time;
       stringstream ss;
-      ss << "slow request " << age << " seconds old, received at " << (*i)->received_time
-          << ": " << *((*i)->request) << " currently " << (*i)->state_string();
+      ss << "slow request " << age << " seconds old, received at " << op->received_time
+	 << ": " << *(op->request) << " currently " << op->state_string();
       warning_vector.push_back(ss.str());
 
       // only those that have been shown will backoff
-      (*i)->warn_interval_multiplier *= 2;
+      op->warn_interval_multiplier *= 2;
     }
-    ++i;
   }
+  unlock_all_shards();
 
   // only summarize if we warn about any.  if everything has backed
   // off, we will stay silent.
@@ -194,35 +385,49 @@ void OpRequest::dump(utime_t now, Formatter *f) const
   }
   {
     f->open_array_section("events");
-    for (list<pair<utime_t, string> >::const_iterator i = events.begin();
-	 i != events.end();
-	 ++i) {
+    unsigned claimed = (unsigned)num_events.read();
+    unsigned n = MIN(claimed, MAX_EVENTS);
+    for (unsigned i = 0; i < n; i++) {
+      event_t id = events[i].id;
+      if (id == EVENT_NONE)
+	continue;  // still being recorded
+      __sync_synchronize();
       f->open_object_section("event");
-      f->dump_stream("time") << i->first;
-      f->dump_string("event", i->second);
+      f->dump_stream("time") << events[i].stamp;
+      f->dump_string("event", get_event_name(id));
       f->close_section();
     }
     f->close_section();
+    if (claimed > MAX_EVENTS)
+      f->dump_unsigned("events_dropped", claimed - MAX_EVENTS);
   }
 }
 
-void OpTracker::mark_event(OpRequest *op, const string &dest)
+double OpRequest::get_duration() const
 {
-  utime_t now = ceph_clock_now(g_ceph_context);
-  return _mark_event(op, dest, now);
+  utime_t last = received_time;
+  unsigned n = MIN((unsigned)num_events.read(), MAX_EVENTS);
+  for (unsigned i = 0; i < n; i++) {
+    if (events[i].id == EVENT_NONE)
+      continue;
+    __sync_synchronize();
+    if (events[i].stamp > last)
+      last = events[i].stamp;
+  }
+  return last - received_time;
 }
 
-void OpTracker::_mark_event(OpRequest *op, const string &evt,
+void OpTracker::_mark_event(OpRequest *op, TrackedOp::event_t evt,
 			    utime_t time)
 {
-  Mutex::Locker locker(ops_in_flight_lock);
+  op->record_event(evt, time);
   dout(5) << "reqid: " << op->get_reqid() << ", seq: " << op->seq
-	  << ", time: " << time << ", event: " << evt
+	  << ", time: " << time << ", event: " << TrackedOp::get_event_name(evt)
 	  << ", request: " << *op->request << dendl;
 }
 
 void OpTracker::RemoveOnDelete::operator()(OpRequest *op) {
-  op->mark_event("done");
+  op->mark_event(TrackedOp::EVENT_DONE);
   tracker->unregister_inflight_op(op);
   // Do not delete op, unregister_inflight_op took control
 }
@@ -237,19 +442,26 @@ OpRequestRef OpTracker::create_request(Message *ref)
   } else if (ref->get_type() == MSG_OSD_SUBOP) {
     retval->reqid = static_cast<MOSDSubOp*>(ref)->reqid;
   }
-  _mark_event(retval.get(), "header_read", ref->get_recv_stamp());
-  _mark_event(retval.get(), "throttled", ref->get_throttle_stamp());
-  _mark_event(retval.get(), "all_read", ref->get_recv_complete_stamp());
-  _mark_event(retval.get(), "dispatched", ref->get_dispatch_stamp());
+  retval->op_type = op_latency_t::get_op_type(ref);
+  _mark_event(retval.get(), TrackedOp::EVENT_HEADER_READ, ref->get_recv_stamp());
+  _mark_event(retval.get(), TrackedOp::EVENT_THROTTLED, ref->get_throttle_stamp());
+  _mark_event(retval.get(), TrackedOp::EVENT_ALL_READ, ref->get_recv_complete_stamp());
+  _mark_event(retval.get(), TrackedOp::EVENT_DISPATCHED, ref->get_dispatch_stamp());
   return retval;
 }
 
-void OpRequest::mark_event(const string &event)
+void OpRequest::record_event(event_t event, utime_t stamp)
+{
+  unsigned i = num_events.inc() - 1;
+  if (i >= MAX_EVENTS)
+    return;
+  events[i].stamp = stamp;
+  __sync_synchronize();  // publish the stamp before the id
+  events[i].id = event;
+}
+
+void OpRequest::mark_event(event_t event)
 {
   utime_t now = ceph_clock_now(g_ceph_context);
-  {
-    Mutex::Locker l(lock);
-    events.push_back(make_pair(now, event));
-  }
-  tracker->mark_event(this, event);
+  tracker->_mark_event(this, event, now);
 }
@@ -19,13 +19,60 @@
 
 #include <include/utime.h>
 #include "common/Mutex.h"
+#include "include/atomic.h"
 #include "include/xlist.h"
 #include "msg/Message.h"
 #include <tr1/memory>
 #include "common/TrackedOp.h"
+#include "common/LatencyHistogram.h"
 #include "osd/osd_types.h"
 
 class OpRequest;
+
+/**
+ * op latency histograms, by op type and phase
+ *
+ * When an op finishes its events are folded into these.  The phases
+ * follow an op through the OSD: received, queued for its pg, pg
+ * locked, object context loaded, transaction submitted, journaled,
+ * applied, replicas committed, reply sent.  Each phase runs from the
+ * previous milestone the op reached to this one; milestones an op
+ * skips (reads never journal) or reaches out of order (applied before
+ * journaled) are left out, so the phases of one op add up to its total.
+ */
+struct op_latency_t {
+  enum {
+    PHASE_RECV,            ///< header read until fully read
+    PHASE_DISPATCH,        ///< fully read until queued for the pg
+    PHASE_QUEUE,           ///< queued until the pg lock is taken
+    PHASE_GET_OBC,         ///< loading the object context
+    PHASE_PREPARE,         ///< executing ops until the transaction is submitted
+    PHASE_JOURNAL,         ///< submitted until locally committed
+    PHASE_APPLY,           ///< committed until applied
+    PHASE_REPLICA_COMMIT,  ///< until the last replica commit arrives
+    PHASE_REPLY,           ///< until the (last) reply is sent
+    PHASE_TOTAL,           ///< received until the last milestone
+    NUM_PHASES
+  };
+  enum {
+    TYPE_READ,
+    TYPE_WRITE,
+    TYPE_OMAP,   ///< has an omap op
+    TYPE_CALL,   ///< has a class method call
+    TYPE_SUBOP,
+    TYPE_OTHER,
+    NUM_TYPES
+  };
+  LatencyHistogram hist[NUM_TYPES][NUM_PHASES];
+
+  static const char *get_phase_name(int p);
+  static const char *get_type_name(int t);
+  static int get_op_type(Message *m);
+  void add(const OpRequest *op);
+  void reset();
+  void dump(ceph::Formatter *f) const;
+};
+
 class OpHistory {
   set<pair<utime_t, const OpRequest *> > arrived;
   set<pair<double, const OpRequest *> > duration;
@@ -46,17 +93,35 @@ class OpTracker {
     void operator()(OpRequest *op);
   };
   friend class RemoveOnDelete;
-  uint64_t seq;
-  Mutex ops_in_flight_lock;
-  xlist<OpRequest *> ops_in_flight;
+
+  /// in-flight ops are spread over shards by seq so registering and
+  /// unregistering only contend with a fraction of the other ops
+  static const unsigned NUM_SHARDS = 8;
+  struct Shard {
+    Mutex lock;
+    xlist<OpRequest *> ops_in_flight;
+    Shard() : lock("OpTracker::Shard::lock") {}
+  };
+  atomic_t seq;
+  Shard shards[NUM_SHARDS];
+  Mutex history_lock;
   OpHistory history;
+  op_latency_t latency;
+
+  /// readers that walk every shard take the locks in index order
+  void lock_all_shards();
+  void unlock_all_shards();
 
 public:
-  OpTracker() : seq(0), ops_in_flight_lock("OpTracker mutex") {}
+  OpTracker() : history_lock("OpTracker::history_lock") {}
   void dump_ops_in_flight(std::ostream& ss);
   void dump_historic_ops(std::ostream& ss);
-  void register_inflight_op(xlist<OpRequest*>::item *i);
-  void unregister_inflight_op(OpRequest *i);
+  void dump_latency(std::ostream& ss);
+  void reset_latency() {
+    latency.reset();
+  }
+  void register_inflight_op(OpRequest *op);
+  void unregister_inflight_op(OpRequest *op);
 
   /**
    * Look for Ops which are too old, and insert warning
@@ -67,8 +132,7 @@ public:
    * @return True if there are any Ops to warn on, false otherwise.
    */
   bool check_ops_in_flight(std::vector<string> &warning_strings);
-  void mark_event(OpRequest *op, const string &evt);
-  void _mark_event(OpRequest *op, const string &evt, utime_t now);
+  void _mark_event(OpRequest *op, TrackedOp::event_t evt, utime_t now);
   OpRequestRef create_request(Message *req);
 };
 
@@ -82,6 +146,7 @@ public:
 struct OpRequest : public TrackedOp {
   friend class OpTracker;
   friend class OpHistory;
+  friend struct op_latency_t;
   Message *request;
   xlist<OpRequest*>::item xitem;
   utime_t received_time;
@@ -89,20 +154,29 @@ struct OpRequest : public TrackedOp {
   utime_t get_arrived() const {
     return received_time;
   }
-  double get_duration() const {
-    return events.size() ?
-      (events.rbegin()->first - received_time) :
-      0.0;
-  }
+  double get_duration() const;
   void dump(utime_t now, Formatter *f) const;
 private:
-  list<pair<utime_t, string> > events;
-  Mutex lock;
+  /**
+   * Events live in a fixed array.  A marker claims a slot with an
+   * atomic increment, writes the stamp and then publishes the id, so
+   * readers skip slots still being filled and nobody takes a lock.
+   * Events past MAX_EVENTS are only counted.
+   */
+  struct Event {
+    utime_t stamp;
+    volatile event_t id;
+    Event() : id(EVENT_NONE) {}
+  };
+  static const unsigned MAX_EVENTS = 32;
+  Event events[MAX_EVENTS];
+  atomic_t num_events;  ///< slots claimed, including dropped events
   OpTracker *tracker;
   osd_reqid_t reqid;
   uint8_t hit_flag_points;
   uint8_t latest_flag_point;
   uint64_t seq;
+  uint8_t op_type;  ///< op_latency_t::TYPE_*
   static const uint8_t flag_queued_for_pg=1 << 0;
   static const uint8_t flag_reached_pg =  1 << 1;
   static const uint8_t flag_delayed =     1 << 2;
@@ -112,12 +186,16 @@ private:
   OpRequest(Message *req, OpTracker *tracker) :
     request(req), xitem(this),
     warn_interval_multiplier(1),
-    lock("OpRequest::lock"),
     tracker(tracker),
-    seq(0) {
+    hit_flag_points(0),
+    latest_flag_point(0),
+    seq(0),
+    op_type(op_latency_t::TYPE_OTHER) {
     received_time = request->get_recv_stamp();
-    tracker->register_inflight_op(&xitem);
+    tracker->register_inflight_op(this);
   }
+
+  void record_event(event_t event, utime_t stamp);
 public:
   ~OpRequest() {
     assert(request);
@@ -148,12 +226,12 @@ public:
   }
 
   void mark_queued_for_pg() {
-    mark_event("queued_for_pg");
+    mark_event(EVENT_QUEUED_FOR_PG);
     hit_flag_points |= flag_queued_for_pg;
     latest_flag_point = flag_queued_for_pg;
   }
   void mark_reached_pg() {
-    mark_event("reached_pg");
+    mark_event(EVENT_REACHED_PG);
     hit_flag_points |= flag_reached_pg;
     latest_flag_point = flag_reached_pg;
   }
@@ -162,17 +240,17 @@ public:
     latest_flag_point = flag_delayed;
   }
   void mark_started() {
-    mark_event("started");
+    mark_event(EVENT_STARTED);
     hit_flag_points |= flag_started;
     latest_flag_point = flag_started;
   }
   void mark_sub_op_sent() {
-    mark_event("sub_op_sent");
+    mark_event(EVENT_SUB_OP_SENT);
     hit_flag_points |= flag_sub_op_sent;
     latest_flag_point = flag_sub_op_sent;
   }
 
-  void mark_event(const string &event);
+  void mark_event(event_t event);
   osd_reqid_t get_reqid() const {
     return reqid;
   }
@@ -18,6 +18,7 @@
 #include "OpRequest.h"
 
 #include "common/Timer.h"
+#include "common/errno.h"
 
 #include "messages/MOSDOp.h"
 #include "messages/MOSDPGNotify.h"
@@ -61,9 +62,11 @@ PG::PG(OSDService *o, OSDMapRef curmap,
   osd(o), osdmap_ref(curmap), pool(_pool),
   _lock("PG::_lock"),
   ref(0), deleting(false), dirty_info(false), dirty_log(false),
+  dirty_big_info(true),
   info(p), coll(p), log_oid(loid), biginfo_oid(ioid),
   recovery_item(this), scrub_item(this), scrub_finalize_item(this), snap_trim_item(this), stat_queue_item(this),
   recovery_ops_active(0),
+  recovery_demanded(false),
   waiting_on_backfill(0),
   role(0),
   state(0),
@@ -74,7 +77,7 @@ PG::PG(OSDService *o, OSDMapRef curmap,
   heartbeat_peer_lock("PG::heartbeat_peer_lock"),
   backfill_target(-1),
   pg_stats_lock("PG::pg_stats_lock"),
-  pg_stats_valid(false),
+  pg_stats_valid(false), pg_stats_acked_valid(false),
   osr(osd->osr_registry.lookup_or_create(p, (stringify(p)))),
   finish_sync_event(NULL),
   finalizing_scrub(false),
@@ -83,6 +86,9 @@ PG::PG(OSDService *o, OSDMapRef curmap,
   scrub_reserved(false), scrub_reserve_failed(false),
   scrub_waiting_on(0),
   active_rep_scrub(0),
+  scrub_chunky(false),
+  scrub_chunk_state(SCRUB_CHUNK_NEW),
+  scrub_errors(0), scrub_fixed(0),
   recovery_state(this)
 {
 }
@@ -837,6 +843,7 @@ void PG::generate_past_intervals()
 
   // record our work.
   dirty_info = true;
+  dirty_big_info = true;
 }
 
 /*
@@ -853,6 +860,7 @@ void PG::trim_past_intervals()
       return;
     dout(10) << __func__ << ": trimming " << pif->second << dendl;
     past_intervals.erase(pif++);
+    dirty_big_info = true;
   }
 }
 
@@ -2033,6 +2041,7 @@ void PG::init(int role, vector<int>& newup, vector<int>& newacting, pg_history_t
 
   info.history = history;
   past_intervals.swap(pi);
+  dirty_big_info = true;
 
   info.stats.up = up;
   info.stats.acting = acting;
@@ -2044,22 +2053,40 @@ void PG::init(int role, vector<int>& newup, vector<int>& newacting, pg_history_t
   write_log(*t);
 }
 
+/*
+ * On-disk layout (struct_v 5):
+ *
+ *  - coll attr "info": struct_v
+ *  - biginfo_oid data: past_intervals, snap_collections
+ *  - biginfo_oid omap "info": pg_info_t
+ *
+ * pg_info_t changes with nearly every op, but past_intervals and
+ * snap_collections only change on peering and snap create/trim and can
+ * get large, so the latter are only rewritten when dirty_big_info is
+ * set.
+ */
 void PG::write_info(ObjectStore::Transaction& t)
 {
-  // pg state
-  bufferlist infobl;
-  __u8 struct_v = 4;
-  ::encode(struct_v, infobl);
-  t.collection_setattr(coll, "info", infobl);
- 
-  // potentially big stuff
-  bufferlist bigbl;
-  ::encode(past_intervals, bigbl);
-  ::encode(snap_collections, bigbl);
-  ::encode(info, bigbl);
-  dout(20) << "write_info bigbl " << bigbl.length() << dendl;
-  t.truncate(coll_t::META_COLL, biginfo_oid, 0);
-  t.write(coll_t::META_COLL, biginfo_oid, 0, bigbl.length(), bigbl);
+  if (dirty_big_info) {
+    // pg state
+    bufferlist infobl;
+    __u8 struct_v = 5;
+    ::encode(struct_v, infobl);
+    t.collection_setattr(coll, "info", infobl);
+
+    // potentially big stuff
+    bufferlist bigbl;
+    ::encode(past_intervals, bigbl);
+    ::encode(snap_collections, bigbl);
+    dout(20) << "write_info bigbl " << bigbl.length() << dendl;
+    t.truncate(coll_t::META_COLL, biginfo_oid, 0);
+    t.write(coll_t::META_COLL, biginfo_oid, 0, bigbl.length(), bigbl);
+    dirty_big_info = false;
+  }
+
+  map<string,bufferlist> keys;
+  ::encode(info, keys["info"]);
+  t.omap_setkeys(coll_t::META_COLL, biginfo_oid, keys);
 
   dirty_info = false;
 }
@@ -2068,30 +2095,26 @@ void PG::write_log(ObjectStore::Transaction& t)
 {
   dout(10) << "write_log" << dendl;
 
-  // assemble buffer
-  bufferlist bl;
-
-  // build buffer
-  ondisklog.tail = 0;
+  // one omap key per entry
+  map<string,bufferlist> keys;
+  ondisklog.tail = ondisklog.head = 0;
   for (list<pg_log_entry_t>::iterator p = log.log.begin();
        p != log.log.end();
        p++) {
-    uint64_t startoff = bl.length();
-
     bufferlist ebl(sizeof(*p)*2);
     ::encode(*p, ebl);
-    __u32 crc = ebl.crc32c(0);
-    ::encode(ebl, bl);
-    ::encode(crc, bl);
-
-    p->offset = startoff;
+    p->offset = ondisklog.head;
+    ondisklog.head += ebl.length();
+    keys[p->version.get_key_name()].claim(ebl);
   }
-  ondisklog.head = bl.length();
+  ondisklog.zero_to = 0;
   ondisklog.has_checksums = true;
+  ondisklog.in_omap = true;
 
   // write it
-  t.remove(coll_t::META_COLL, log_oid );
-  t.write(coll_t::META_COLL, log_oid , 0, bl.length(), bl);
+  t.remove(coll_t::META_COLL, log_oid);
+  t.touch(coll_t::META_COLL, log_oid);
+  t.omap_setkeys(coll_t::META_COLL, log_oid, keys);
 
   bufferlist blb(sizeof(ondisklog));
   ::encode(ondisklog, blb);
@@ -2117,8 +2140,15 @@ void PG::trim(ObjectStore::Transaction& t, eversion_t trim_to)
     assert(trim_to <= info.last_complete);
 
     dout(10) << "trim " << log << " to " << trim_to << dendl;
+    set<string> keys;
+    for (list<pg_log_entry_t>::iterator p = log.log.begin();
+	 p != log.log.end() && p->version <= trim_to;
+	 ++p)
+      keys.insert(p->version.get_key_name());
     log.trim(t, trim_to);
     info.log_tail = log.tail;
+    if (!g_conf->osd_preserve_trimmed_log)
+      t.omap_rmkeys(coll_t::META_COLL, log_oid, keys);
     trim_ondisklog(t);
   }
 }
@@ -2131,28 +2161,12 @@ void PG::trim_ondisklog(ObjectStore::Transaction& t)
   } else {
     new_tail = log.log.front().offset;
   }
-  bool same_block = (new_tail & ~4095) == (ondisklog.tail & ~4095);
   dout(15) << "trim_ondisklog tail " << ondisklog.tail << " -> " << new_tail
 	   << ", now " << new_tail << "~" << (ondisklog.head - new_tail)
-	   << " " << (same_block ? "(same block)" : "(different block)")
 	   << dendl;
   assert(new_tail >= ondisklog.tail);
-  
-  if (same_block)
-    return;
-
   ondisklog.tail = new_tail;
 
-  if (!g_conf->osd_preserve_trimmed_log) {
-    uint64_t zt = new_tail & ~4095;
-    if (zt > ondisklog.zero_to) {
-      t.zero(coll_t::META_COLL, log_oid, ondisklog.zero_to, zt - ondisklog.zero_to);
-      dout(15) << "trim_ondisklog zeroing from " << ondisklog.zero_to
-	       << " to " << zt << dendl;
-      ondisklog.zero_to = zt;
-    }
-  }
-
   bufferlist blb(sizeof(ondisklog));
   ::encode(ondisklog, blb);
   t.collection_setattr(coll, "ondisklog", blb);
@@ -2182,15 +2196,7 @@ void PG::add_log_entry(pg_log_entry_t& e, bufferlist& log_bl)
 
   // log mutation
   log.add(e);
-  if (ondisklog.has_checksums) {
-    bufferlist ebl(sizeof(e)*2);
-    ::encode(e, ebl);
-    __u32 crc = ebl.crc32c(0);
-    ::encode(ebl, log_bl);
-    ::encode(crc, log_bl);
-  } else {
-    ::encode(e, log_bl);
-  }
+  ::encode(e, log_bl);
   dout(10) << "add_log_entry " << e << dendl;
 }
 
@@ -2199,19 +2205,23 @@ void PG::append_log(vector<pg_log_entry_t>& logv, eversion_t trim_to, ObjectStor
 {
   dout(10) << "append_log " << log << " " << logv << dendl;
 
-  bufferlist bl;
+  map<string,bufferlist> keys;
+  uint64_t len = 0;
   for (vector<pg_log_entry_t>::iterator p = logv.begin();
        p != logv.end();
        p++) {
-    p->offset = ondisklog.head + bl.length();
+    p->offset = ondisklog.head + len;
+    bufferlist bl(sizeof(*p)*2);
     add_log_entry(*p, bl);
+    len += bl.length();
+    keys[p->version.get_key_name()].claim(bl);
   }
 
   dout(10) << "append_log  " << ondisklog.tail << "~" << ondisklog.length()
-	   << " adding " << bl.length() << dendl;
+	   << " adding " << len << dendl;
 
-  t.write(coll_t::META_COLL, log_oid, ondisklog.head, bl.length(), bl );
-  ondisklog.head += bl.length();
+  t.omap_setkeys(coll_t::META_COLL, log_oid, keys);
+  ondisklog.head += len;
 
   bufferlist blb(sizeof(ondisklog));
   ::encode(ondisklog, blb);
@@ -2224,7 +2234,119 @@ void PG::append_log(vector<pg_log_entry_t>& logv, eversion_t trim_to, ObjectStor
   write_info(t);
 }
 
-void PG::read_log(ObjectStore *store)
+/*
+ * Decode a pre-v5 log (a flat byte stream in log_oid's data) into
+ * entries, stopping at info.last_update.
+ *
+ * @return true if there was extra data past last_update
+ */
+bool PG::read_log_entries_legacy(ObjectStore *store, list<pg_log_entry_t>& entries)
+{
+  if (ondisklog.head == 0)
+    return false;
+
+  // read
+  bufferlist bl;
+  store->read(coll_t::META_COLL, log_oid, ondisklog.tail, ondisklog.length(), bl);
+  if (bl.length() < ondisklog.length()) {
+    std::ostringstream oss;
+    oss << "read_log got " << bl.length() << " bytes, expected "
+	<< ondisklog.head << "-" << ondisklog.tail << "="
+	<< ondisklog.length();
+    throw read_log_error(oss.str().c_str());
+  }
+
+  bufferlist::iterator p = bl.begin();
+  while (!p.end()) {
+    uint64_t pos = ondisklog.tail + p.get_off();
+    pg_log_entry_t e;
+    if (ondisklog.has_checksums) {
+      bufferlist ebl;
+      ::decode(ebl, p);
+      __u32 crc;
+      ::decode(crc, p);
+
+      __u32 got = ebl.crc32c(0);
+      if (crc == got) {
+	bufferlist::iterator q = ebl.begin();
+	::decode(e, q);
+      } else {
+	std::ostringstream oss;
+	oss << "read_log " << pos << " bad crc got " << got << " expected" << crc;
+	throw read_log_error(oss.str().c_str());
+      }
+    } else {
+      ::decode(e, p);
+    }
+    e.offset = pos;
+    entries.push_back(e);
+
+    // [repair] at end of log?
+    if (!p.end() && e.version == info.last_update) {
+      uint64_t endpos = ondisklog.tail + p.get_off();
+      osd->clog.error() << info.pgid << " log has extra data at "
+			<< endpos << "~" << (ondisklog.head-endpos) << " after "
+			<< info.last_update << "\n";
+
+      dout(0) << "read_log " << endpos << " *** extra gunk at end of log, "
+	      << "adjusting ondisklog.head" << dendl;
+      ondisklog.head = endpos;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Scan the omap keys of log_oid, in eversion order, into entries,
+ * skipping anything at or below log.tail and stopping at
+ * info.last_update.
+ *
+ * @return true if there were entries past last_update
+ */
+bool PG::read_log_entries_omap(ObjectStore *store, list<pg_log_entry_t>& entries)
+{
+  ObjectMap::ObjectMapIterator it =
+    store->get_omap_iterator(coll_t::META_COLL, log_oid);
+  if (!it)
+    throw read_log_error("unable to iterate log omap");
+
+  uint64_t pos = ondisklog.tail;
+  for (it->seek_to_first(); it->valid(); it->next()) {
+    bufferlist bl = it->value();
+    bufferlist::iterator p = bl.begin();
+    pg_log_entry_t e;
+    ::decode(e, p);
+    if (e.version <= log.tail) {
+      dout(20) << "read_log  ignoring entry " << it->key() << " below log.tail" << dendl;
+      continue;
+    }
+    e.offset = pos;
+    pos += bl.length();
+    entries.push_back(e);
+
+    if (e.version == info.last_update) {
+      it->next();
+      if (it->valid()) {
+	osd->clog.error() << info.pgid << " log has extra entries from "
+			  << it->key() << " after " << info.last_update << "\n";
+	dout(0) << "read_log *** extra entries at end of log from " << it->key()
+		<< dendl;
+	ondisklog.head = pos;
+	return true;
+      }
+      break;
+    }
+  }
+  if (it->status() < 0) {
+    std::ostringstream oss;
+    oss << "read_log omap iteration failed: " << it->status();
+    throw read_log_error(oss.str().c_str());
+  }
+  return false;
+}
+
+void PG::read_log(ObjectStore *store, utime_t *missing_time)
 {
   // load bounds
   ondisklog.tail = ondisklog.head = 0;
@@ -2234,134 +2356,107 @@ void PG::read_log(ObjectStore *store)
   bufferlist::iterator p = blb.begin();
   ::decode(ondisklog, p);
 
-  dout(10) << "read_log " << ondisklog.tail << "~" << ondisklog.length() << dendl;
+  dout(10) << "read_log " << ondisklog.tail << "~" << ondisklog.length()
+	   << (ondisklog.in_omap ? "" : " (legacy)") << dendl;
 
   log.tail = info.log_tail;
 
+  list<pg_log_entry_t> entries;
+  bool truncated;
+  if (ondisklog.in_omap)
+    truncated = read_log_entries_omap(store, entries);
+  else
+    truncated = read_log_entries_legacy(store, entries);
+
   // In case of sobject_t based encoding, may need to list objects in the store
   // to find hashes
   bool listed_collection = false;
   vector<hobject_t> ls;
-  
-  if (ondisklog.head > 0) {
-    // read
-    bufferlist bl;
-    store->read(coll_t::META_COLL, log_oid, ondisklog.tail, ondisklog.length(), bl);
-    if (bl.length() < ondisklog.length()) {
-      std::ostringstream oss;
-      oss << "read_log got " << bl.length() << " bytes, expected "
-	  << ondisklog.head << "-" << ondisklog.tail << "="
-	  << ondisklog.length();
-      throw read_log_error(oss.str().c_str());
+
+  assert(log.empty());
+  eversion_t last;
+  bool reorder = false;
+  for (list<pg_log_entry_t>::iterator i = entries.begin(); i != entries.end(); ++i) {
+    pg_log_entry_t &e = *i;
+    uint64_t pos = e.offset;
+    dout(20) << "read_log " << pos << " " << e << dendl;
+
+    // [repair] in order?
+    if (e.version < last) {
+      dout(0) << "read_log " << pos << " out of order entry " << e << " follows " << last << dendl;
+      osd->clog.error() << info.pgid << " log has out of order entry "
+	    << e << " following " << last << "\n";
+      reorder = true;
     }
-    
-    pg_log_entry_t e;
-    bufferlist::iterator p = bl.begin();
-    assert(log.empty());
-    eversion_t last;
-    bool reorder = false;
-    while (!p.end()) {
-      uint64_t pos = ondisklog.tail + p.get_off();
-      if (ondisklog.has_checksums) {
-	bufferlist ebl;
-	::decode(ebl, p);
-	__u32 crc;
-	::decode(crc, p);
-	
-	__u32 got = ebl.crc32c(0);
-	if (crc == got) {
-	  bufferlist::iterator q = ebl.begin();
-	  ::decode(e, q);
-	} else {
-	  std::ostringstream oss;
-	  oss << "read_log " << pos << " bad crc got " << got << " expected" << crc;
-	  throw read_log_error(oss.str().c_str());
-	}
-      } else {
-	::decode(e, p);
-      }
-      dout(20) << "read_log " << pos << " " << e << dendl;
-
-      // [repair] in order?
-      if (e.version < last) {
-	dout(0) << "read_log " << pos << " out of order entry " << e << " follows " << last << dendl;
-	osd->clog.error() << info.pgid << " log has out of order entry "
-	      << e << " following " << last << "\n";
-	reorder = true;
-      }
 
-      if (e.version <= log.tail) {
-	dout(20) << "read_log  ignoring entry at " << pos << " below log.tail" << dendl;
-	continue;
-      }
-      if (last.version == e.version.version) {
-	dout(0) << "read_log  got dup " << e.version << " (last was " << last << ", dropping that one)" << dendl;
-	log.log.pop_back();
-	osd->clog.error() << info.pgid << " read_log got dup "
-	      << e.version << " after " << last << "\n";
-      }
+    if (e.version <= log.tail) {
+      dout(20) << "read_log  ignoring entry at " << pos << " below log.tail" << dendl;
+      continue;
+    }
+    if (last.version == e.version.version) {
+      dout(0) << "read_log  got dup " << e.version << " (last was " << last << ", dropping that one)" << dendl;
+      log.log.pop_back();
+      osd->clog.error() << info.pgid << " read_log got dup "
+	    << e.version << " after " << last << "\n";
+    }
 
-      if (e.invalid_hash) {
-	// We need to find the object in the store to get the hash
-	if (!listed_collection) {
-	  store->collection_list(coll, ls);
-	  listed_collection = true;
-	}
-	bool found = false;
-	for (vector<hobject_t>::iterator i = ls.begin();
-	     i != ls.end();
-	     ++i) {
-	  if (i->oid == e.soid.oid && i->snap == e.soid.snap) {
-	    e.soid = *i;
-	    found = true;
-	    break;
-	  }
-	}
-	if (!found) {
-	  // Didn't find the correct hash
-	  std::ostringstream oss;
-	  oss << "Could not find hash for hoid " << e.soid << std::endl;
-	  throw read_log_error(oss.str().c_str());
-	}
+    if (e.invalid_hash) {
+      // We need to find the object in the store to get the hash
+      if (!listed_collection) {
+	store->collection_list(coll, ls);
+	listed_collection = true;
       }
-
-      if (e.invalid_pool) {
-	e.soid.pool = info.pgid.pool();
+      bool found = false;
+      for (vector<hobject_t>::iterator i = ls.begin();
+	   i != ls.end();
+	   ++i) {
+	if (i->oid == e.soid.oid && i->snap == e.soid.snap) {
+	  e.soid = *i;
+	  found = true;
+	  break;
+	}
       }
-
-      e.offset = pos;
-      uint64_t endpos = ondisklog.tail + p.get_off();
-      log.log.push_back(e);
-      last = e.version;
-
-      // [repair] at end of log?
-      if (!p.end() && e.version == info.last_update) {
-	osd->clog.error() << info.pgid << " log has extra data at "
-	   << endpos << "~" << (ondisklog.head-endpos) << " after "
-	   << info.last_update << "\n";
-
-	dout(0) << "read_log " << endpos << " *** extra gunk at end of log, "
-	        << "adjusting ondisklog.head" << dendl;
-	ondisklog.head = endpos;
-	break;
+      if (!found) {
+	// Didn't find the correct hash
+	std::ostringstream oss;
+	oss << "Could not find hash for hoid " << e.soid << std::endl;
+	throw read_log_error(oss.str().c_str());
       }
     }
-  
-    if (reorder) {
-      dout(0) << "read_log reordering log" << dendl;
-      map<eversion_t, pg_log_entry_t> m;
-      for (list<pg_log_entry_t>::iterator p = log.log.begin(); p != log.log.end(); p++)
-	m[p->version] = *p;
-      log.log.clear();
-      for (map<eversion_t, pg_log_entry_t>::iterator p = m.begin(); p != m.end(); p++)
-	log.log.push_back(p->second);
+
+    if (e.invalid_pool) {
+      e.soid.pool = info.pgid.pool();
     }
+
+    log.log.push_back(e);
+    last = e.version;
+  }
+
+  if (reorder) {
+    dout(0) << "read_log reordering log" << dendl;
+    map<eversion_t, pg_log_entry_t> m;
+    for (list<pg_log_entry_t>::iterator p = log.log.begin(); p != log.log.end(); p++)
+      m[p->version] = *p;
+    log.log.clear();
+    for (map<eversion_t, pg_log_entry_t>::iterator p = m.begin(); p != m.end(); p++)
+      log.log.push_back(p->second);
   }
 
   log.head = info.last_update;
   log.index();
 
+  // convert a legacy log, or drop the entries past last_update
+  if (!ondisklog.in_omap || truncated || reorder) {
+    dout(0) << "read_log rewriting log as omap entries" << dendl;
+    ObjectStore::Transaction t;
+    write_log(t);
+    store->apply_transaction(t);
+  }
+
   // build missing
+  utime_t missing_start;
+  if (missing_time)
+    missing_start = ceph_clock_now(g_ceph_context);
   if (info.last_complete < info.last_update) {
     dout(10) << "read_log checking for missing items over interval (" << info.last_complete
 	     << "," << info.last_update << "]" << dendl;
@@ -2390,6 +2485,8 @@ void PG::read_log(ObjectStore *store)
       }
     }
   }
+  if (missing_time)
+    *missing_time = ceph_clock_now(g_ceph_context) - missing_start;
   dout(10) << "read_log done" << dendl;
 }
 
@@ -2408,7 +2505,36 @@ bool PG::check_log_for_corruption(ObjectStore *store)
 
   bool ok = true;
   uint64_t pos = 0;
-  if (bounds.head > 0) {
+  if (bounds.in_omap) {
+    ObjectMap::ObjectMapIterator it =
+      store->get_omap_iterator(coll_t::META_COLL, log_oid);
+    if (!it) {
+      ss << "unable to iterate omap";
+      ok = false;
+    } else {
+      for (it->seek_to_first(); it->valid(); it->next()) {
+	pg_log_entry_t e;
+	bufferlist bl = it->value();
+	bufferlist::iterator q = bl.begin();
+	try {
+	  ::decode(e, q);
+	}
+	catch (const buffer::error &e) {
+	  dout(0) << "corrupt entry at " << it->key() << dendl;
+	  ss << "corrupt entry at key " << it->key();
+	  ok = false;
+	  break;
+	}
+	catch(const std::bad_alloc &a) {
+	  dout(0) << "corrupt entry at " << it->key() << dendl;
+	  ss << "corrupt entry at key " << it->key();
+	  ok = false;
+	  break;
+	}
+	dout(30) << " " << it->key() << " " << e << dendl;
+      }
+    }
+  } else if (bounds.head > 0) {
     // read
     struct stat st;
     store->stat(coll_t::META_COLL, log_oid, &st);
@@ -2477,7 +2603,7 @@ std::string PG::get_corrupt_pg_log_name() const
   return buf;
 }
 
-void PG::read_state(ObjectStore *store)
+void PG::read_state(ObjectStore *store, utime_t *missing_time)
 {
   bufferlist bl;
   bufferlist::iterator p;
@@ -2515,12 +2641,25 @@ void PG::read_state(ObjectStore *store)
     }
   } else {
     ::decode(snap_collections, p);
-    if (struct_v >= 4)
+    if (struct_v == 4)
       ::decode(info, p);
   }
 
+  if (struct_v >= 5) {
+    set<string> keys;
+    keys.insert("info");
+    map<string,bufferlist> values;
+    store->omap_get_values(coll_t::META_COLL, biginfo_oid, keys, &values);
+    assert(values.count("info"));
+    p = values["info"].begin();
+    ::decode(info, p);
+    dirty_big_info = false;
+  }
+  // otherwise leave dirty_big_info set; the next write_info() converts
+  // us to the current format
+
   try {
-    read_log(store);
+    read_log(store, missing_time);
   }
   catch (const buffer::error &e) {
     string cr_log_coll_name(get_corrupt_pg_log_name());
@@ -2542,6 +2681,9 @@ void PG::read_state(ObjectStore *store)
     t.create_collection(cr_log_coll);
     t.collection_move(cr_log_coll, coll_t::META_COLL, log_oid);
     t.touch(coll_t::META_COLL, log_oid);
+    bufferlist blb;
+    ::encode(ondisklog, blb);
+    t.collection_setattr(coll, "ondisklog", blb);
     write_info(t);
     store->apply_transaction(t);
 
@@ -2593,6 +2735,7 @@ coll_t PG::make_snap_collection(ObjectStore::Transaction& t, snapid_t s)
   coll_t c(info.pgid, s);
   if (!snap_collections.contains(s)) {
     snap_collections.insert(s);
+    dirty_big_info = true;
     write_info(t);
     dout(10) << "create_snap_collection " << c << ", set now " << snap_collections << dendl;
     t.create_collection(c);
@@ -2672,9 +2815,18 @@ void PG::requeue_ops(list<OpRequestRef> &ls)
 {
   dout(15) << " requeue_ops " << ls << dendl;
   assert(&ls != &op_queue);
-  size_t requeue_size = ls.size();
-  op_queue.splice(op_queue.begin(), ls, ls.begin(), ls.end());
-  for (size_t i = 0; i < requeue_size; ++i) osd->queue_for_op(this);
+  // requeued ops go ahead of queued ops of the same priority; walk
+  // backwards so they keep their own order
+  while (!ls.empty()) {
+    OpRequestRef op = ls.back();
+    ls.pop_back();
+    unsigned priority = op->request->get_priority();
+    list<OpRequestRef>::iterator p = op_queue.begin();
+    while (p != op_queue.end() && (*p)->request->get_priority() > priority)
+      ++p;
+    op_queue.insert(p, op);
+    osd->queue_for_op(this, priority);
+  }
 }
 
 
@@ -2766,6 +2918,28 @@ void PG::sub_op_scrub_map(OpRequestRef op)
 
   dout(10) << " got osd." << from << " scrub map" << dendl;
   bufferlist::iterator p = m->get_data().begin();
+
+  if (scrub_chunky) {
+    if (!scrub_active || !scrub_waiting_on_whom.count(from)) {
+      dout(10) << "sub_op_scrub_map not waiting on osd." << from
+	       << ", discarding" << dendl;
+      return;
+    }
+    if (m->get_data().length() == 0) {
+      dout(10) << "sub_op_scrub_map osd." << from << " failed to map chunk"
+	       << dendl;
+      scrub_map_failed.insert(from);
+    } else {
+      scrub_received_maps[from].decode(p, info.pgid.pool());
+    }
+    --scrub_waiting_on;
+    scrub_waiting_on_whom.erase(from);
+    if (scrub_waiting_on == 0 &&
+	scrub_chunk_state == SCRUB_CHUNK_WAIT_REPLICAS)
+      osd->scrub_wq.queue(this);
+    return;
+  }
+
   if (scrub_received_maps.count(from)) {
     ScrubMap incoming;
     incoming.decode(p, info.pgid.pool());
@@ -2796,10 +2970,17 @@ void PG::sub_op_scrub_map(OpRequestRef op)
 
 /* 
  * pg lock may or may not be held
+ *
+ * A deep scan also reads each object and records a crc32c of its
+ * data; the pg lock must not be held.  Each object is charged to the
+ * scrub class of the work scheduler, but we never wait here: writes
+ * to the chunk may be blocked behind us.  chunky_scrub() paces the
+ * chunks instead.
  */
-void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls)
+void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls, bool deep)
 {
-  dout(10) << "_scan_list scanning " << ls.size() << " objects" << dendl;
+  dout(10) << "_scan_list scanning " << ls.size() << " objects"
+	   << (deep ? " deeply" : "") << dendl;
   int i = 0;
   for (vector<hobject_t>::iterator p = ls.begin(); 
        p != ls.end(); 
@@ -2809,10 +2990,35 @@ void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls)
     struct stat st;
     int r = osd->store->stat(coll, poid, &st);
     if (r == 0) {
+      osd->work_sched.charge(WorkScheduler::CLASS_SCRUB,
+			     WorkScheduler::io_cost(deep ? st.st_size : 0));
+
       ScrubMap::object &o = map.objects[poid];
       o.size = st.st_size;
       assert(!o.negative);
       osd->store->getattrs(coll, poid, o.attrs);
+
+      if (deep) {
+	uint32_t crc = -1;
+	uint64_t pos = 0;
+	while (true) {
+	  bufferlist bl;
+	  r = osd->store->read(coll, poid, pos, g_conf->osd_deep_scrub_stride, bl);
+	  if (r <= 0)
+	    break;
+	  crc = bl.crc32c(crc);
+	  pos += r;
+	}
+	if (r < 0) {
+	  // leave the digest out; a missing or short copy shows up in
+	  // the comparison with the other replicas' digests
+	  osd->clog.error() << info.pgid << " deep scrub " << poid
+			    << " read error " << r;
+	} else {
+	  o.digest = crc;
+	  o.digest_present = true;
+	}
+      }
       dout(25) << "_scan_list  " << poid << dendl;
     } else {
       dout(25) << "_scan_list  " << poid << " got " << r << ", skipping" << dendl;
@@ -2831,6 +3037,19 @@ void PG::_request_scrub_map(int replica, eversion_t version)
                                        get_osdmap()->get_cluster_inst(replica));
 }
 
+void PG::_request_scrub_map_chunk(int replica, eversion_t version,
+				  const hobject_t& start, const hobject_t& end)
+{
+  assert(replica != osd->whoami);
+  dout(10) << "scrub  requesting scrubmap for [" << start << "," << end
+	   << ") from osd." << replica << dendl;
+  MOSDRepScrub *repscrubop = new MOSDRepScrub(info.pgid, version,
+					      get_osdmap()->get_epoch(),
+					      start, end);
+  osd->cluster_messenger->send_message(repscrubop,
+                                       get_osdmap()->get_cluster_inst(replica));
+}
+
 void PG::sub_op_scrub_reserve(OpRequestRef op)
 {
   MOSDSubOp *m = (MOSDSubOp*)op->request;
@@ -2994,6 +3213,61 @@ void PG::build_scrub_map(ScrubMap &map)
 }
 
 
+/*
+ * build a summary of the objects in [start, end)
+ * called while holding pg lock, which is dropped while we scan
+ *
+ * @return 0, -EAGAIN if the pg changed while unlocked, or the error
+ * listing the collection
+ */
+int PG::build_scrub_map_chunk(ScrubMap &map,
+			       const hobject_t& start, const hobject_t& end)
+{
+  dout(10) << "build_scrub_map_chunk [" << start << "," << end << ")" << dendl;
+
+  map.valid_through = info.last_update;
+  epoch_t epoch = info.history.same_interval_since;
+
+  unlock();
+
+  // wait for the writes to the chunk that we've been told about
+  osr->flush();
+
+  vector<hobject_t> ls;
+  hobject_t pos = start;
+  while (pos < end) {
+    vector<hobject_t> objects;
+    hobject_t next;
+    int r = osd->store->collection_list_partial(coll, pos,
+						osd->store->get_ideal_list_min(),
+						osd->store->get_ideal_list_max(),
+						0, &objects, &next);
+    if (r < 0) {
+      derr << "build_scrub_map_chunk collection_list_partial got "
+	   << cpp_strerror(r) << dendl;
+      lock();
+      return r;
+    }
+    for (vector<hobject_t>::iterator p = objects.begin();
+	 p != objects.end() && *p < end;
+	 ++p)
+      ls.push_back(*p);
+    if (objects.empty())
+      break;
+    pos = next;
+  }
+
+  _scan_list(map, ls, g_conf->osd_deep_scrub);
+  lock();
+
+  if (epoch != info.history.same_interval_since) {
+    dout(10) << "scrub  pg changed, aborting" << dendl;
+    return -EAGAIN;
+  }
+  dout(10) << "build_scrub_map_chunk got " << map.objects.size() << " objects" << dendl;
+  return 0;
+}
+
 /* 
  * build a summary of pg content changed starting after v
  * called while holding pg lock
@@ -3052,6 +3326,10 @@ void PG::repair_object(const hobject_t& soid, ScrubMap::object *po, int bad_peer
 }
 
 /* replica_scrub
+ *
+ * If msg->chunky is set, replica_scrub waits (requeued by
+ * sub_op_modify_applied) until last_update_applied reaches
+ * msg->scrub_to, then maps just [msg->start, msg->end).
  *
  * If msg->scrub_from is not set, replica_scrub calls build_scrubmap to
  * build a complete map (with the pg lock dropped).
@@ -3080,7 +3358,35 @@ void PG::replica_scrub(MOSDRepScrub *msg)
   }
 
   ScrubMap map;
-  if (msg->scrub_from > eversion_t()) {
+  if (msg->chunky) {
+    if (last_update_applied < msg->scrub_to) {
+      dout(10) << "replica_scrub waiting for " << msg->scrub_to
+	       << " to apply" << dendl;
+      active_rep_scrub = msg;
+      msg->get();
+      return;
+    }
+    int r = build_scrub_map_chunk(map, msg->start, msg->end);
+    if (r == -EAGAIN)
+      return;
+    if (r < 0) {
+      // an empty map tells the primary we failed, rather than letting it
+      // take a partial map for an inconsistent pg
+      osd->clog.error() << info.pgid << " replica scrub of chunk ["
+			<< msg->start << "," << msg->end << ") failed: "
+			<< cpp_strerror(r);
+      if (msg->map_epoch < info.history.same_interval_since)
+	return;
+      vector<OSDOp> scrub(1);
+      scrub[0].op.op = CEPH_OSD_OP_SCRUB_MAP;
+      MOSDSubOp *subop = new MOSDSubOp(osd_reqid_t(), info.pgid, hobject_t(),
+				       false, 0, msg->map_epoch,
+				       osd->get_tid(), eversion_t());
+      subop->ops = scrub;
+      osd->cluster_messenger->send_message(subop, msg->get_connection());
+      return;
+    }
+  } else if (msg->scrub_from > eversion_t()) {
     if (finalizing_scrub) {
       assert(last_update_applied == info.last_update);
       assert(last_update_applied == msg->scrub_to);
@@ -3150,12 +3456,20 @@ void PG::scrub()
     return;
   }
 
-  if (!is_primary() || !is_active() || !is_clean() || !is_scrubbing()) {
+  // a chunky repair leaves the pg unclean behind it as it goes
+  if (!is_primary() || !is_active() || !is_scrubbing() ||
+      (!is_clean() && !(scrub_active && scrub_chunky))) {
     dout(10) << "scrub -- not primary or active or not clean" << dendl;
     unlock();
     return;
   }
 
+  if (scrub_active && scrub_chunky) {
+    chunky_scrub();
+    unlock();
+    return;
+  }
+
   if (!scrub_active) {
     dout(10) << "scrub start" << dendl;
     scrub_active = true;
@@ -3174,6 +3488,20 @@ void PG::scrub()
     ++(osd->scrubs_active);
     osd->sched_scrub_lock.Unlock();
 
+    scrub_cstat = object_stat_collection_t();
+
+    if (g_conf->osd_scrub_chunky && scrub_peers_support_chunky()) {
+      dout(10) << "scrub in chunks" << dendl;
+      scrub_chunky = true;
+      scrub_chunk_state = SCRUB_CHUNK_NEW;
+      scrub_start = hobject_t();
+      scrub_end = hobject_t();
+      scrub_errors = scrub_fixed = 0;
+      chunky_scrub();
+      unlock();
+      return;
+    }
+
     /* scrub_waiting_on == 0 iff all replicas have sent the requested maps and
      * the primary has done a final scrub (which in turn can only happen if
      * last_update_applied == info.last_update)
@@ -3253,6 +3581,238 @@ void PG::scrub()
   unlock();
 }
 
+const char *PG::get_scrub_chunk_state_name(int s)
+{
+  switch (s) {
+  case SCRUB_CHUNK_NEW: return "new";
+  case SCRUB_CHUNK_WAIT_APPLIED: return "wait_applied";
+  case SCRUB_CHUNK_BUILD_MAP: return "build_map";
+  case SCRUB_CHUNK_WAIT_REPLICAS: return "wait_replicas";
+  case SCRUB_CHUNK_COMPARE: return "compare";
+  default: return "???";
+  }
+}
+
+/*
+ * Chunky scrub is only worth it if every replica can build a map of a
+ * range; otherwise we do a classic scrub.
+ */
+bool PG::scrub_peers_support_chunky()
+{
+  for (unsigned i=1; i<acting.size(); i++) {
+    Connection *con =
+      osd->cluster_messenger->get_connection(get_osdmap()->get_cluster_inst(acting[i]));
+    bool ok = con && con->has_feature(CEPH_FEATURE_CHUNKY_SCRUB);
+    if (con)
+      con->put();
+    if (!ok) {
+      dout(10) << "osd." << acting[i] << " can't do chunky scrub" << dendl;
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Chunky scrub:
+ * The pg is scrubbed a chunk of osd_scrub_chunk_min..max objects at a
+ * time, in hobject_t order.  Chunks end on a hash boundary, so a head
+ * and its clones are always scrubbed together.  For each chunk:
+ *
+ * NEW:           choose [scrub_start, scrub_end).  From here on writes
+ *                to the chunk wait in do_op.  Find the last log entry
+ *                touching the chunk and ask the replicas for a map of
+ *                the chunk once they've applied it.
+ * WAIT_APPLIED:  wait for our own copy of that entry to apply; requeued
+ *                by op_applied.
+ * BUILD_MAP:     build our map of the chunk, with the pg lock dropped.
+ * WAIT_REPLICAS: wait for the replica maps; requeued by sub_op_scrub_map.
+ * COMPARE:       compare maps, repair, check snapsets and sum stats,
+ *                let blocked writes go and requeue for the next chunk.
+ *
+ * The rest of the pg takes writes throughout.  Writes to objects we're
+ * done with (below scrub_start) are added to scrub_cstat as they happen,
+ * so the summed stats can be checked against the pg's at the end.
+ */
+void PG::chunky_scrub()
+{
+  assert(_lock.is_locked());
+  bool done = false;
+
+  while (!done) {
+    dout(20) << "scrub state " << get_scrub_chunk_state_name(scrub_chunk_state)
+	     << " [" << scrub_start << "," << scrub_end << ")" << dendl;
+
+    switch (scrub_chunk_state) {
+    case SCRUB_CHUNK_NEW:
+      {
+	int min = MAX(3, g_conf->osd_scrub_chunk_min);
+	int max = MAX(min, g_conf->osd_scrub_chunk_max);
+	while (true) {
+	  vector<hobject_t> objects;
+	  hobject_t candidate_end;
+	  int r = osd->store->collection_list_partial(coll, scrub_start, min, max,
+						      0, &objects, &candidate_end);
+	  assert(r >= 0);
+	  candidate_end = candidate_end.get_boundary();
+	  if (candidate_end > scrub_start) {
+	    scrub_end = candidate_end;
+	    break;
+	  }
+	  // everything we listed shares one hash; look further
+	  min *= 2;
+	  max *= 2;
+	}
+
+	scrub_subset_last_update = eversion_t();
+	for (list<pg_log_entry_t>::reverse_iterator p = log.log.rbegin();
+	     p != log.log.rend();
+	     ++p) {
+	  if (p->soid >= scrub_start && p->soid < scrub_end) {
+	    scrub_subset_last_update = p->version;
+	    break;
+	  }
+	}
+
+	primary_scrubmap = ScrubMap();
+	scrub_received_maps.clear();
+	scrub_map_failed.clear();
+	scrub_chunk_stamp = ceph_clock_now(g_ceph_context);
+	scrub_waiting_on = 0;
+	scrub_waiting_on_whom.clear();
+	for (unsigned i=1; i<acting.size(); i++) {
+	  _request_scrub_map_chunk(acting[i], scrub_subset_last_update,
+				   scrub_start, scrub_end);
+	  ++scrub_waiting_on;
+	  scrub_waiting_on_whom.insert(acting[i]);
+	}
+	scrub_chunk_state = SCRUB_CHUNK_WAIT_APPLIED;
+      }
+      break;
+
+    case SCRUB_CHUNK_WAIT_APPLIED:
+      if (last_update_applied < scrub_subset_last_update) {
+	dout(10) << "scrub  waiting for " << scrub_subset_last_update
+		 << " to apply" << dendl;
+	done = true;
+      } else {
+	scrub_chunk_state = SCRUB_CHUNK_BUILD_MAP;
+      }
+      break;
+
+    case SCRUB_CHUNK_BUILD_MAP:
+      // unlocks and relocks
+      {
+	int r = build_scrub_map_chunk(primary_scrubmap, scrub_start, scrub_end);
+	if (r == -EAGAIN ||
+	    scrub_epoch_start != info.history.same_interval_since) {
+	  dout(10) << "scrub  pg changed, aborting" << dendl;
+	  scrub_clear_state();
+	  scrub_unreserve_replicas();
+	  return;
+	}
+	if (r < 0) {
+	  osd->clog.error() << info.pgid << " scrub of chunk [" << scrub_start
+			    << "," << scrub_end << ") failed: "
+			    << cpp_strerror(r) << ", aborting";
+	  scrub_clear_state();
+	  scrub_unreserve_replicas();
+	  return;
+	}
+      }
+      scrub_chunk_state = SCRUB_CHUNK_WAIT_REPLICAS;
+      break;
+
+    case SCRUB_CHUNK_WAIT_REPLICAS:
+      if (scrub_waiting_on) {
+	dout(10) << "scrub  waiting for maps from " << scrub_waiting_on_whom
+		 << dendl;
+	done = true;
+      } else if (!scrub_map_failed.empty()) {
+	// a missing map is not an inconsistency; give up on this scrub
+	// and let it be scheduled again
+	osd->clog.error() << info.pgid << " scrub aborted, osd(s) "
+			  << scrub_map_failed << " failed to map chunk ["
+			  << scrub_start << "," << scrub_end << ")";
+	scrub_clear_state();
+	scrub_unreserve_replicas();
+	return;
+      } else {
+	scrub_chunk_state = SCRUB_CHUNK_COMPARE;
+      }
+      break;
+
+    case SCRUB_CHUNK_COMPARE:
+      {
+	uint64_t bytes = 0;  // read by our deep scan
+	for (map<hobject_t,ScrubMap::object>::iterator p = primary_scrubmap.objects.begin();
+	     p != primary_scrubmap.objects.end();
+	     ++p)
+	  if (p->second.digest_present)
+	    bytes += p->second.size;
+
+	scrub_compare_maps(scrub_errors, scrub_fixed);
+	_scrub(primary_scrubmap, scrub_errors, scrub_fixed);
+	primary_scrubmap = ScrubMap();
+	scrub_received_maps.clear();
+
+	// writes to the chunk can go now
+	requeue_ops(waiting_for_active);
+
+	if (scrub_end.is_max()) {
+	  scrub_finish(scrub_errors, scrub_fixed);
+	  return;
+	}
+
+	// requeue rather than loop, so others get at the pg between chunks
+	scrub_start = scrub_end;
+	scrub_chunk_state = SCRUB_CHUNK_NEW;
+	scrub_queue_next_chunk(bytes);
+	done = true;
+      }
+      break;
+    }
+  }
+}
+
+struct C_PG_QueueScrub : public Context {
+  OSDService *osd;
+  PG *pg;
+  C_PG_QueueScrub(OSDService *o, PG *p) : osd(o), pg(p) {
+    pg->get();
+  }
+  ~C_PG_QueueScrub() {
+    pg->put();  // also when the timer is shut down under us
+  }
+  void finish(int r) {
+    osd->scrub_wq.queue(pg);
+  }
+};
+
+/*
+ * Pace chunks here, with no writes waiting on us, instead of while
+ * reading them: hold the next one back until our deep reads are down
+ * to osd_deep_scrub_bandwidth, and while the scrub class is over its
+ * share.  The wait is on a timer, not on the disk_tp thread.
+ */
+void PG::scrub_queue_next_chunk(uint64_t bytes)
+{
+  double delay = 0;
+  uint64_t bw = g_conf->osd_deep_scrub_bandwidth;
+  if (bw)
+    delay = (double)bytes / (double)bw -
+      (double)(ceph_clock_now(g_ceph_context) - scrub_chunk_stamp);
+  if (!osd->work_sched.may_run(WorkScheduler::CLASS_SCRUB))
+    delay = MAX(delay, g_conf->osd_scrub_chunk_defer);
+  if (delay <= 0) {
+    osd->scrub_wq.queue(this);
+    return;
+  }
+  dout(20) << "scrub  next chunk in " << delay << "s" << dendl;
+  osd->watch_lock.Lock();
+  osd->watch_timer.add_event_after(delay, new C_PG_QueueScrub(osd, this));
+  osd->watch_lock.Unlock();
+}
+
 void PG::scrub_clear_state()
 {
   assert(_lock.is_locked());
@@ -3275,6 +3835,14 @@ void PG::scrub_clear_state()
     active_rep_scrub = NULL;
   }
   scrub_received_maps.clear();
+  scrub_map_failed.clear();
+
+  scrub_chunky = false;
+  scrub_chunk_state = SCRUB_CHUNK_NEW;
+  scrub_start = hobject_t();
+  scrub_end = hobject_t();
+  scrub_subset_last_update = eversion_t();
+  scrub_errors = scrub_fixed = 0;
 }
 
 bool PG::scrub_gather_replica_maps() {
@@ -3310,6 +3878,14 @@ bool PG::_compare_scrub_objects(ScrubMap::object &auth,
     errorstream << "size " << candidate.size 
 		<< " != known size " << auth.size;
   }
+  if (auth.digest_present && candidate.digest_present &&
+      auth.digest != candidate.digest) {
+    if (!ok)
+      errorstream << ", ";
+    ok = false;
+    errorstream << "digest 0x" << std::hex << candidate.digest
+		<< " != known digest 0x" << auth.digest << std::dec;
+  }
   for (map<string,bufferptr>::const_iterator i = auth.attrs.begin();
        i != auth.attrs.end();
        i++) {
@@ -3422,6 +3998,20 @@ void PG::scrub_finalize() {
 
   dout(10) << "scrub_finalize has maps, analyzing" << dendl;
   int errors = 0, fixed = 0;
+  scrub_compare_maps(errors, fixed);
+
+  // ok, do the pg-type specific scrubbing
+  _scrub(primary_scrubmap, errors, fixed);
+  scrub_finish(errors, fixed);
+  unlock();
+}
+
+/*
+ * compare primary_scrubmap with the replicas' maps, and queue repairs
+ * if this is a repair
+ */
+void PG::scrub_compare_maps(int& errors, int& fixed)
+{
   bool repair = state_test(PG_STATE_REPAIR);
   const char *mode = repair ? "repair":"scrub";
   if (acting.size() > 1) {
@@ -3454,7 +4044,9 @@ void PG::scrub_finalize() {
       dout(2) << ss.str() << dendl;
       osd->clog.error(ss);
       state_set(PG_STATE_INCONSISTENT);
+      errors += missing.size() + inconsistent.size();
       if (repair) {
+	fixed += missing.size() + inconsistent.size();
 	state_clear(PG_STATE_CLEAN);
 	for (map<hobject_t, int>::iterator i = authoritative.begin();
 	     i != authoritative.end();
@@ -3487,8 +4079,15 @@ void PG::scrub_finalize() {
     }
   }
 
-  // ok, do the pg-type specific scrubbing
-  _scrub(primary_scrubmap, errors, fixed);
+}
+
+void PG::scrub_finish(int errors, int fixed)
+{
+  bool repair = state_test(PG_STATE_REPAIR);
+  const char *mode = repair ? "repair":"scrub";
+
+  // check the object stats summed up by _scrub against the pg's
+  _scrub_finish(errors, fixed);
 
   {
     stringstream oss;
@@ -3530,7 +4129,6 @@ void PG::scrub_finalize() {
   }
 
   dout(10) << "scrub done" << dendl;
-  unlock();
 }
 
 void PG::share_pg_info()
@@ -3828,6 +4426,7 @@ void PG::start_peering_interval(const OSDMapRef lastmap,
     if (new_interval) {
       dout(10) << " noting past " << past_intervals.rbegin()->second << dendl;
       dirty_info = true;
+      dirty_big_info = true;
     }
   }
 
@@ -4141,8 +4740,19 @@ void PG::queue_op(OpRequestRef op)
       can_discard_request(op)) {
     return;
   }
-  op_queue.push_back(op);
-  osd->queue_for_op(this);
+  // the shard queue orders pgs; keep our own ops in priority order too,
+  // fifo within a priority.  usually everything is the same priority and
+  // this stops at the back.
+  unsigned priority = op->request->get_priority();
+  list<OpRequestRef>::iterator p = op_queue.end();
+  while (p != op_queue.begin()) {
+    list<OpRequestRef>::iterator q = p;
+    if ((*--q)->request->get_priority() >= priority)
+      break;
+    p = q;
+  }
+  op_queue.insert(p, op);
+  osd->queue_for_op(this, priority);
 }
 
 void PG::take_waiters()
@@ -4818,6 +5428,13 @@ boost::statechart::result PG::RecoveryState::Active::react(const QueryState& q)
     q.f->dump_int("scrub_active", pg->scrub_active);
     q.f->dump_int("scrub_block_writes", pg->scrub_block_writes);
     q.f->dump_int("finalizing_scrub", pg->finalizing_scrub);
+    q.f->dump_int("scrub_chunky", pg->scrub_chunky);
+    if (pg->scrub_chunky) {
+      q.f->dump_string("scrub_chunk_state",
+		       get_scrub_chunk_state_name(pg->scrub_chunk_state));
+      q.f->dump_stream("scrub_start") << pg->scrub_start;
+      q.f->dump_stream("scrub_end") << pg->scrub_end;
+    }
     q.f->dump_int("scrub_waiting_on", pg->scrub_waiting_on);
     {
       q.f->open_array_section("scrub_waiting_on_whom");
@@ -272,16 +272,24 @@ public:
 
   /**
    * OndiskLog - some info about how we store the log on disk.
+   *
+   * Since v5 each entry is an omap key on log_oid, named by
+   * eversion_t::get_key_name(), so appends and trims only touch the
+   * entries involved.  tail and head then count encoded bytes of the
+   * live entries (for stats) rather than file offsets.  Older logs are a
+   * flat byte stream in the object data; read_log() converts them.
    */
   class OndiskLog {
   public:
     // ok
     uint64_t tail;                     // first byte of log. 
     uint64_t head;                     // byte following end of log.
-    uint64_t zero_to;                // first non-zeroed byte of log.
+    uint64_t zero_to;                // first non-zeroed byte of log (legacy)
     bool has_checksums;
+    bool in_omap;                    // entries are omap keys (v5+)
 
-    OndiskLog() : tail(0), head(0), zero_to(0) {}
+    OndiskLog() : tail(0), head(0), zero_to(0),
+		  has_checksums(true), in_omap(true) {}
 
     uint64_t length() { return head - tail; }
     bool trim_to(eversion_t v, ObjectStore::Transaction& t);
@@ -293,15 +301,17 @@ public:
     }
 
     void encode(bufferlist& bl) const {
-      ENCODE_START(4, 3, bl);
+      // older code would misread an omap log as a byte stream
+      ENCODE_START(5, 5, bl);
       ::encode(tail, bl);
       ::encode(head, bl);
       ::encode(zero_to, bl);
       ENCODE_FINISH(bl);
     }
     void decode(bufferlist::iterator& bl) {
-      DECODE_START_LEGACY_COMPAT_LEN(3, 3, 3, bl);
+      DECODE_START_LEGACY_COMPAT_LEN(5, 3, 3, bl);
       has_checksums = (struct_v >= 2);
+      in_omap = (struct_v >= 5);
       ::decode(tail, bl);
       ::decode(head, bl);
       if (struct_v >= 4)
@@ -395,9 +405,11 @@ public:
   }
 
 
-  list<OpRequestRef> op_queue;  // op queue
+  list<OpRequestRef> op_queue;  // op queue, highest priority first
 
   bool dirty_info, dirty_log;
+  /// past_intervals or snap_collections changed since the last write_info()
+  bool dirty_big_info;
 
 public:
   // pg state
@@ -420,6 +432,11 @@ public:
    * (if they have one) */
   xlist<PG*>::item recovery_item, scrub_item, scrub_finalize_item, snap_trim_item, stat_queue_item;
   int recovery_ops_active;
+  bool recovery_demanded;  ///< client ops wait on recovery; under OSD::recovery_wq lock
+  bool is_recovery_demanded() const {
+    return !waiting_for_missing_object.empty() ||
+      !waiting_for_degraded_object.empty();
+  }
   bool waiting_on_backfill;
 #ifdef DEBUG_RECOVERY_OIDS
   set<hobject_t> recovering_oids;
@@ -639,6 +656,9 @@ protected:
   Mutex pg_stats_lock;
   bool pg_stats_valid;
   pg_stat_t pg_stats_stable;
+  /// what we last sent the mon, and what it last acked (delta base)
+  pg_stat_t pg_stats_sent, pg_stats_acked;
+  bool pg_stats_acked_valid;
 
   // for ordering writes
   std::tr1::shared_ptr<ObjectStore::Sequencer> osr;
@@ -784,6 +804,37 @@ public:
   ScrubMap primary_scrubmap;
   MOSDRepScrub *active_rep_scrub;
 
+  // chunky scrub: the pg is scrubbed a hash range at a time, and only
+  // writes to the chunk being scrubbed wait.
+  enum ScrubChunkState {
+    SCRUB_CHUNK_NEW,          // pick the next chunk, ask replicas for maps
+    SCRUB_CHUNK_WAIT_APPLIED, // wait for writes to the chunk to apply
+    SCRUB_CHUNK_BUILD_MAP,    // build our own map of the chunk
+    SCRUB_CHUNK_WAIT_REPLICAS,
+    SCRUB_CHUNK_COMPARE,      // compare maps, repair, move on
+  };
+  bool scrub_chunky;
+  ScrubChunkState scrub_chunk_state;
+  hobject_t scrub_start, scrub_end;    ///< current chunk, [start, end)
+  eversion_t scrub_subset_last_update; ///< last log entry touching the chunk
+  int scrub_errors, scrub_fixed;
+  set<int> scrub_map_failed;  ///< replicas that couldn't map the chunk
+  utime_t scrub_chunk_stamp;  ///< when we started on the current chunk
+  object_stat_collection_t scrub_cstat; ///< stats of objects scrubbed so far
+
+  static const char *get_scrub_chunk_state_name(int s);
+  bool scrub_peers_support_chunky();
+  /// true if writes to soid must wait for the chunk being scrubbed
+  bool write_blocked_by_scrub(const hobject_t &soid) const {
+    return scrub_active && scrub_chunky &&
+      scrub_chunk_state != SCRUB_CHUNK_NEW &&
+      soid >= scrub_start && soid < scrub_end;
+  }
+  /// true if soid is in a part of the pg this chunky scrub is done with
+  bool scrub_chunk_done_with(const hobject_t &soid) const {
+    return scrub_active && scrub_chunky && soid < scrub_start;
+  }
+
   void repair_object(const hobject_t& soid, ScrubMap::object *po, int bad_peer, int ok_peer);
   bool _compare_scrub_objects(ScrubMap::object &auth,
 			      ScrubMap::object &candidate,
@@ -794,14 +845,25 @@ public:
 			  map<hobject_t, int> &authoritative,
 			  ostream &errorstream);
   void scrub();
+  void chunky_scrub();
+  void scrub_compare_maps(int& errors, int& fixed);
+  void scrub_finish(int errors, int fixed);
   void scrub_finalize();
   void scrub_clear_state();
+  void scrub_queue_next_chunk(uint64_t bytes);
   bool scrub_gather_replica_maps();
-  void _scan_list(ScrubMap &map, vector<hobject_t> &ls);
+  void _scan_list(ScrubMap &map, vector<hobject_t> &ls, bool deep = false);
   void _request_scrub_map(int replica, eversion_t version);
+  void _request_scrub_map_chunk(int replica, eversion_t version,
+				const hobject_t& start, const hobject_t& end);
   void build_scrub_map(ScrubMap &map);
+  int build_scrub_map_chunk(ScrubMap &map,
+			     const hobject_t& start, const hobject_t& end);
   void build_inc_scrub_map(ScrubMap &map, eversion_t v);
+  /// check the objects in map, adding them to scrub_cstat
   virtual int _scrub(ScrubMap &map, int& errors, int& fixed) { return 0; }
+  /// compare scrub_cstat with the pg stats once every object is checked
+  virtual void _scrub_finish(int& errors, int& fixed) { }
   virtual coll_t get_temp_coll() = 0;
   virtual bool have_temp_coll() = 0;
   void clear_scrub_reserved();
@@ -1451,14 +1513,16 @@ public:
   void add_log_entry(pg_log_entry_t& e, bufferlist& log_bl);
   void append_log(vector<pg_log_entry_t>& logv, eversion_t trim_to, ObjectStore::Transaction &t);
 
-  void read_log(ObjectStore *store);
+  void read_log(ObjectStore *store, utime_t *missing_time = NULL);
+  bool read_log_entries_legacy(ObjectStore *store, list<pg_log_entry_t>& entries);
+  bool read_log_entries_omap(ObjectStore *store, list<pg_log_entry_t>& entries);
   bool check_log_for_corruption(ObjectStore *store);
   void trim(ObjectStore::Transaction& t, eversion_t v);
   void trim_ondisklog(ObjectStore::Transaction& t);
   void trim_peers();
 
   std::string get_corrupt_pg_log_name() const;
-  void read_state(ObjectStore *store);
+  void read_state(ObjectStore *store, utime_t *missing_time = NULL);
   coll_t make_snap_collection(ObjectStore::Transaction& t, snapid_t sn);
   void update_snap_collections(vector<pg_log_entry_t> &log_entries,
 			       ObjectStore::Transaction& t);
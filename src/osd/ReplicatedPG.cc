@@ -101,6 +101,14 @@ bool ReplicatedPG::is_missing_object(const hobject_t& soid)
   return missing.missing.count(soid);
 }
 
+/*
+ * pull() return values:
+ *  NONE  - didn't pull anything
+ *  YES   - pulled what the caller wanted
+ *  OTHER - needed to pull something else first (_head or _snapdir)
+ */
+enum { PULL_NONE, PULL_OTHER, PULL_YES };
+
 void ReplicatedPG::wait_for_missing_object(const hobject_t& soid, OpRequestRef op)
 {
   assert(is_missing_object(soid));
@@ -119,10 +127,12 @@ void ReplicatedPG::wait_for_missing_object(const hobject_t& soid, OpRequestRef o
   }
   else {
     dout(7) << "missing " << soid << " v " << v << ", pulling." << dendl;
-    pull(soid, v);
+    if (pull(soid, v) != PULL_NONE)
+      osd->logger->inc(l_osd_rop_demand);
   }
   waiting_for_missing_object[soid].push_back(op);
   op->mark_delayed();
+  osd->expedite_recovery(this);
 }
 
 void ReplicatedPG::wait_for_all_missing(OpRequestRef op)
@@ -181,10 +191,19 @@ void ReplicatedPG::wait_for_degraded_object(const hobject_t& soid, OpRequestRef
 	break;
       }
     }
-    recover_object_replicas(soid, v);
+    osd->logger->inc(l_osd_rop_demand, recover_object_replicas(soid, v));
   }
   waiting_for_degraded_object[soid].push_back(op);
   op->mark_delayed();
+  osd->expedite_recovery(this);
+}
+
+void ReplicatedPG::requeue_recovered_waiters(list<OpRequestRef>& ls)
+{
+  utime_t now = ceph_clock_now(g_ceph_context);
+  for (list<OpRequestRef>::iterator p = ls.begin(); p != ls.end(); ++p)
+    osd->logger->finc(l_osd_rop_blocked_lat, now - (*p)->get_arrived());
+  requeue_ops(ls);
 }
 
 bool PGLSParentFilter::filter(bufferlist& xattr_data, bufferlist& outdata)
@@ -597,6 +616,30 @@ void ReplicatedPG::get_src_oloc(const object_t& oid, const object_locator_t& olo
     src_oloc.key = oid.name;
 }
 
+bool ReplicatedPG::replica_object_committed(const hobject_t& soid)
+{
+  hash_map<hobject_t, pg_log_entry_t*>::iterator p = log.objects.find(soid);
+  return p == log.objects.end() ||
+    p->second->readable_on_replica(replica_committed_to, last_update_applied);
+}
+
+bool ReplicatedPG::can_serve_replica_read(MOSDOp *m, const hobject_t& head,
+					  const hobject_t& snapdir)
+{
+  if (!g_conf->osd_replica_reads)
+    return false;
+  if (m->may_write() || (m->get_flags() & CEPH_OSD_FLAG_RWORDERED))
+    return false;
+  if (!is_active() || !is_replica())
+    return false;
+  // backfill hasn't reached it, or recovery hasn't
+  if (head > info.last_backfill ||
+      is_missing_object(head) || is_missing_object(snapdir))
+    return false;
+  // a write may be in flight
+  return replica_object_committed(head) && replica_object_committed(snapdir);
+}
+
 /** do_op - do an op
  * pg lock will be held (if multithreaded)
  * osd_lock NOT held.
@@ -615,17 +658,34 @@ void ReplicatedPG::do_op(OpRequestRef op)
 
   dout(10) << "do_op " << *m << (m->may_write() ? " may_write" : "") << dendl;
 
-  if (scrub_block_writes && m->may_write()) {
+  // missing object?
+  hobject_t head(m->get_oid(), m->get_object_locator().key,
+		 CEPH_NOSNAP, m->get_pg().ps(),
+		 info.pgid.pool());
+  hobject_t snapdir(m->get_oid(), m->get_object_locator().key,
+		    CEPH_SNAPDIR, m->get_pg().ps(), info.pgid.pool());
+
+  // clones share the head's hash, so they're in the same scrub chunk
+  if (m->may_write() && (scrub_block_writes || write_blocked_by_scrub(head))) {
     dout(20) << __func__ << ": waiting for scrub" << dendl;
     waiting_for_active.push_back(op);
     op->mark_delayed();
     return;
   }
 
-  // missing object?
-  hobject_t head(m->get_oid(), m->get_object_locator().key,
-		 CEPH_NOSNAP, m->get_pg().ps(),
-		 info.pgid.pool());
+  if (!is_primary()) {
+    if (!(m->get_flags() & (CEPH_OSD_FLAG_BALANCE_READS |
+			    CEPH_OSD_FLAG_LOCALIZE_READS))) {
+      osd->handle_misdirected_op(this, op);
+      return;
+    }
+    if (!can_serve_replica_read(m, head, snapdir)) {
+      dout(10) << "do_op can't serve " << head << " on replica, sending client to primary" << dendl;
+      osd->reply_op_error(op, -EAGAIN);
+      return;
+    }
+  }
+
   if (is_missing_object(head)) {
     wait_for_missing_object(head, op);
     return;
@@ -638,8 +698,6 @@ void ReplicatedPG::do_op(OpRequestRef op)
   }
 
   // missing snapdir?
-  hobject_t snapdir(m->get_oid(), m->get_object_locator().key,
-		    CEPH_SNAPDIR, m->get_pg().ps(), info.pgid.pool());
   if (is_missing_object(snapdir)) {
     wait_for_missing_object(snapdir, op);
     return;
@@ -666,10 +724,10 @@ void ReplicatedPG::do_op(OpRequestRef op)
     &obc, can_create, &snapid);
   if (r) {
     if (r == -EAGAIN) {
-      // If we're not the primary of this OSD, and we have
-      // CEPH_OSD_FLAG_LOCALIZE_READS set, we just return -EAGAIN. Otherwise,
-      // we have to wait for the object.
-      if (is_primary() || (!(m->get_rmw_flags() & CEPH_OSD_FLAG_LOCALIZE_READS))) {
+      // If we're a replica serving a balanced or localized read, we
+      // just return -EAGAIN and the client retries on the primary.
+      // Otherwise, we have to wait for the object.
+      if (is_primary()) {
 	// missing the specific snap we need; requeue and wait.
 	assert(!can_create); // only happens on a read
 	hobject_t soid(m->get_oid(), m->get_object_locator().key,
@@ -694,6 +752,15 @@ void ReplicatedPG::do_op(OpRequestRef op)
 		     << " op " << *m << "\n";
   }
 
+  // a snap read may resolve to a clone that is still in flight
+  if (!is_primary() && obc->obs.oi.soid != head &&
+      !replica_object_committed(obc->obs.oi.soid)) {
+    dout(10) << "do_op " << obc->obs.oi.soid << " not committed on replica, sending client to primary" << dendl;
+    put_object_context(obc);
+    osd->reply_op_error(op, -EAGAIN);
+    return;
+  }
+
   if ((m->may_read()) && (obc->obs.oi.lost)) {
     // This object is lost. Reading from it returns an error.
     dout(20) << __func__ << ": object " << obc->obs.oi.soid
@@ -961,6 +1028,7 @@ void ReplicatedPG::do_op(OpRequestRef op)
     ctx->reply = NULL;
     reply->add_flags(CEPH_OSD_FLAG_ACK | CEPH_OSD_FLAG_ONDISK);
     osd->client_messenger->send_message(reply, m->get_connection());
+    op->mark_event(OpRequest::EVENT_REPLY_SENT);
     delete ctx;
     put_object_context(obc);
     put_object_contexts(src_obc);
@@ -972,12 +1040,11 @@ void ReplicatedPG::do_op(OpRequestRef op)
   // trim log?
   calc_trim_to();
 
-  append_log(ctx->log, pg_trim_to, ctx->local_t);
-  
   // continuing on to write path, make sure object context is registered
   assert(obc->registered);
 
-  // issue replica writes
+  // issue replica writes first, so the replicas start on their journals
+  // while we prepare and submit our own
   tid_t rep_tid = osd->get_tid();
   RepGather *repop = new_repop(ctx, obc, rep_tid);  // new repop claims our obc, src_obc refs
   // note: repop now owns ctx AND ctx->op
@@ -986,6 +1053,9 @@ void ReplicatedPG::do_op(OpRequestRef op)
 
   issue_repop(repop, now, old_last_update, old_exists, old_size, old_version);
 
+  append_log(ctx->log, pg_trim_to, ctx->local_t);
+  repop->pg_local_last_complete = info.last_complete;
+
   eval_repop(repop);
   repop->put();
 }
@@ -1244,11 +1314,13 @@ void ReplicatedPG::do_backfill(OpRequestRef op)
   }
 }
 
-/* Returns head of snap_trimq as snap_to_trim and the relevant objects as 
- * obs_to_trim */
+/* Returns head of snap_trimq as snap_to_trim and the first page of the
+ * relevant objects as obs_to_trim, with next set to where the following
+ * page starts */
 bool ReplicatedPG::get_obs_to_trim(snapid_t &snap_to_trim,
 				   coll_t &col_to_trim,
-				   vector<hobject_t> &obs_to_trim)
+				   vector<hobject_t> &obs_to_trim,
+				   hobject_t &next)
 {
   assert_locked();
   obs_to_trim.clear();
@@ -1268,19 +1340,37 @@ bool ReplicatedPG::get_obs_to_trim(snapid_t &snap_to_trim,
 
   snap_to_trim = snap_trimq.range_start();
   col_to_trim = coll_t(info.pgid, snap_to_trim);
+  next = hobject_t::get_max();
 
   if (!snap_collections.contains(snap_to_trim)) {
     return true;
   }
 
-  // flush pg ops to fs so we can rely on collection_list()
+  // flush pg ops to fs so we can rely on collection_list_partial()
   osr->flush();
 
-  osd->store->collection_list(col_to_trim, obs_to_trim);
+  next = hobject_t();
+  list_obs_to_trim(col_to_trim, obs_to_trim, next);
 
   return true;
 }
 
+/* The snap collection already indexes the clones that carry the snap, so
+ * we only ever list as much of it as the next batch needs. */
+void ReplicatedPG::list_obs_to_trim(const coll_t &col_to_trim,
+				    vector<hobject_t> &obs_to_trim,
+				    hobject_t &next)
+{
+  obs_to_trim.clear();
+  int min = osd->store->get_ideal_list_min();
+  int max = MAX(g_conf->osd_snap_trim_batch, osd->store->get_ideal_list_max());
+  int r = osd->store->collection_list_partial(col_to_trim, next, min, max, 0,
+					      &obs_to_trim, &next);
+  assert(r == 0);
+  dout(20) << "list_obs_to_trim " << col_to_trim << " got " << obs_to_trim.size()
+	   << ", next " << next << dendl;
+}
+
 ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
 						   const snapid_t &sn)
 {
@@ -1439,7 +1529,8 @@ void ReplicatedPG::snap_trimmer()
   dout(10) << "snap_trimmer entry" << dendl;
   if (is_primary()) {
     entity_inst_t nobody;
-    if (!mode.try_write(nobody) || scrub_block_writes) {
+    if (!mode.try_write(nobody) || scrub_block_writes ||
+	(scrub_active && scrub_chunky)) {
       dout(10) << " can't write, requeueing" << dendl;
       queue_snap_trim();
       unlock();
@@ -1463,7 +1554,14 @@ void ReplicatedPG::snap_trimmer()
     dout(10) << "snap_trimmer requeue" << dendl;
     queue_snap_trim();
   }
+  uint64_t cost = snap_trimmer_machine.trim_cost;
+  snap_trimmer_machine.trim_cost = 0;
   unlock();
+
+  // charge the pass after the fact, with the pg unlocked, so waiting for
+  // our share holds up the next pass instead of client ops on this pg
+  if (cost)
+    osd->work_sched.get(WorkScheduler::CLASS_SNAPTRIM, cost);
   return;
 }
 
@@ -1594,7 +1692,7 @@ void ReplicatedPG::remove_watchers_and_notifies()
        ) {
     map<hobject_t, ObjectContext *>::iterator iter = oiter++;
     ObjectContext *obc = iter->second;
-    obc->ref++;
+    obc->get();
     for (map<entity_name_t, OSD::Session *>::iterator witer = obc->watchers.begin();
 	 witer != obc->watchers.end();
 	 remove_watcher(obc, (witer++)->first)) ;
@@ -1831,11 +1929,9 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	  break;
 	}
 
-	ClassHandler::ClassData *cls;
-	result = osd->class_handler->open_class(cname, &cls);
+	ClassHandler::ClassMethod *method;
+	result = osd->class_handler->get_method(cname, mname, &method);
 	assert(result == 0);   // init_op_flags() already verified this works.
-
-	ClassHandler::ClassMethod *method = cls->get_method(mname.c_str());
 	if (!method) {
 	  dout(10) << "call method " << cname << "." << mname << " does not exist" << dendl;
 	  result = -EINVAL;
@@ -2054,6 +2150,12 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	    t.truncate(coll, soid, op.extent.truncate_size);
 	    oi.truncate_seq = op.extent.truncate_seq;
 	    oi.truncate_size = op.extent.truncate_size;
+	    if (oi.size > op.extent.truncate_size) {
+	      interval_set<uint64_t> trim;
+	      trim.insert(op.extent.truncate_size,
+			  oi.size - op.extent.truncate_size);
+	      ctx->modified_ranges.union_of(trim);
+	    }
 	    if (op.extent.truncate_size != oi.size) {
 	      ctx->delta_stats.num_bytes -= oi.size;
 	      ctx->delta_stats.num_bytes += op.extent.truncate_size;
@@ -2882,6 +2984,7 @@ int ReplicatedPG::_rollback_to(OpContext *ctx, ceph_osd_op& op)
       t.clone(coll,
 	      rollback_to_sobject, soid);
       snapset.head_exists = true;
+      ctx->dirty_extents_unknown = true;
 
       map<snapid_t, interval_set<uint64_t> >::iterator iter =
 	snapset.clone_overlap.lower_bound(snapid);
@@ -3055,6 +3158,15 @@ void ReplicatedPG::add_interval_usage(interval_set<uint64_t>& s, object_stat_sum
   }
 }
 
+static void queue_watch_notify(map<Connection*, list<Message*> >& notifies,
+			       Connection *con, Message *m)
+{
+  list<Message*>& ls = notifies[con];
+  if (ls.empty())
+    con->get();  // put by send_watch_notifies
+  ls.push_back(m);
+}
+
 void ReplicatedPG::do_osd_op_effects(OpContext *ctx)
 {
   if (ctx->watch_connect || ctx->watch_disconnect ||
@@ -3067,6 +3179,9 @@ void ReplicatedPG::do_osd_op_effects(OpContext *ctx)
 
     dout(10) << "do_osd_op_effects applying watch/notify effects on session " << session << dendl;
 
+    // sent once we drop watch_lock, batched per connection
+    map<Connection*, list<Message*> > notifies;
+
     osd->watch_lock.Lock();
     dump_watchers(obc);
     
@@ -3079,7 +3194,7 @@ void ReplicatedPG::do_osd_op_effects(OpContext *ctx)
 	obc->watchers[entity] = session;
 	session->get();
 	session->watches[obc] = get_osdmap()->object_locator_to_pg(soid.oid, obc->obs.oi.oloc);
-	obc->ref++;
+	obc->get();
       } else if (iter->second == session) {
 	// already there
 	dout(10) << " already connected to " << w << " by " << entity
@@ -3108,7 +3223,7 @@ void ReplicatedPG::do_osd_op_effects(OpContext *ctx)
 	  /* there is a pending notification for this watcher, we should resend it anyway
 	     even if we already sent it as it might not have received it */
 	  MWatchNotify *notify_msg = new MWatchNotify(w.cookie, oi.user_version.version, notif->id, WATCH_NOTIFY, notif->bl);
-	  osd->client_messenger->send_message(notify_msg, session->con);
+	  queue_watch_notify(notifies, session->con, notify_msg);
 	}
       }
     }
@@ -3164,7 +3279,7 @@ void ReplicatedPG::do_osd_op_effects(OpContext *ctx)
 	  s->add_notif(notif, name);
 
 	  MWatchNotify *notify_msg = new MWatchNotify(w.cookie, oi.user_version.version, notif->id, WATCH_NOTIFY, notif->bl);
-	  osd->client_messenger->send_message(notify_msg, s->con);
+	  queue_watch_notify(notifies, s->con, notify_msg);
 	} else {
 	  // unconnected
 	  entity_name_t name = i->first;
@@ -3178,7 +3293,7 @@ void ReplicatedPG::do_osd_op_effects(OpContext *ctx)
 	osd->osd->complete_notify(notif, obc);
       } else {
 	obc->notifs[notif] = true;
-	obc->ref++;
+	obc->get();
 	notif->obc = obc;
 	// TODOSAM: osd->osd not good
 	notif->timeout = new Watch::C_NotifyTimeout(osd->osd, notif);
@@ -3202,6 +3317,7 @@ void ReplicatedPG::do_osd_op_effects(OpContext *ctx)
     }
 
     osd->watch_lock.Unlock();
+    osd->send_watch_notifies(notifies);
     session->put();
   }
 }
@@ -3249,6 +3365,24 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
   }
 
 
+  // note the data we touched before make_writeable() trims
+  // modified_ranges down to the clone overlap
+  interval_set<uint64_t> dirty_extents;
+  bool dirty_extents_valid = false;
+  if (g_conf->osd_pg_log_max_dirty_extents > 0 && !ctx->dirty_extents_unknown) {
+    dirty_extents = ctx->modified_ranges;
+    uint64_t old_size = ctx->obs->exists ? ctx->obs->oi.size : 0;
+    uint64_t new_size = ctx->new_obs.oi.size;
+    if (old_size != new_size) {
+      interval_set<uint64_t> resized;
+      resized.insert(MIN(old_size, new_size),
+		     MAX(old_size, new_size) - MIN(old_size, new_size));
+      dirty_extents.union_of(resized);
+    }
+    dirty_extents_valid =
+      dirty_extents.num_intervals() <= g_conf->osd_pg_log_max_dirty_extents;
+  }
+
   // there was a modification!
   make_writeable(ctx);
 
@@ -3274,6 +3408,10 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
     logopcode = pg_log_entry_t::DELETE;
   ctx->log.push_back(pg_log_entry_t(logopcode, soid, ctx->at_version, old_version,
 				ctx->reqid, ctx->mtime));
+  if (logopcode == pg_log_entry_t::MODIFY && dirty_extents_valid) {
+    ctx->log.back().dirty_extents.swap(dirty_extents);
+    ctx->log.back().dirty_extents_valid = true;
+  }
 
   if (ctx->new_obs.exists) {
     ctx->new_obs.oi.version = ctx->at_version;
@@ -3339,6 +3477,8 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
   ctx->obc->obs = ctx->new_obs;
   ctx->obc->ssc->snapset = ctx->new_snapset;
   info.stats.stats.add(ctx->delta_stats, ctx->obc->obs.oi.category);
+  if (scrub_chunk_done_with(soid))
+    scrub_cstat.add(ctx->delta_stats, ctx->obc->obs.oi.category);
 
   if (backfill_target >= 0) {
     pg_info_t& pinfo = peer_info[backfill_target];
@@ -3407,6 +3547,8 @@ void ReplicatedPG::apply_repop(RepGather *repop)
   Context *onapplied = new C_OSD_OpApplied(this, repop);
   Context *onapplied_sync = new C_OSD_OndiskWriteUnlock(repop->obc,
 							repop->ctx->clone_obc);
+  if (repop->ctx->op)
+    repop->ctx->op->mark_event(OpRequest::EVENT_TXN_SUBMITTED);
   int r = osd->store->queue_transactions(osr.get(), repop->tls, onapplied, oncommit, onapplied_sync, repop->ctx->op);
   if (r) {
     derr << "apply_repop  queue_transactions returned " << r << " on " << *repop << dendl;
@@ -3419,7 +3561,7 @@ void ReplicatedPG::op_applied(RepGather *repop)
   lock();
   dout(10) << "op_applied " << *repop << dendl;
   if (repop->ctx->op)
-    repop->ctx->op->mark_event("op_applied");
+    repop->ctx->op->mark_event(OpRequest::EVENT_OP_APPLIED);
 
   // discard my reference to the buffer
   if (repop->ctx->op)
@@ -3463,6 +3605,11 @@ void ReplicatedPG::op_applied(RepGather *repop)
       ++scrub_waiting_on;
       scrub_waiting_on_whom.insert(osd->whoami);
       osd->scrub_wq.queue(this);
+    } else if (scrub_active && scrub_chunky &&
+	       scrub_chunk_state == SCRUB_CHUNK_WAIT_APPLIED &&
+	       last_update_applied >= scrub_subset_last_update) {
+      dout(10) << "requeueing scrub, chunk writes applied" << dendl;
+      osd->scrub_wq.queue(this);
     }
   }
 
@@ -3477,7 +3624,7 @@ void ReplicatedPG::op_commit(RepGather *repop)
 {
   lock();
   if (repop->ctx->op)
-    repop->ctx->op->mark_event("op_commit");
+    repop->ctx->op->mark_event(OpRequest::EVENT_OP_COMMIT);
 
   if (repop->aborted) {
     dout(10) << "op_commit " << *repop << " -- aborted" << dendl;
@@ -3571,6 +3718,7 @@ void ReplicatedPG::eval_repop(RepGather *repop)
 	dout(10) << " sending commit on " << *repop << " " << reply << dendl;
 	assert(entity_name_t::TYPE_OSD != m->get_connection()->peer_type);
 	osd->client_messenger->send_message(reply, m->get_connection());
+	repop->ctx->op->mark_event(OpRequest::EVENT_REPLY_SENT);
 	repop->sent_disk = true;
       }
     }
@@ -3603,6 +3751,7 @@ void ReplicatedPG::eval_repop(RepGather *repop)
 	dout(10) << " sending ack on " << *repop << " " << reply << dendl;
         assert(entity_name_t::TYPE_OSD != m->get_connection()->peer_type);
 	osd->client_messenger->send_message(reply, m->get_connection());
+	repop->ctx->op->mark_event(OpRequest::EVENT_REPLY_SENT);
 	repop->sent_ack = true;
       }
 
@@ -3658,6 +3807,13 @@ void ReplicatedPG::issue_repop(RepGather *repop, utime_t now,
 
   int acks_wanted = CEPH_OSD_FLAG_ACK | CEPH_OSD_FLAG_ONDISK;
 
+  // encode the transaction and log once; every sub_op shares the buffers
+  bufferlist op_t_bl, empty_t_bl, log_bl;
+  if (acting.size() > 1) {
+    ::encode(repop->ctx->op_t, op_t_bl);
+    ::encode(repop->ctx->log, log_bl);
+  }
+
   for (unsigned i=1; i<acting.size(); i++) {
     if (ctx->op)
       ctx->op->mark_sub_op_sent();
@@ -3690,12 +3846,15 @@ void ReplicatedPG::issue_repop(RepGather *repop, utime_t now,
       if (peer == backfill_target && soid >= backfill_pos) {
 	dout(10) << "issue_repop shipping empty opt to osd." << peer << ", object beyond backfill_pos "
 		 << backfill_pos << ", last_backfill is " << pinfo.last_backfill << dendl;
-	ObjectStore::Transaction t;
-	::encode(t, wr->get_data());
+	if (!empty_t_bl.length()) {
+	  ObjectStore::Transaction t;
+	  ::encode(t, empty_t_bl);
+	}
+	wr->set_data(empty_t_bl);
       } else {
-	::encode(repop->ctx->op_t, wr->get_data());
+	wr->set_data(op_t_bl);
       }
-      ::encode(repop->ctx->log, wr->logbl);
+      wr->logbl = log_bl;
 
       if (backfill_target >= 0 && backfill_target == peer)
 	wr->pg_stats = pinfo.stats;  // reflects backfill progress
@@ -3704,6 +3863,7 @@ void ReplicatedPG::issue_repop(RepGather *repop, utime_t now,
     }
     
     wr->pg_trim_to = pg_trim_to;
+    wr->pg_committed_to = min_last_complete_ondisk;
     osd->cluster_messenger->send_message(wr, get_osdmap()->get_cluster_inst(peer));
 
     // keep peer_info up to date
@@ -3771,7 +3931,7 @@ void ReplicatedPG::repop_ack(RepGather *repop, int result, int ack_type,
   
   if (ack_type & CEPH_OSD_FLAG_ONDISK) {
     if (repop->ctx->op)
-      repop->ctx->op->mark_event("sub_op_commit_rec");
+      repop->ctx->op->mark_event(OpRequest::EVENT_SUB_OP_COMMIT_REC);
     // disk
     if (repop->waitfor_disk.count(fromosd)) {
       repop->waitfor_disk.erase(fromosd);
@@ -3786,7 +3946,7 @@ void ReplicatedPG::repop_ack(RepGather *repop, int result, int ack_type,
   } else {
     // ack
     if (repop->ctx->op)
-      repop->ctx->op->mark_event("sub_op_applied_rec");
+      repop->ctx->op->mark_event(OpRequest::EVENT_SUB_OP_APPLIED_REC);
     repop->waitfor_ack.erase(fromosd);
   }
 
@@ -3843,7 +4003,7 @@ void ReplicatedPG::register_unconnected_watcher(void *_obc,
   pg_t pgid = info.pgid;
   pgid.set_ps(obc->obs.oi.soid.hash);
   get();
-  obc->ref++;
+  obc->get();
   Watch::C_WatchTimeout *cb = new Watch::C_WatchTimeout(osd->osd,
 							static_cast<void *>(obc),
 							this,
@@ -3926,7 +4086,7 @@ ReplicatedPG::ObjectContext *ReplicatedPG::create_object_context(const object_in
   dout(10) << "create_object_context " << obc << " " << oi.soid << " " << obc->ref << dendl;
   register_object_context(obc);
   populate_obc_watchers(obc);
-  obc->ref++;
+  obc->get();
   return obc;
 }
 
@@ -3976,13 +4136,14 @@ ReplicatedPG::ObjectContext *ReplicatedPG::get_object_context(const hobject_t& s
     populate_obc_watchers(obc);
     dout(10) << "get_object_context " << obc << " " << soid << " 0 -> 1 read " << obc->obs.oi << dendl;
   }
-  obc->ref++;
+  obc->get();
   return obc;
 }
 
 void ReplicatedPG::context_registry_on_change()
 {
   remove_watchers_and_notifies();
+  trim_object_context_cache(0);
 }
 
 
@@ -4097,18 +4258,57 @@ void ReplicatedPG::put_object_context(ObjectContext *obc)
 
   --obc->ref;
   if (obc->ref == 0) {
-    if (obc->ssc)
-      put_snapset_context(obc->ssc);
-
-    if (obc->registered)
-      object_contexts.erase(obc->obs.oi.soid);
-    delete obc;
+    int max = g_conf->osd_pg_object_context_cache_count;
+    if (max > 0 && obc->registered && obc->obs.exists &&
+	is_primary() && is_active()) {
+      dout(15) << "put_object_context " << obc << " " << obc->obs.oi.soid
+	       << " cached" << dendl;
+      obc_lru.push_front(&obc->lru_item);
+      trim_object_context_cache(max);
+    } else {
+      _drop_object_context(obc);
+    }
 
-    if (object_contexts.empty())
+    if (object_contexts.size() == (unsigned)obc_lru.size())
       kick();
   }
 }
 
+void ReplicatedPG::_drop_object_context(ObjectContext *obc)
+{
+  assert(obc->ref == 0);
+  obc->lru_item.remove_myself();
+  if (obc->ssc)
+    put_snapset_context(obc->ssc);
+
+  if (obc->registered)
+    object_contexts.erase(obc->obs.oi.soid);
+  delete obc;
+}
+
+void ReplicatedPG::trim_object_context_cache(unsigned max)
+{
+  while ((unsigned)obc_lru.size() > max) {
+    ObjectContext *obc = obc_lru.back();
+    dout(20) << "trim_object_context_cache dropping " << obc << " "
+	     << obc->obs.oi.soid << dendl;
+    _drop_object_context(obc);
+  }
+}
+
+void ReplicatedPG::evict_cached_object_contexts(const object_t& oid)
+{
+  for (xlist<ObjectContext*>::iterator p = obc_lru.begin(); !p.end(); ) {
+    ObjectContext *obc = *p;
+    ++p;
+    if (obc->obs.oi.soid.oid == oid) {
+      dout(20) << "evict_cached_object_contexts " << obc << " "
+	       << obc->obs.oi.soid << dendl;
+      _drop_object_context(obc);
+    }
+  }
+}
+
 void ReplicatedPG::put_object_contexts(map<hobject_t,ObjectContext*>& obcv)
 {
   if (obcv.empty())
@@ -4248,6 +4448,9 @@ void ReplicatedPG::sub_op_modify(OpRequestRef op)
   // we better not be missing this.
   assert(!missing.is_missing(soid));
 
+  if (m->pg_committed_to > replica_committed_to)
+    replica_committed_to = m->pg_committed_to;
+
   int ackerosd = acting[0];
   
   op->mark_started();
@@ -4330,6 +4533,7 @@ void ReplicatedPG::sub_op_modify(OpRequestRef op)
   
   Context *oncommit = new C_OSD_RepModifyCommit(rm);
   Context *onapply = new C_OSD_RepModifyApply(rm);
+  op->mark_event(OpRequest::EVENT_TXN_SUBMITTED);
   int r = osd->store->queue_transactions(osr.get(), rm->tls, onapply, oncommit, 0, op);
   if (r) {
     dout(0) << "error applying transaction: r = " << r << dendl;
@@ -4341,7 +4545,7 @@ void ReplicatedPG::sub_op_modify(OpRequestRef op)
 void ReplicatedPG::sub_op_modify_applied(RepModify *rm)
 {
   lock();
-  rm->op->mark_event("sub_op_applied");
+  rm->op->mark_event(OpRequest::EVENT_SUB_OP_APPLIED);
 
   if (rm->epoch_started >= last_peering_reset) {
     dout(10) << "sub_op_modify_applied on " << rm << " op " << *rm->op->request << dendl;
@@ -4360,9 +4564,11 @@ void ReplicatedPG::sub_op_modify_applied(RepModify *rm)
     assert(info.last_update >= m->version);
     assert(last_update_applied < m->version);
     last_update_applied = m->version;
-    if (finalizing_scrub) {
-      assert(active_rep_scrub);
-      if (last_update_applied == active_rep_scrub->scrub_to) {
+    if (active_rep_scrub) {
+      assert(finalizing_scrub || active_rep_scrub->chunky);
+      if (active_rep_scrub->chunky ?
+	  last_update_applied >= active_rep_scrub->scrub_to :
+	  last_update_applied == active_rep_scrub->scrub_to) {
 	osd->rep_scrub_wq.queue(active_rep_scrub);
 	active_rep_scrub = 0;
       }
@@ -4385,7 +4591,7 @@ void ReplicatedPG::sub_op_modify_applied(RepModify *rm)
 void ReplicatedPG::sub_op_modify_commit(RepModify *rm)
 {
   lock();
-  rm->op->mark_event("sub_op_commit");
+  rm->op->mark_event(OpRequest::EVENT_SUB_OP_COMMIT);
 
 
   if (rm->epoch_started >= last_peering_reset) {
@@ -4400,6 +4606,7 @@ void ReplicatedPG::sub_op_modify_commit(RepModify *rm)
       commit->set_last_complete_ondisk(rm->last_complete);
       commit->set_priority(CEPH_MSG_PRIO_HIGH); // this better match ack priority!
       osd->cluster_messenger->send_message(commit, get_osdmap()->get_cluster_inst(rm->ackerosd));
+      rm->op->mark_event(OpRequest::EVENT_REPLY_SENT);
     }
     
     rm->committed = true;
@@ -4571,14 +4778,6 @@ void ReplicatedPG::calc_clone_subsets(SnapSet& snapset, const hobject_t& soid,
 /** pull - request object from a peer
  */
 
-/*
- * Return values:
- *  NONE  - didn't pull anything
- *  YES   - pulled what the caller wanted
- *  OTHER - needed to pull something else first (_head or _snapdir)
- */
-enum { PULL_NONE, PULL_OTHER, PULL_YES };
-
 int ReplicatedPG::pull(const hobject_t& soid, eversion_t v)
 {
   int fromosd = -1;
@@ -4751,11 +4950,60 @@ void ReplicatedPG::push_to_replica(ObjectContext *obc, const hobject_t& soid, in
 		      peer_info[peer].last_backfill,
 		      data_subset, clone_subsets);
     put_snapset_context(ssc);
+
+    // or just the extents written since the replica's stale copy?
+    eversion_t have = peer_missing[peer].have_old(soid);
+    interval_set<uint64_t> dirty;
+    if (have != eversion_t() &&
+	get_dirty_extents(soid, have, dirty)) {
+      interval_set<uint64_t> in_object;
+      if (size)
+	in_object.insert(0, size);
+      dirty.intersection_of(in_object);
+      Connection *con = osd->cluster_messenger->get_connection(
+	get_osdmap()->get_cluster_inst(peer));
+      bool supported = con && con->has_feature(CEPH_FEATURE_RECOVERY_DELTA);
+      if (con)
+	con->put();
+      if (supported && dirty.size() < data_subset.size()) {
+	dout(10) << "push_to_replica osd." << peer << " has " << soid
+		 << " v" << have << ", pushing dirty extents " << dirty
+		 << " instead of " << data_subset << dendl;
+	clone_subsets.clear();
+	osd->logger->inc(l_osd_push_delta);
+	push_start(obc, soid, peer, oi.version, dirty, clone_subsets, have);
+	return;
+      }
+    }
   }
 
   push_start(obc, soid, peer, oi.version, data_subset, clone_subsets);
 }
 
+/**
+ * get_dirty_extents - union of the data touched by soid's updates since a version
+ *
+ * Returns false if the log doesn't reach back to since, or if any update to
+ * soid after since is not a MODIFY with recorded extents (e.g. a delete,
+ * rollback or revert), in which case the whole object must be pushed.
+ */
+bool ReplicatedPG::get_dirty_extents(const hobject_t& soid, eversion_t since,
+				     interval_set<uint64_t>& extents)
+{
+  if (since < log.tail)
+    return false;
+  for (list<pg_log_entry_t>::reverse_iterator p = log.log.rbegin();
+       p != log.log.rend() && p->version > since;
+       ++p) {
+    if (p->soid != soid)
+      continue;
+    if (!p->is_modify() || !p->dirty_extents_valid)
+      return false;
+    extents.union_of(p->dirty_extents);
+  }
+  return true;
+}
+
 void ReplicatedPG::push_start(ObjectContext *obc,
 			      const hobject_t& soid, int peer)
 {
@@ -4772,7 +5020,8 @@ void ReplicatedPG::push_start(
   const hobject_t& soid, int peer,
   eversion_t version,
   interval_set<uint64_t> &data_subset,
-  map<hobject_t, interval_set<uint64_t> >& clone_subsets)
+  map<hobject_t, interval_set<uint64_t> >& clone_subsets,
+  eversion_t delta_from)
 {
   peer_missing[peer].revise_have(soid, eversion_t());
   // take note.
@@ -4780,6 +5029,7 @@ void ReplicatedPG::push_start(
   pi.recovery_info.size = obc->obs.oi.size;
   pi.recovery_info.copy_subset = data_subset;
   pi.recovery_info.clone_subset = clone_subsets;
+  pi.recovery_info.delta_from = delta_from;
   pi.recovery_info.soid = soid;
   pi.recovery_info.oi = obc->obs.oi;
   pi.recovery_info.version = version;
@@ -4834,7 +5084,22 @@ void ReplicatedPG::submit_push_data(
   map<string, bufferlist> &omap_entries,
   ObjectStore::Transaction *t)
 {
-  if (first) {
+  if (first && recovery_info.delta_from != eversion_t()) {
+    // only the dirty extents are coming; start from our stale copy.
+    // attrs and omap are always sent whole, so drop ours.
+    // (handle_push has checked that our copy is the right base.)
+    assert(missing.can_apply_delta(recovery_info.soid,
+				   recovery_info.delta_from));
+    dout(10) << "submit_push_data " << recovery_info.soid
+	     << " applying extents on top of v" << recovery_info.delta_from << dendl;
+    missing.revise_have(recovery_info.soid, eversion_t());
+    t->remove(get_temp_coll(t), recovery_info.soid);
+    t->collection_move(get_temp_coll(t), coll, recovery_info.soid);
+    t->truncate(get_temp_coll(t), recovery_info.soid, recovery_info.size);
+    t->rmattrs(get_temp_coll(t), recovery_info.soid);
+    t->omap_clear(get_temp_coll(t), recovery_info.soid);
+    t->omap_setheader(get_temp_coll(t), recovery_info.soid, omap_header);
+  } else if (first) {
     missing.revise_have(recovery_info.soid, eversion_t());
     remove_object_with_snap_hardlinks(*t, recovery_info.soid);
     t->remove(get_temp_coll(t), recovery_info.soid);
@@ -5016,6 +5281,8 @@ void ReplicatedPG::handle_pull_response(OpRequestRef op)
 		   t);
 
   if (complete) {
+    // whatever we had cached for this object is stale now
+    evict_cached_object_contexts(hoid.oid);
     submit_push_complete(pi.recovery_info, t);
 
     SnapSetContext *ssc;
@@ -5053,7 +5320,7 @@ void ReplicatedPG::handle_pull_response(OpRequestRef op)
     update_stats();
     if (waiting_for_missing_object.count(hoid)) {
       dout(20) << " kicking waiters on " << hoid << dendl;
-      requeue_ops(waiting_for_missing_object[hoid]);
+      requeue_recovered_waiters(waiting_for_missing_object[hoid]);
       waiting_for_missing_object.erase(hoid);
       if (missing.missing.size() == 0) {
 	requeue_ops(waiting_for_all_missing);
@@ -5072,9 +5339,25 @@ void ReplicatedPG::handle_push(OpRequestRef op)
 	   << m->recovery_info
 	   << m->recovery_progress
 	   << dendl;
+  bool first = m->current_progress.first;
+
+  if (first && m->recovery_info.delta_from != eversion_t() &&
+      !missing.can_apply_delta(m->recovery_info.soid,
+			       m->recovery_info.delta_from)) {
+    // the primary's idea of our copy is out of date (a repeer, or a
+    // racing log change); make it push the whole object instead
+    dout(10) << "handle_push " << m->recovery_info.soid
+	     << " delta from v" << m->recovery_info.delta_from
+	     << " but we have v" << missing.have_old(m->recovery_info.soid)
+	     << ", rejecting" << dendl;
+    MOSDSubOpReply *reply = new MOSDSubOpReply(
+      m, -ESTALE, get_osdmap()->get_epoch(), CEPH_OSD_FLAG_ACK);
+    osd->cluster_messenger->send_message(reply, m->get_connection());
+    return;
+  }
+
   bufferlist data;
   m->claim_data(data);
-  bool first = m->current_progress.first;
   bool complete = m->recovery_progress.data_complete &&
     m->recovery_progress.omap_complete;
   ObjectStore::Transaction *t = new ObjectStore::Transaction;
@@ -5247,7 +5530,21 @@ void ReplicatedPG::sub_op_push_reply(OpRequestRef op)
   } else {
     PushInfo *pi = &pushing[soid][peer];
 
-    if (!pi->recovery_progress.data_complete) {
+    if (reply->get_result() == -ESTALE &&
+	pi->recovery_info.delta_from != eversion_t()) {
+      dout(10) << " osd." << peer << " doesn't have " << soid << " v"
+	       << pi->recovery_info.delta_from << ", pushing it whole" << dendl;
+      pi->recovery_info.delta_from = eversion_t();
+      pi->recovery_info.copy_subset.clear();
+      if (pi->recovery_info.size)
+	pi->recovery_info.copy_subset.insert(0, pi->recovery_info.size);
+      pi->recovery_info.clone_subset.clear();
+      pi->recovery_progress = ObjectRecoveryProgress();
+      ObjectRecoveryProgress new_progress;
+      send_push(
+	peer, pi->recovery_info, pi->recovery_progress, &new_progress);
+      pi->recovery_progress = new_progress;
+    } else if (!pi->recovery_progress.data_complete) {
       dout(10) << " pushing more from, "
 	       << pi->recovery_progress.data_recovered_to
 	       << " of " << pi->recovery_info.copy_subset << dendl;
@@ -5272,7 +5569,7 @@ void ReplicatedPG::sub_op_push_reply(OpRequestRef op)
 	dout(10) << "pushed " << soid << " to all replicas" << dendl;
 	finish_recovery_op(soid);
 	if (waiting_for_degraded_object.count(soid)) {
-	  requeue_ops(waiting_for_degraded_object[soid]);
+	  requeue_recovered_waiters(waiting_for_degraded_object[soid]);
 	  waiting_for_degraded_object.erase(soid);
 	}
 	finish_degraded_object(soid);
@@ -5761,6 +6058,7 @@ void ReplicatedPG::on_removal()
   dout(10) << "on_removal" << dendl;
   apply_and_flush_repops(false);
   remove_watchers_and_notifies();
+  trim_object_context_cache(0);
 }
 
 void ReplicatedPG::on_shutdown()
@@ -5768,6 +6066,7 @@ void ReplicatedPG::on_shutdown()
   dout(10) << "on_shutdown" << dendl;
   apply_and_flush_repops(false);
   remove_watchers_and_notifies();
+  trim_object_context_cache(0);
 }
 
 void ReplicatedPG::on_activate()
@@ -5819,6 +6118,11 @@ void ReplicatedPG::on_change()
 
   // clear snap_trimmer state
   snap_trimmer_machine.process_event(Reset());
+
+  // flushing repops may have cached more obcs
+  trim_object_context_cache(0);
+
+  replica_committed_to = eversion_t();
 }
 
 void ReplicatedPG::on_role_change()
@@ -5939,19 +6243,25 @@ int ReplicatedPG::start_recovery_ops(int max, RecoveryCtx *prctx)
     info.last_complete = info.last_update;
   }
 
-  if (num_missing == num_unfound) {
+  // objects client ops are waiting for go first
+  int demanded = recover_demanded(max);
+  max -= demanded;
+
+  if (max > 0 && num_missing == num_unfound) {
     // All of the missing objects we have are unfound.
     // Recover the replicas.
     started = recover_replicas(max);
   }
-  if (!started) {
+  if (max > 0 && !started) {
     // We still have missing objects that we should grab from replicas.
     started += recover_primary(max);
   }
-  if (!started && num_unfound != get_num_unfound()) {
+  if (max > 0 && !started && num_unfound != get_num_unfound()) {
     // second chance to recovery replicas
     started = recover_replicas(max);
   }
+  started += demanded;
+  max += demanded;
   if (backfill_target >= 0 && started < max &&
       missing.num_missing() == 0 &&
       !waiting_on_backfill) {
@@ -5984,6 +6294,56 @@ int ReplicatedPG::start_recovery_ops(int max, RecoveryCtx *prctx)
   return 0;
 }
 
+/**
+ * start recovery of objects that client ops are blocked on, ahead of
+ * the usual log order
+ *
+ * wait_for_missing_object and wait_for_degraded_object kick off
+ * recovery when an op first blocks, but some can't start then (a clone
+ * whose head is being pulled, say); this picks them up.
+ */
+int ReplicatedPG::recover_demanded(int max)
+{
+  int started = 0;
+
+  for (map<hobject_t, list<OpRequestRef> >::iterator p = waiting_for_missing_object.begin();
+       p != waiting_for_missing_object.end() && started < max;
+       ++p) {
+    const hobject_t& soid = p->first;
+    hobject_t head = soid;
+    head.snap = CEPH_NOSNAP;
+    if (!missing.is_missing(soid) ||
+	pulling.count(soid) || pulling.count(head) ||
+	missing_loc.find(soid) == missing_loc.end())
+      continue;
+    dout(10) << __func__ << ": pulling " << soid << " for "
+	     << p->second.size() << " waiting ops" << dendl;
+    if (pull(soid, missing.missing[soid].need) != PULL_NONE)
+      ++started;
+  }
+
+  for (map<hobject_t, list<OpRequestRef> >::iterator p = waiting_for_degraded_object.begin();
+       p != waiting_for_degraded_object.end() && started < max;
+       ++p) {
+    const hobject_t& soid = p->first;
+    if (pushing.count(soid) || missing.is_missing(soid))
+      continue;
+    for (unsigned i = 1; i < acting.size(); i++) {
+      map<int, pg_missing_t>::iterator pm = peer_missing.find(acting[i]);
+      if (pm != peer_missing.end() && pm->second.is_missing(soid)) {
+	dout(10) << __func__ << ": pushing " << soid << " for "
+		 << p->second.size() << " waiting ops" << dendl;
+	started += recover_object_replicas(soid, pm->second.missing[soid].need);
+	break;
+      }
+    }
+  }
+
+  if (started)
+    osd->logger->inc(l_osd_rop_demand, started);
+  return started;
+}
+
 /**
  * do one recovery op.
  * return true if done, false if nothing left to do.
@@ -6544,8 +6904,6 @@ int ReplicatedPG::_scrub(ScrubMap& scrubmap, int& errors, int& fixed)
   SnapSet snapset;
   vector<snapid_t>::reverse_iterator curclone;
 
-  object_stat_collection_t cstat;
-
   bufferlist last_data;
 
   for (map<hobject_t,ScrubMap::object>::reverse_iterator p = scrubmap.objects.rbegin(); 
@@ -6599,7 +6957,7 @@ int ReplicatedPG::_scrub(ScrubMap& scrubmap, int& errors, int& fixed)
     }
     if (soid.snap == CEPH_SNAPDIR) {
       string cat;
-      cstat.add(stat, cat);
+      scrub_cstat.add(stat, cat);
       continue;
     }
 
@@ -6666,9 +7024,19 @@ int ReplicatedPG::_scrub(ScrubMap& scrubmap, int& errors, int& fixed)
     }
 
     string cat; // fixme
-    cstat.add(stat, cat);
+    scrub_cstat.add(stat, cat);
   }  
   
+  dout(10) << "_scrub (" << mode << ") finish" << dendl;
+  return errors;
+}
+
+void ReplicatedPG::_scrub_finish(int& errors, int& fixed)
+{
+  bool repair = state_test(PG_STATE_REPAIR);
+  const char *mode = repair ? "repair":"scrub";
+  object_stat_collection_t &cstat = scrub_cstat;
+
   dout(10) << mode << " got "
 	   << cstat.sum.num_objects << "/" << info.stats.stats.sum.num_objects << " objects, "
 	   << cstat.sum.num_object_clones << "/" << info.stats.stats.sum.num_object_clones << " clones, "
@@ -6692,9 +7060,6 @@ int ReplicatedPG::_scrub(ScrubMap& scrubmap, int& errors, int& fixed)
       share_pg_info();
     }
   }
-
-  dout(10) << "_scrub (" << mode << ") finish" << dendl;
-  return errors;
 }
 
 /*---SnapTrimmer Logging---*/
@@ -6722,6 +7087,14 @@ ReplicatedPG::NotTrimming::NotTrimming(my_context ctx) : my_base(ctx)
   state_name = "NotTrimming";
   context< SnapTrimmer >().requeue = false;
   context< SnapTrimmer >().log_enter(state_name);
+
+  // a Reset out of TrimmingObjects leaves the batch it was waiting on
+  set<RepGather *> &repops = context<SnapTrimmer>().repops;
+  for (set<RepGather *>::iterator i = repops.begin();
+       i != repops.end();
+       repops.erase(i++)) {
+    (*i)->put();
+  }
 }
 
 void ReplicatedPG::NotTrimming::exit()
@@ -6742,19 +7115,22 @@ boost::statechart::result ReplicatedPG::NotTrimming::react(const SnapTrim&)
   } else if (!pg->is_primary() || !pg->is_active() || !pg->is_clean()) {
     dout(10) << "NotTrimming not primary, active, clean" << dendl;
     return discard_event();
-  } else if (pg->scrub_block_writes) {
-    dout(10) << "NotTrimming finalizing scrub" << dendl;
+  } else if (pg->scrub_block_writes ||
+	     (pg->scrub_active && pg->scrub_chunky)) {
+    dout(10) << "NotTrimming scrubbing" << dendl;
     pg->queue_snap_trim();
     return discard_event();
   }
 
   // Primary trimming
   vector<hobject_t> &obs_to_trim = context<SnapTrimmer>().obs_to_trim;
+  hobject_t &next = context<SnapTrimmer>().next_to_list;
   snapid_t &snap_to_trim = context<SnapTrimmer>().snap_to_trim;
   coll_t &col_to_trim = context<SnapTrimmer>().col_to_trim;
   if (!pg->get_obs_to_trim(snap_to_trim,
 			   col_to_trim,
-			   obs_to_trim)) {
+			   obs_to_trim,
+			   next)) {
     // Nothing to trim
     dout(10) << "NotTrimming: nothing to trim" << dendl;
     return discard_event();
@@ -6821,9 +7197,12 @@ boost::statechart::result ReplicatedPG::RepColTrim::react(const SnapTrim&)
     t->collection_remove(col_to_trim, *i);
   }
   t->remove_collection(col_to_trim);
+  context<SnapTrimmer>().trim_cost +=
+    (obs_to_trim.size() + 1) * WorkScheduler::io_cost(0);
   int r = pg->osd->store->queue_transaction(NULL, t, new ObjectStore::C_DeleteTransaction(t));
   assert(r == 0);
   pg->snap_collections.erase(snap_to_trim);
+  pg->dirty_big_info = true;
   return discard_event();
 }
 
@@ -6846,39 +7225,81 @@ boost::statechart::result ReplicatedPG::TrimmingObjects::react(const SnapTrim&)
   dout(10) << "TrimmingObjects react" << dendl;
   ReplicatedPG *pg = context< SnapTrimmer >().pg;
   vector<hobject_t> &obs_to_trim = context<SnapTrimmer>().obs_to_trim;
+  hobject_t &next = context<SnapTrimmer>().next_to_list;
   snapid_t &snap_to_trim = context<SnapTrimmer>().snap_to_trim;
+  coll_t &col_to_trim = context<SnapTrimmer>().col_to_trim;
   set<RepGather *> &repops = context<SnapTrimmer>().repops;
+  uint64_t &trim_cost = context<SnapTrimmer>().trim_cost;
 
-  // Done, 
-  if (position == obs_to_trim.end()) {
-    post_event(SnapTrim());
-    return transit< WaitingOnReplicas >();
+  // Let the last batch apply everywhere before starting the next; each of
+  // its repops requeues us as it completes.
+  for (set<RepGather *>::iterator i = repops.begin();
+       i != repops.end(); ) {
+    if ((*i)->applied && (*i)->waitfor_ack.empty()) {
+      (*i)->put();
+      repops.erase(i++);
+    } else {
+      ++i;
+    }
+  }
+  if (!repops.empty()) {
+    dout(10) << "TrimmingObjects react waiting on " << repops.size()
+	     << " repops" << dendl;
+    context<SnapTrimmer>().requeue = false;
+    return discard_event();
   }
 
-  dout(10) << "TrimmingObjects react trimming " << *position << dendl;
-  RepGather *repop = pg->trim_object(*position, snap_to_trim);
+  int batch = MAX(g_conf->osd_snap_trim_batch, 1);
+  int trimmed = 0;
+  ObjectStore::Transaction *t = 0;  // for clones that are already gone
+  while (trimmed < batch) {
+    if (position == obs_to_trim.end()) {
+      if (next.is_max())
+	break;
+      pg->list_obs_to_trim(col_to_trim, obs_to_trim, next);
+      position = obs_to_trim.begin();
+      continue;
+    }
 
-  if (repop) {
-    repop->queue_snap_trimmer = true;
-    eversion_t old_last_update = pg->log.head;
-    bool old_exists = repop->obc->obs.exists;
-    uint64_t old_size = repop->obc->obs.oi.size;
-    eversion_t old_version = repop->obc->obs.oi.version;
-    
-    pg->append_log(repop->ctx->log, eversion_t(), repop->ctx->local_t);
-    pg->issue_repop(repop, repop->ctx->mtime, old_last_update, old_exists, old_size, old_version);
-    pg->eval_repop(repop);
-    
-    repops.insert(repop);
+    dout(10) << "TrimmingObjects react trimming " << *position << dendl;
+    RepGather *repop = pg->trim_object(*position, snap_to_trim);
+
+    if (repop) {
+      repop->queue_snap_trimmer = true;
+      eversion_t old_last_update = pg->log.head;
+      bool old_exists = repop->obc->obs.exists;
+      uint64_t old_size = repop->obc->obs.oi.size;
+      eversion_t old_version = repop->obc->obs.oi.version;
+
+      pg->append_log(repop->ctx->log, eversion_t(), repop->ctx->local_t);
+      pg->issue_repop(repop, repop->ctx->mtime, old_last_update, old_exists, old_size, old_version);
+      pg->eval_repop(repop);
+
+      repops.insert(repop);
+    } else {
+      // object has already been trimmed, this is an extra
+      if (!t)
+	t = new ObjectStore::Transaction;
+      t->collection_remove(col_to_trim, *position);
+    }
+    trim_cost += WorkScheduler::io_cost(0);
+    ++trimmed;
     ++position;
-  } else {
-    // object has already been trimmed, this is an extra
-    coll_t col_to_trim(pg->info.pgid, snap_to_trim);
-    ObjectStore::Transaction *t = new ObjectStore::Transaction;
-    t->collection_remove(col_to_trim, *position);
+  }
+
+  if (t) {
     int r = pg->osd->store->queue_transaction(NULL, t, new ObjectStore::C_DeleteTransaction(t));
     assert(r == 0);
   }
+
+  // Done, 
+  if (position == obs_to_trim.end() && next.is_max()) {
+    post_event(SnapTrim());
+    return transit< WaitingOnReplicas >();
+  }
+
+  // with no repops in flight nothing else will requeue us
+  context<SnapTrimmer>().requeue = repops.empty();
   return discard_event();
 }
 /* WaitingOnReplicasObjects */
@@ -6931,6 +7352,7 @@ boost::statechart::result ReplicatedPG::WaitingOnReplicas::react(const SnapTrim&
   ObjectStore::Transaction *t = new ObjectStore::Transaction;
   dout(10) << "removing snap " << sn << " collection " << c << dendl;
   pg->snap_collections.erase(sn);
+  pg->dirty_big_info = true;
   pg->write_info(*t);
   t->remove_collection(c);
   int tr = pg->osd->store->queue_transaction(pg->osr.get(), t);
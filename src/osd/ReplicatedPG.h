@@ -283,13 +283,20 @@ public:
     map<entity_name_t, Watch::C_WatchTimeout *> unconnected_watchers;
     map<Watch::Notification *, bool> notifs;
 
+    // on the pg's obc_lru while unreferenced but still cached
+    xlist<ObjectContext*>::item lru_item;
+
     ObjectContext(const object_info_t &oi_, bool exists_, SnapSetContext *ssc_)
       : ref(0), registered(false), obs(oi_, exists_), ssc(ssc_),
 	lock("ReplicatedPG::ObjectContext::lock"),
 	unstable_writes(0), readers(0), writers_waiting(0), readers_waiting(0),
-	blocked_by(0) {}
+	blocked_by(0), lru_item(this) {}
     
-    void get() { ++ref; }
+    void get() {
+      if (!ref)
+	lru_item.remove_myself();  // back in use
+      ++ref;
+    }
 
     // do simple synchronous mutual exclusion, for now.  now waitqueues or anything fancy.
     void ondisk_write_lock() {
@@ -365,6 +372,7 @@ public:
     vector<pg_log_entry_t> log;
 
     interval_set<uint64_t> modified_ranges;
+    bool dirty_extents_unknown;  // modified_ranges doesn't cover every data change
     ObjectContext *obc;          // For ref counting purposes
     map<hobject_t,ObjectContext*> src_obc;
     ObjectContext *clone_obc;    // if we created a clone
@@ -388,6 +396,7 @@ public:
       modify(false), user_modify(false),
       watch_connect(false), watch_disconnect(false),
       bytes_written(0), bytes_read(0),
+      dirty_extents_unknown(false),
       obc(0), clone_obc(0), snapset_obc(0), data_off(0), reply(NULL), pg(_pg) { 
       if (_ssc) {
 	new_snapset = _ssc->snapset;
@@ -512,10 +521,38 @@ protected:
   friend class C_OSD_OpCommit;
   friend class C_OSD_OpApplied;
 
+  /*
+   * Replica reads.  A replica serves a read-only op flagged
+   * BALANCE_READS or LOCALIZE_READS when the objects it touches have
+   * no log entries newer than replica_committed_to, the primary's
+   * min_last_complete_ondisk as of the last sub_op we applied, or
+   * newer than our own last_update_applied.  Anything newer may still
+   * be in flight or only in our journal, so the client is sent back to
+   * the primary with -EAGAIN, where the op is ordered normally.
+   */
+  eversion_t replica_committed_to;
+  bool replica_object_committed(const hobject_t& soid);
+  bool can_serve_replica_read(MOSDOp *m, const hobject_t& head,
+			      const hobject_t& snapdir);
+
   // projected object info
   map<hobject_t, ObjectContext*> object_contexts;
   map<object_t, SnapSetContext*> snapset_contexts;
 
+  /*
+   * Recently used, unreferenced ObjectContexts (most recent first).
+   * They stay registered in object_contexts, holding their ssc, so a
+   * hot object doesn't pay for OI_ATTR/SS_ATTR reads and decodes on
+   * every op.  A registered obc is the projected state of its object,
+   * so these stay coherent as long as every write goes through the obc.
+   * Only a primary caches.  The cache is dropped on interval change, and
+   * an object's entries are dropped before recovery rewrites it.
+   */
+  xlist<ObjectContext*> obc_lru;
+  void _drop_object_context(ObjectContext *obc);
+  void trim_object_context_cache(unsigned max);
+  void evict_cached_object_contexts(const object_t& oid);
+
   void populate_obc_watchers(ObjectContext *obc);
   void register_unconnected_watcher(void *obc,
 				    entity_name_t entity,
@@ -529,7 +566,7 @@ protected:
   ObjectContext *lookup_object_context(const hobject_t& soid) {
     if (object_contexts.count(soid)) {
       ObjectContext *obc = object_contexts[soid];
-      obc->ref++;
+      obc->get();
       return obc;
     }
     return NULL;
@@ -751,6 +788,8 @@ protected:
 			  const hobject_t &last_backfill,
 			  interval_set<uint64_t>& data_subset,
 			  map<hobject_t, interval_set<uint64_t> >& clone_subsets);
+  bool get_dirty_extents(const hobject_t& soid, eversion_t since,
+			 interval_set<uint64_t>& extents);
   void push_to_replica(ObjectContext *obc, const hobject_t& oid, int dest);
   void push_start(ObjectContext *obc,
 		  const hobject_t& oid, int dest);
@@ -758,7 +797,8 @@ protected:
 		  const hobject_t& soid, int peer,
 		  eversion_t version,
 		  interval_set<uint64_t> &data_subset,
-		  map<hobject_t, interval_set<uint64_t> >& clone_subsets);
+		  map<hobject_t, interval_set<uint64_t> >& clone_subsets,
+		  eversion_t delta_from = eversion_t());
   void send_push_op_blank(const hobject_t& soid, int peer);
 
   void finish_degraded_object(const hobject_t& oid);
@@ -790,6 +830,7 @@ protected:
 
   void queue_for_recovery();
   int start_recovery_ops(int max, RecoveryCtx *prctx);
+  int recover_demanded(int max);
   int recover_primary(int max);
   int recover_replicas(int max);
   int recover_backfill(int max);
@@ -906,6 +947,7 @@ protected:
 
   // -- scrub --
   virtual int _scrub(ScrubMap& map, int& errors, int& fixed);
+  virtual void _scrub_finish(int& errors, int& fixed);
 
   void apply_and_flush_repops(bool requeue);
 
@@ -933,7 +975,11 @@ public:
   void do_backfill(OpRequestRef op);
   bool get_obs_to_trim(snapid_t &snap_to_trim,
 		       coll_t &col_to_trim,
-		       vector<hobject_t> &obs_to_trim);
+		       vector<hobject_t> &obs_to_trim,
+		       hobject_t &next);
+  void list_obs_to_trim(const coll_t &col_to_trim,
+			vector<hobject_t> &obs_to_trim,
+			hobject_t &next);
   RepGather *trim_object(const hobject_t &coid, const snapid_t &sn);
   void snap_trimmer();
   int do_osd_ops(OpContext *ctx, vector<OSDOp>& ops);
@@ -960,12 +1006,15 @@ private:
   struct SnapTrimmer : public boost::statechart::state_machine< SnapTrimmer, NotTrimming > {
     ReplicatedPG *pg;
     set<RepGather *> repops;
-    vector<hobject_t> obs_to_trim;
+    vector<hobject_t> obs_to_trim;  ///< current page of col_to_trim
+    hobject_t next_to_list;         ///< where the next page of col_to_trim starts
     snapid_t snap_to_trim;
     coll_t col_to_trim;
     bool need_share_pg_info;
     bool requeue;
-    SnapTrimmer(ReplicatedPG *pg) : pg(pg), need_share_pg_info(false), requeue(false) {}
+    uint64_t trim_cost;             ///< io cost of this pass, charged once unlocked
+    SnapTrimmer(ReplicatedPG *pg) : pg(pg), need_share_pg_info(false), requeue(false),
+				    trim_cost(0) {}
     void log_enter(const char *state_name);
     void log_exit(const char *state_name, utime_t duration);
   } snap_trimmer_machine;
@@ -1029,6 +1078,8 @@ public:
 
   bool is_degraded_object(const hobject_t& oid);
   void wait_for_degraded_object(const hobject_t& oid, OpRequestRef op);
+  /// requeue ops held for an object we just recovered
+  void requeue_recovered_waiters(list<OpRequestRef>& ls);
 
   void mark_all_unfound_lost(int what);
   eversion_t pick_newest_available(const hobject_t& oid);
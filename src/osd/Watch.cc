@@ -10,6 +10,7 @@
 #include "Watch.h"
 
 #include "common/config.h"
+#include "common/Formatter.h"
 
 bool Watch::ack_notification(entity_name_t& watcher, Notification *notif)
 {
@@ -19,10 +20,41 @@ bool Watch::ack_notification(entity_name_t& watcher, Notification *notif)
     return false;
 
   notif->watchers.erase(iter);
+  ack_latency.add(ceph_clock_now(g_ceph_context) - notif->start);
 
   return notif->watchers.empty(); // true if there are no more watchers
 }
 
+void Watch::note_complete(Notification *notif)
+{
+  if (notif->watchers.empty())
+    complete_latency.add(ceph_clock_now(g_ceph_context) - notif->start);
+  else
+    num_timeouts.inc();
+}
+
+void Watch::dump_latency(ostream& ss)
+{
+  JSONFormatter jf(true);
+  jf.open_object_section("notify_latency");
+  jf.open_object_section("ack");
+  ack_latency.dump(&jf);
+  jf.close_section();
+  jf.open_object_section("complete");
+  complete_latency.dump(&jf);
+  jf.close_section();
+  jf.dump_unsigned("timeouts", num_timeouts.read());
+  jf.close_section();
+  jf.flush(ss);
+}
+
+void Watch::reset_latency()
+{
+  ack_latency.reset();
+  complete_latency.reset();
+  num_timeouts.set(0);
+}
+
 void Watch::C_NotifyTimeout::finish(int r)
 {
   osd->handle_notify_timeout(notif);
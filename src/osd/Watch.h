@@ -20,6 +20,7 @@
 
 #include "OSD.h"
 #include "common/config.h"
+#include "common/LatencyHistogram.h"
 
 class MWatchNotify;
 
@@ -44,12 +45,15 @@ public:
     void *obc;
     pg_t pgid;
     bufferlist bl;
+    utime_t start;
 
     void add_watcher(const entity_name_t& name, WatcherState state) {
       watchers[name] = state;
     }
 
-    Notification(entity_name_t& n, OSD::Session *s, uint64_t c, bufferlist& b) : name(n), session(s), cookie(c), bl(b) { }
+    Notification(entity_name_t& n, OSD::Session *s, uint64_t c, bufferlist& b)
+      : name(n), session(s), cookie(c), bl(b),
+	start(ceph_clock_now(g_ceph_context)) { }
   };
 
   class C_NotifyTimeout : public Context {
@@ -77,6 +81,11 @@ private:
   std::map<uint64_t, Notification *> notifs; /* notif_id to notifications */
 
 public:
+  // notify latency, from the notify op's effects being applied
+  LatencyHistogram ack_latency;       ///< ... to each watcher's ack
+  LatencyHistogram complete_latency;  ///< ... to the last ack
+  atomic_t num_timeouts;              ///< notifies completed by timeout
+
   Watch() : notif_id(0) {}
 
   void add_notification(Notification *notif) {
@@ -96,6 +105,11 @@ public:
   }
 
   bool ack_notification(entity_name_t& watcher, Notification *notif);
+  /// account for a notify about to be completed (or timed out)
+  void note_complete(Notification *notif);
+
+  void dump_latency(ostream& ss);
+  void reset_latency();
 };
 
 
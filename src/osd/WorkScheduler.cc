@@ -0,0 +1,271 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "osd/WorkScheduler.h"
+#include "common/Clock.h"
+#include "common/ceph_context.h"
+#include "common/config.h"
+#include "common/dout.h"
+#include "common/perf_counters.h"
+
+#define dout_subsys ceph_subsys_osd
+#undef dout_prefix
+#define dout_prefix *_dout << "sched "
+
+enum {
+  l_osd_sched_first = 94500,
+  // per class: ops, cost, wait
+  l_osd_sched_last = l_osd_sched_first + 1 + 3 * WorkScheduler::NUM_CLASSES,
+};
+
+static int counter_idx(int c, int k)
+{
+  return l_osd_sched_first + 1 + 3 * c + k;
+}
+
+static const char *counter_names[WorkScheduler::NUM_CLASSES][3] = {
+  { "client_ops", "client_cost", "client_wait" },
+  { "recovery_ops", "recovery_cost", "recovery_wait" },
+  { "scrub_ops", "scrub_cost", "scrub_wait" },
+  { "snaptrim_ops", "snaptrim_cost", "snaptrim_wait" },
+};
+
+const char *WorkScheduler::get_class_name(int c)
+{
+  switch (c) {
+  case CLASS_CLIENT: return "client";
+  case CLASS_RECOVERY: return "recovery";
+  case CLASS_SCRUB: return "scrub";
+  case CLASS_SNAPTRIM: return "snaptrim";
+  default: return "???";
+  }
+}
+
+uint64_t WorkScheduler::io_cost(uint64_t bytes)
+{
+  return g_conf->osd_sched_op_cost + bytes;
+}
+
+WorkScheduler::WorkScheduler(CephContext *cct)
+  : cct(cct), lock("WorkScheduler::lock"),
+    burst(0), idle(0), max_wait(0),
+    client_ops_folded(0), client_cost_folded(0)
+{
+  PerfCountersBuilder b(cct, "osd_sched", l_osd_sched_first, l_osd_sched_last);
+  for (int c = 0; c < NUM_CLASSES; c++) {
+    b.add_u64_counter(counter_idx(c, 0), counter_names[c][0]);
+    b.add_u64_counter(counter_idx(c, 1), counter_names[c][1]);
+    b.add_fl_avg(counter_idx(c, 2), counter_names[c][2]);
+  }
+  logger = b.create_perf_counters();
+  cct->get_perfcounters_collection()->add(logger);
+
+  _read_config(cct->_conf);
+  cct->_conf->add_observer(this);
+}
+
+WorkScheduler::~WorkScheduler()
+{
+  cct->_conf->remove_observer(this);
+  cct->get_perfcounters_collection()->remove(logger);
+  delete logger;
+}
+
+const char** WorkScheduler::get_tracked_conf_keys() const
+{
+  static const char *KEYS[] = {
+    "osd_sched_client_weight",
+    "osd_sched_recovery_weight",
+    "osd_sched_scrub_weight",
+    "osd_sched_snaptrim_weight",
+    "osd_sched_client_reservation",
+    "osd_sched_recovery_reservation",
+    "osd_sched_scrub_reservation",
+    "osd_sched_snaptrim_reservation",
+    "osd_sched_burst",
+    "osd_sched_idle",
+    "osd_sched_max_wait",
+    NULL
+  };
+  return KEYS;
+}
+
+void WorkScheduler::handle_conf_change(const struct md_config_t *conf,
+				       const std::set <std::string> &changed)
+{
+  Mutex::Locker l(lock);
+  _read_config(conf);
+}
+
+void WorkScheduler::_read_config(const md_config_t *conf)
+{
+  classes[CLASS_CLIENT].weight = conf->osd_sched_client_weight;
+  classes[CLASS_RECOVERY].weight = conf->osd_sched_recovery_weight;
+  classes[CLASS_SCRUB].weight = conf->osd_sched_scrub_weight;
+  classes[CLASS_SNAPTRIM].weight = conf->osd_sched_snaptrim_weight;
+  classes[CLASS_CLIENT].reservation = conf->osd_sched_client_reservation;
+  classes[CLASS_RECOVERY].reservation = conf->osd_sched_recovery_reservation;
+  classes[CLASS_SCRUB].reservation = conf->osd_sched_scrub_reservation;
+  classes[CLASS_SNAPTRIM].reservation = conf->osd_sched_snaptrim_reservation;
+  for (int c = 0; c < NUM_CLASSES; c++)
+    if (classes[c].weight <= 0)
+      classes[c].weight = 1;
+  burst = conf->osd_sched_burst;
+  idle = conf->osd_sched_idle;
+  max_wait = conf->osd_sched_max_wait;
+}
+
+bool WorkScheduler::_min_other_vtime(int c, double *vt)
+{
+  bool found = false;
+  for (int o = 0; o < NUM_CLASSES; o++) {
+    if (o == c || !_has_work(o))
+      continue;
+    if (!found || classes[o].vtime < *vt)
+      *vt = classes[o].vtime;
+    found = true;
+  }
+  return found;
+}
+
+bool WorkScheduler::_should_wait(int c, utime_t now)
+{
+  if (now - window_start >= utime_t(1, 0)) {
+    window_start = now;
+    for (int o = 0; o < NUM_CLASSES; o++)
+      classes[o].window_cost = 0;
+  }
+  ClassState& cs = classes[c];
+  if (cs.reservation && cs.window_cost < cs.reservation)
+    return false;
+  double min_vt;
+  if (!_min_other_vtime(c, &min_vt))
+    return false;
+  return cs.vtime - min_vt > (double)burst / cs.weight;
+}
+
+void WorkScheduler::_level(int c, utime_t now)
+{
+  // a class coming back from idle starts level with the others, so it
+  // neither spends credit saved while idle nor pays for its history
+  bool found = false;
+  double min_vt = 0;
+  for (int o = 0; o < NUM_CLASSES; o++) {
+    if (o == c || !_is_active(o, now))
+      continue;
+    if (!found || classes[o].vtime < min_vt)
+      min_vt = classes[o].vtime;
+    found = true;
+  }
+  if (found)
+    classes[c].vtime = MAX(classes[c].vtime, min_vt);
+}
+
+void WorkScheduler::_charge(int c, uint64_t cost, utime_t now)
+{
+  ClassState& cs = classes[c];
+  cs.vtime += (double)cost / cs.weight;
+  cs.window_cost += cost;
+  cs.last_active = now;
+  cond.Signal();
+
+  logger->inc(counter_idx(c, 0));
+  logger->inc(counter_idx(c, 1), cost);
+}
+
+void WorkScheduler::_fold_client(utime_t now)
+{
+  // the counters only grow (modulo wrap), so the difference is what
+  // the op shards charged since we last looked
+  uint64_t ops = client_ops.read();
+  uint64_t total = client_cost.read();
+  uint64_t n = ops - client_ops_folded;
+  uint64_t cost = total - client_cost_folded;
+  client_ops_folded = ops;
+  client_cost_folded = total;
+  if (!n && !_has_work(CLASS_CLIENT))
+    return;
+
+  // the first time we see the client busy after an idle stretch it
+  // starts level, so it can't bank credit for the time it was away;
+  // after that, any fold that finds it busy keeps it active
+  if (!_recently_active(CLASS_CLIENT, now))
+    _level(CLASS_CLIENT, now);
+  ClassState& cs = classes[CLASS_CLIENT];
+  cs.vtime += (double)cost / cs.weight;
+  cs.window_cost += cost;
+  cs.last_active = now;
+
+  if (n) {
+    logger->inc(counter_idx(CLASS_CLIENT, 0), n);
+    logger->inc(counter_idx(CLASS_CLIENT, 1), cost);
+  }
+}
+
+void WorkScheduler::charge(int c, uint64_t cost)
+{
+  assert(c > CLASS_CLIENT && c < NUM_CLASSES);
+  Mutex::Locker l(lock);
+  utime_t now = ceph_clock_now(cct);
+  _fold_client(now);
+  if (!_is_active(c, now))
+    _level(c, now);
+  _charge(c, cost, now);
+}
+
+bool WorkScheduler::may_run(int c)
+{
+  assert(c > CLASS_CLIENT && c < NUM_CLASSES);
+  Mutex::Locker l(lock);
+  utime_t now = ceph_clock_now(cct);
+  _fold_client(now);
+  if (!_is_active(c, now))
+    _level(c, now);
+  return !_should_wait(c, now);
+}
+
+void WorkScheduler::get(int c, uint64_t cost)
+{
+  assert(c > CLASS_CLIENT && c < NUM_CLASSES);
+  Mutex::Locker l(lock);
+  ClassState& cs = classes[c];
+  utime_t now = ceph_clock_now(cct);
+  _fold_client(now);
+  if (!_is_active(c, now))
+    _level(c, now);
+
+  utime_t start = now;
+  bool waited = false;
+  cs.waiting++;
+  while (_should_wait(c, now)) {
+    if ((double)(now - start) >= max_wait) {
+      ldout(cct, 10) << get_class_name(c) << " waited " << (now - start)
+		     << ", going anyway" << dendl;
+      break;
+    }
+    if (!waited)
+      ldout(cct, 20) << get_class_name(c) << " vtime " << cs.vtime
+		     << " ahead, waiting" << dendl;
+    waited = true;
+    // client progress doesn't signal us; poll for it
+    cond.WaitInterval(cct, lock, utime_t(0, 10000000));
+    now = ceph_clock_now(cct);
+    _fold_client(now);
+  }
+  cs.waiting--;
+
+  _charge(c, cost, now);
+  if (waited)
+    logger->finc(counter_idx(c, 2), now - start);
+}
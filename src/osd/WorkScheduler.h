@@ -0,0 +1,148 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_WORKSCHEDULER_H
+#define CEPH_OSD_WORKSCHEDULER_H
+
+#include "common/Mutex.h"
+#include "common/Cond.h"
+#include "common/config_obs.h"
+#include "include/atomic.h"
+#include "include/utime.h"
+
+class CephContext;
+class PerfCounters;
+
+/**
+ * WorkScheduler
+ *
+ * Weighted fair sharing of the OSD's disk between classes of work.
+ * Each unit of work is charged an estimated cost (bytes, plus
+ * osd_sched_op_cost per IO), and each class accumulates virtual time,
+ * cost / weight.
+ *
+ * Only background classes (recovery, scrub, snap trim) ever wait.
+ * Their threads call get() before or after a unit of work. A class
+ * that is more than osd_sched_burst / weight ahead of the slowest
+ * other class *with work waiting* waits for it to catch up. If nobody
+ * else has work, it runs, so the scheduler is work conserving.
+ *
+ * Client ops never take the scheduler lock: the op shards only bump
+ * atomic counters with add_client_queued() and charge_client(), and
+ * those are folded into the client's vtime whenever a background
+ * class comes to get() or charge().  Ops sitting in the shard queues
+ * are what hold background work back while the client is ahead on
+ * its share.
+ *
+ * A class that has charged less than its reservation in the current
+ * second is always admitted.  A class coming back after osd_sched_idle
+ * seconds without work starts level with the others.  Waits are capped
+ * at osd_sched_max_wait so a stalled class can't trip the thread pool
+ * heartbeat.
+ */
+class WorkScheduler : public md_config_obs_t {
+public:
+  enum {
+    CLASS_CLIENT,
+    CLASS_RECOVERY,
+    CLASS_SCRUB,
+    CLASS_SNAPTRIM,
+    NUM_CLASSES
+  };
+  static const char *get_class_name(int c);
+
+private:
+  struct ClassState {
+    double weight;
+    uint64_t reservation;  ///< cost per second admitted regardless of share
+    double vtime;          ///< charged cost / weight
+    uint64_t window_cost;  ///< cost charged in the current second
+    utime_t last_active;
+    int waiting;           ///< threads blocked in get()
+    ClassState()
+      : weight(1), reservation(0), vtime(0), window_cost(0), waiting(0) {}
+  };
+
+  CephContext *cct;
+  Mutex lock;
+  Cond cond;
+  ClassState classes[NUM_CLASSES];
+  utime_t window_start;
+  PerfCounters *logger;
+
+  // config, cached under lock by handle_conf_change()
+  uint64_t burst;
+  double idle;
+  double max_wait;
+
+  // client accounting, updated without the lock
+  atomic_t client_queued;  ///< ops sitting in the op shards
+  atomic_t client_ops;     ///< ops charged, ever
+  atomic_t client_cost;    ///< cost charged, ever (wraps)
+  uint64_t client_ops_folded, client_cost_folded;
+
+  void _read_config(const md_config_t *conf);
+  bool _recently_active(int c, utime_t now) {
+    return classes[c].last_active != utime_t() &&
+      (double)(now - classes[c].last_active) < idle;
+  }
+  bool _has_work(int c) {
+    if (c == CLASS_CLIENT)
+      return client_queued.read() > 0;
+    return classes[c].waiting > 0;
+  }
+  bool _is_active(int c, utime_t now) {
+    return _has_work(c) || _recently_active(c, now);
+  }
+  /// lowest vtime among other classes with work waiting; false if none
+  bool _min_other_vtime(int c, double *vt);
+  bool _should_wait(int c, utime_t now);
+  void _level(int c, utime_t now);
+  void _charge(int c, uint64_t cost, utime_t now);
+  void _fold_client(utime_t now);
+
+public:
+  WorkScheduler(CephContext *cct);
+  ~WorkScheduler();
+
+  const char** get_tracked_conf_keys() const;
+  void handle_conf_change(const struct md_config_t *conf,
+			  const std::set <std::string> &changed);
+
+  /// block until background class c may do work of the given cost,
+  /// then charge it
+  void get(int c, uint64_t cost);
+  /// charge background class c without waiting
+  void charge(int c, uint64_t cost);
+  /// true if background class c could go now without waiting in get()
+  bool may_run(int c);
+
+  /// note n more (or fewer) client ops queued for an op thread
+  void add_client_queued(int n) {
+    if (n > 0)
+      client_queued.add(n);
+    else
+      client_queued.sub(-n);
+  }
+  /// charge a client op
+  void charge_client(uint64_t cost) {
+    client_ops.inc();
+    client_cost.add(cost);
+  }
+
+  /// cost of an IO moving the given number of bytes
+  static uint64_t io_cost(uint64_t bytes);
+};
+
+#endif
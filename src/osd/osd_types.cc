@@ -1077,6 +1077,141 @@ void pg_stat_t::decode(bufferlist::iterator &bl)
   DECODE_FINISH(bl);
 }
 
+// -- pg_stat_delta_t --
+
+bool pg_stat_delta_t::build(const pg_stat_t& base, const pg_stat_t& cur)
+{
+  base_reported = base.reported;
+  version = cur.version;
+  reported = cur.reported;
+  last_fresh = cur.last_fresh;
+  last_change = cur.last_change;
+  last_active = cur.last_active;
+  last_clean = cur.last_clean;
+  last_unstale = cur.last_unstale;
+  log_start = cur.log_start;
+  ondisk_log_start = cur.ondisk_log_start;
+  log_size = cur.log_size;
+  ondisk_log_size = cur.ondisk_log_size;
+  sum = cur.stats.sum;
+  sum.sub(base.stats.sum);
+
+  // compare encodings, so fields added to pg_stat_t later are covered
+  pg_stat_t check = base;
+  apply(check);
+  bufferlist a, b;
+  ::encode(check, a);
+  ::encode(cur, b);
+  return a.contents_equal(b);
+}
+
+void pg_stat_delta_t::apply(pg_stat_t& s) const
+{
+  s.version = version;
+  s.reported = reported;
+  s.last_fresh = last_fresh;
+  s.last_change = last_change;
+  s.last_active = last_active;
+  s.last_clean = last_clean;
+  s.last_unstale = last_unstale;
+  s.log_start = log_start;
+  s.ondisk_log_start = ondisk_log_start;
+  s.log_size = log_size;
+  s.ondisk_log_size = ondisk_log_size;
+  s.stats.sum.add(sum);
+}
+
+void pg_stat_delta_t::dump(Formatter *f) const
+{
+  f->dump_stream("base_reported") << base_reported;
+  f->dump_stream("version") << version;
+  f->dump_stream("reported") << reported;
+  f->dump_stream("last_fresh") << last_fresh;
+  f->dump_stream("last_change") << last_change;
+  f->dump_stream("last_active") << last_active;
+  f->dump_stream("last_clean") << last_clean;
+  f->dump_stream("last_unstale") << last_unstale;
+  f->dump_stream("log_start") << log_start;
+  f->dump_stream("ondisk_log_start") << ondisk_log_start;
+  f->dump_int("log_size", log_size);
+  f->dump_int("ondisk_log_size", ondisk_log_size);
+  f->open_object_section("sum");
+  sum.dump(f);
+  f->close_section();
+}
+
+void pg_stat_delta_t::encode(bufferlist &bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(base_reported, bl);
+  ::encode(version, bl);
+  ::encode(reported, bl);
+  ::encode(last_fresh, bl);
+  ::encode(last_change, bl);
+  ::encode(last_active, bl);
+  ::encode(last_clean, bl);
+  ::encode(last_unstale, bl);
+  ::encode(log_start, bl);
+  ::encode(ondisk_log_start, bl);
+  ::encode(log_size, bl);
+  ::encode(ondisk_log_size, bl);
+  // idle pgs have nothing to add
+  __u8 have_sum = !sum.is_zero();
+  ::encode(have_sum, bl);
+  if (have_sum)
+    ::encode(sum, bl);
+  ENCODE_FINISH(bl);
+}
+
+void pg_stat_delta_t::decode(bufferlist::iterator &bl)
+{
+  DECODE_START(1, bl);
+  ::decode(base_reported, bl);
+  ::decode(version, bl);
+  ::decode(reported, bl);
+  ::decode(last_fresh, bl);
+  ::decode(last_change, bl);
+  ::decode(last_active, bl);
+  ::decode(last_clean, bl);
+  ::decode(last_unstale, bl);
+  ::decode(log_start, bl);
+  ::decode(ondisk_log_start, bl);
+  ::decode(log_size, bl);
+  ::decode(ondisk_log_size, bl);
+  __u8 have_sum;
+  ::decode(have_sum, bl);
+  if (have_sum)
+    ::decode(sum, bl);
+  else
+    sum.clear();
+  DECODE_FINISH(bl);
+}
+
+void pg_stat_delta_t::generate_test_instances(list<pg_stat_delta_t*>& o)
+{
+  pg_stat_delta_t a;
+  o.push_back(new pg_stat_delta_t(a));
+
+  a.base_reported = eversion_t(1, 2);
+  a.version = eversion_t(1, 4);
+  a.reported = eversion_t(1, 3);
+  a.last_fresh = utime_t(1002, 1);
+  a.last_change = utime_t(1002, 2);
+  a.last_active = utime_t(1002, 3);
+  a.last_clean = utime_t(1002, 4);
+  a.last_unstale = utime_t(1002, 5);
+  a.log_start = eversion_t(1, 1);
+  a.ondisk_log_start = eversion_t(1, 1);
+  a.log_size = 3;
+  a.ondisk_log_size = 3;
+  o.push_back(new pg_stat_delta_t(a));
+
+  list<object_stat_sum_t*> l;
+  object_stat_sum_t::generate_test_instances(l);
+  a.sum = *l.back();
+  o.push_back(new pg_stat_delta_t(a));
+}
+
 void pg_stat_t::generate_test_instances(list<pg_stat_t*>& o)
 {
   pg_stat_t a;
@@ -1552,7 +1687,7 @@ void pg_query_t::generate_test_instances(list<pg_query_t*>& o)
 
 void pg_log_entry_t::encode(bufferlist &bl) const
 {
-  ENCODE_START(5, 4, bl);
+  ENCODE_START(6, 4, bl);
   ::encode(op, bl);
   ::encode(soid, bl);
   ::encode(version, bl);
@@ -1561,12 +1696,15 @@ void pg_log_entry_t::encode(bufferlist &bl) const
   ::encode(mtime, bl);
   if (op == CLONE)
     ::encode(snaps, bl);
+  ::encode(dirty_extents_valid, bl);
+  if (dirty_extents_valid)
+    ::encode(dirty_extents, bl);
   ENCODE_FINISH(bl);
 }
 
 void pg_log_entry_t::decode(bufferlist::iterator &bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(5, 4, 4, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(6, 4, 4, bl);
   ::decode(op, bl);
   if (struct_v < 2) {
     sobject_t old_soid;
@@ -1587,6 +1725,13 @@ void pg_log_entry_t::decode(bufferlist::iterator &bl)
     ::decode(snaps, bl);
   if (struct_v < 5)
     invalid_pool = true;
+  if (struct_v >= 6) {
+    ::decode(dirty_extents_valid, bl);
+    if (dirty_extents_valid)
+      ::decode(dirty_extents, bl);
+  } else {
+    dirty_extents_valid = false;
+  }
   DECODE_FINISH(bl);
 }
 
@@ -1598,6 +1743,8 @@ void pg_log_entry_t::dump(Formatter *f) const
   f->dump_stream("prior_version") << version;
   f->dump_stream("reqid") << reqid;
   f->dump_stream("mtime") << mtime;
+  if (dirty_extents_valid)
+    f->dump_stream("dirty_extents") << dirty_extents;
 }
 
 void pg_log_entry_t::generate_test_instances(list<pg_log_entry_t*>& o)
@@ -1606,6 +1753,10 @@ void pg_log_entry_t::generate_test_instances(list<pg_log_entry_t*>& o)
   hobject_t oid(object_t("objname"), "key", 123, 456, 0);
   o.push_back(new pg_log_entry_t(MODIFY, oid, eversion_t(1,2), eversion_t(3,4),
 				 osd_reqid_t(entity_name_t::CLIENT(777), 8, 999), utime_t(8,9)));
+  o.push_back(new pg_log_entry_t(MODIFY, oid, eversion_t(1,3), eversion_t(1,2),
+				 osd_reqid_t(entity_name_t::CLIENT(777), 9, 999), utime_t(8,9)));
+  o.back()->dirty_extents.insert(4096, 8192);
+  o.back()->dirty_extents_valid = true;
 }
 
 ostream& operator<<(ostream& out, const pg_log_entry_t& e)
@@ -1855,6 +2006,12 @@ eversion_t pg_missing_t::have_old(const hobject_t& oid) const
   return item.have;
 }
 
+bool pg_missing_t::can_apply_delta(const hobject_t& oid,
+				   eversion_t delta_from) const
+{
+  return delta_from != eversion_t() && have_old(oid) == delta_from;
+}
+
 /*
  * this needs to be called in log order as we extend the log.  it
  * assumes missing is accurate up through the previous log entry.
@@ -2405,7 +2562,7 @@ void ObjectRecoveryProgress::dump(Formatter *f) const
 
 void ObjectRecoveryInfo::encode(bufferlist &bl) const
 {
-  ENCODE_START(2, 1, bl);
+  ENCODE_START(3, 1, bl);
   ::encode(soid, bl);
   ::encode(version, bl);
   ::encode(size, bl);
@@ -2413,13 +2570,14 @@ void ObjectRecoveryInfo::encode(bufferlist &bl) const
   ::encode(ss, bl);
   ::encode(copy_subset, bl);
   ::encode(clone_subset, bl);
+  ::encode(delta_from, bl);
   ENCODE_FINISH(bl);
 }
 
 void ObjectRecoveryInfo::decode(bufferlist::iterator &bl,
 				int64_t pool)
 {
-  DECODE_START(2, bl);
+  DECODE_START(3, bl);
   ::decode(soid, bl);
   ::decode(version, bl);
   ::decode(size, bl);
@@ -2427,6 +2585,8 @@ void ObjectRecoveryInfo::decode(bufferlist::iterator &bl,
   ::decode(ss, bl);
   ::decode(copy_subset, bl);
   ::decode(clone_subset, bl);
+  if (struct_v >= 3)
+    ::decode(delta_from, bl);
   DECODE_FINISH(bl);
 
   if (struct_v < 2) {
@@ -2472,6 +2632,7 @@ void ObjectRecoveryInfo::dump(Formatter *f) const
   }
   f->dump_stream("copy_subset") << copy_subset;
   f->dump_stream("clone_subset") << clone_subset;
+  f->dump_stream("delta_from") << delta_from;
 }
 
 ostream& operator<<(ostream& out, const ObjectRecoveryInfo &inf)
@@ -2485,6 +2646,7 @@ ostream &ObjectRecoveryInfo::print(ostream &out) const
 	     << soid << "@" << version
 	     << ", copy_subset: " << copy_subset
 	     << ", clone_subset: " << clone_subset
+	     << ", delta_from: " << delta_from
 	     << ")";
 }
 
@@ -2591,19 +2753,28 @@ void ScrubMap::generate_test_instances(list<ScrubMap*>& o)
 
 void ScrubMap::object::encode(bufferlist& bl) const
 {
-  ENCODE_START(2, 2, bl);
+  ENCODE_START(3, 2, bl);
   ::encode(size, bl);
   ::encode(negative, bl);
   ::encode(attrs, bl);
+  ::encode(digest_present, bl);
+  ::encode(digest, bl);
   ENCODE_FINISH(bl);
 }
 
 void ScrubMap::object::decode(bufferlist::iterator& bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(2, 2, 2, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(3, 2, 2, bl);
   ::decode(size, bl);
   ::decode(negative, bl);
   ::decode(attrs, bl);
+  if (struct_v >= 3) {
+    ::decode(digest_present, bl);
+    ::decode(digest, bl);
+  } else {
+    digest_present = false;
+    digest = 0;
+  }
   DECODE_FINISH(bl);
 }
 
@@ -2611,6 +2782,8 @@ void ScrubMap::object::dump(Formatter *f) const
 {
   f->dump_int("size", size);
   f->dump_int("negative", negative);
+  if (digest_present)
+    f->dump_unsigned("digest", digest);
   f->open_array_section("attrs");
   for (map<string,bufferptr>::const_iterator p = attrs.begin(); p != attrs.end(); ++p) {
     f->open_object_section("attr");
@@ -2630,6 +2803,10 @@ void ScrubMap::object::generate_test_instances(list<object*>& o)
   o.back()->size = 123;
   o.back()->attrs["foo"] = buffer::copy("foo", 3);
   o.back()->attrs["bar"] = buffer::copy("barval", 6);
+  o.push_back(new object);
+  o.back()->size = 4096;
+  o.back()->digest_present = true;
+  o.back()->digest = 0x12345678;
 }
 
 // -- OSDOp --
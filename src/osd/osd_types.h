@@ -448,6 +448,13 @@ public:
     version++;
   }
 
+  /// fixed width key that sorts like eversion_t (e.g., for omap)
+  string get_key_name() const {
+    char key[40];
+    snprintf(key, sizeof(key), "%010u.%020llu", epoch, (unsigned long long)version);
+    return string(key);
+  }
+
   void encode(bufferlist &bl) const {
     ::encode(version, bl);
     ::encode(epoch, bl);
@@ -898,6 +905,37 @@ struct pg_stat_t {
 };
 WRITE_CLASS_ENCODER(pg_stat_t)
 
+/*
+ * pg_stat_delta_t - a pg_stat_t relative to one the mon already has
+ *
+ * Covers what moves while a pg is active on a stable mapping: the
+ * versions, freshness stamps, log bounds and summed object stats.  If
+ * anything else changed (state, mapping, scrub, per-category stats)
+ * the full pg_stat_t has to be sent.  An idle pg's delta is just the
+ * versions and stamps.
+ */
+struct pg_stat_delta_t {
+  eversion_t base_reported;   // reported of the stats this applies to
+  eversion_t version;
+  eversion_t reported;
+  utime_t last_fresh, last_change, last_active, last_clean, last_unstale;
+  eversion_t log_start, ondisk_log_start;
+  int64_t log_size, ondisk_log_size;
+  object_stat_sum_t sum;      // cur.stats.sum - base.stats.sum
+
+  pg_stat_delta_t() : log_size(0), ondisk_log_size(0) {}
+
+  /// @return true if cur is base plus this delta
+  bool build(const pg_stat_t& base, const pg_stat_t& cur);
+  void apply(pg_stat_t& base) const;
+
+  void dump(Formatter *f) const;
+  void encode(bufferlist &bl) const;
+  void decode(bufferlist::iterator &bl);
+  static void generate_test_instances(list<pg_stat_delta_t*>& o);
+};
+WRITE_CLASS_ENCODER(pg_stat_delta_t)
+
 /*
  * summation over an entire pool
  */
@@ -1233,16 +1271,22 @@ struct pg_log_entry_t {
   bool invalid_hash; // only when decoding sobject_t based entries
   bool invalid_pool; // only when decoding pool-less hobject based entries
 
+  /// object data written, zeroed or truncated away by this MODIFY, if
+  /// dirty_extents_valid; lets recovery push just these to a stale copy
+  interval_set<uint64_t> dirty_extents;
+  bool dirty_extents_valid;
+
   uint64_t offset;   // [soft state] my offset on disk
       
   pg_log_entry_t()
-    : op(0), invalid_hash(false), offset(0) {}
+    : op(0), invalid_hash(false), dirty_extents_valid(false), offset(0) {}
   pg_log_entry_t(int _op, const hobject_t& _soid, 
 		 const eversion_t& v, const eversion_t& pv,
 		 const osd_reqid_t& rid, const utime_t& mt)
     : op(_op), soid(_soid), version(v),
       prior_version(pv),
       reqid(rid), mtime(mt), invalid_hash(false), invalid_pool(false),
+      dirty_extents_valid(false),
       offset(0) {}
       
   bool is_clone() const { return op == CLONE; }
@@ -1263,6 +1307,13 @@ struct pg_log_entry_t {
     return reqid != osd_reqid_t() && (op == MODIFY || op == DELETE);
   }
 
+  /// a replica may serve reads past this entry once it is committed on
+  /// every replica and applied to our own store; with a writeahead
+  /// journal the second can lag the first
+  bool readable_on_replica(eversion_t committed_to, eversion_t applied) const {
+    return version <= committed_to && version <= applied;
+  }
+
   void encode(bufferlist &bl) const;
   void decode(bufferlist::iterator &bl);
   void dump(Formatter *f) const;
@@ -1414,6 +1465,8 @@ struct pg_missing_t {
   bool is_missing(const hobject_t& oid) const;
   bool is_missing(const hobject_t& oid, eversion_t v) const;
   eversion_t have_old(const hobject_t& oid) const;
+  /// true if our stale copy of oid is the base a delta push was built on
+  bool can_apply_delta(const hobject_t& oid, eversion_t delta_from) const;
   void add_next_event(const pg_log_entry_t& e);
   void revise_need(hobject_t oid, eversion_t need);
   void revise_have(hobject_t oid, eversion_t have);
@@ -1728,6 +1781,8 @@ struct ObjectRecoveryInfo {
   SnapSet ss;
   interval_set<uint64_t> copy_subset;
   map<hobject_t, interval_set<uint64_t> > clone_subset;
+  /// if set, copy_subset is applied on top of the target's copy at this version
+  eversion_t delta_from;
 
   ObjectRecoveryInfo() : size(0) { }
 
@@ -1777,8 +1832,10 @@ struct ScrubMap {
     uint64_t size;
     bool negative;
     map<string,bufferptr> attrs;
+    bool digest_present;  ///< digest was computed (deep scrub)
+    uint32_t digest;      ///< crc32c of the object data
 
-    object(): size(0), negative(false) {}
+    object(): size(0), negative(false), digest_present(false), digest(0) {}
 
     void encode(bufferlist& bl) const;
     void decode(bufferlist::iterator& bl);
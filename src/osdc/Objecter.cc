@@ -469,6 +469,9 @@ void Objecter::handle_osd_map(MOSDMap *m)
             << "] > " << osdmap->get_epoch()
             << dendl;
 
+    if (cct->_conf->objecter_pg_mappings && !osdmap->have_pg_mappings())
+      osdmap->build_pg_mappings();
+
     if (osdmap->get_epoch()) {
       // we want incrementals
       for (epoch_t e = osdmap->get_epoch() + 1;
@@ -1296,6 +1299,11 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 
   if (rc == -EAGAIN) {
     ldout(cct, 7) << " got -EAGAIN, resubmitting" << dendl;
+    if (op->used_replica) {
+      // the replica can't serve it (yet); go to the primary
+      op->flags &= ~(CEPH_OSD_FLAG_BALANCE_READS | CEPH_OSD_FLAG_LOCALIZE_READS);
+      op->acting.clear();
+    }
     if (op->onack)
       num_unacked--;
     if (op->oncommit)
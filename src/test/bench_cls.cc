@@ -0,0 +1,178 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * Time object class calls against a running cluster: the rgw bucket
+ * index updates every object PUT does, and the rbd header calls every
+ * image open does.
+ *
+ *   bench_cls [rgw|rbd|all] [num_ops]
+ */
+
+#include "include/types.h"
+#include "include/rados/librados.hpp"
+#include "include/utime.h"
+#include "common/Clock.h"
+#include "common/LatencyHistogram.h"
+#include "common/errno.h"
+#include "cls/rgw/cls_rgw_client.h"
+#include "librbd/cls_rbd_client.h"
+#include "test/rados-api/test.h"
+
+#include <errno.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace librados;
+
+struct Timer {
+  const char *name;
+  LatencyHistogram hist;
+  utime_t total;
+  int errors;
+
+  Timer(const char *n) : name(n), errors(0) {}
+
+  void add(utime_t start, int r) {
+    utime_t lat = ceph_clock_now(NULL) - start;
+    hist.add(lat);
+    total += lat;
+    if (r < 0)
+      errors++;
+  }
+
+  void report() const {
+    uint64_t n = hist.get_count();
+    if (!n)
+      return;
+    double secs = (double)total;
+    cout << name << ": " << n << " calls in " << total << "s, "
+	 << (double)n / secs << " calls/s, avg " << secs * 1000000.0 / n << "us"
+	 << ", p50 <" << hist.get_percentile(50) << "us"
+	 << ", p99 <" << hist.get_percentile(99) << "us";
+    if (errors)
+      cout << ", " << errors << " errors";
+    cout << std::endl;
+  }
+};
+
+static int bench_rgw(IoCtx& ioctx, int num)
+{
+  string oid = "bench_cls.rgw_index";
+  ObjectWriteOperation init;
+  bufferlist in;
+  init.exec("rgw", "bucket_init_index", in);
+  int r = ioctx.operate(oid, &init);
+  if (r < 0) {
+    cerr << "rgw: bucket_init_index failed: " << cpp_strerror(r)
+	 << " (is libcls_rgw loaded?)" << std::endl;
+    return r;
+  }
+
+  Timer prepare("rgw bucket_prepare_op"), complete("rgw bucket_complete_op");
+  string locator;
+  for (int i = 0; i < num; i++) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "obj.%d", i);
+    string name = buf;
+    snprintf(buf, sizeof(buf), "tag.%d", i);
+    string tag = buf;
+
+    ObjectWriteOperation p;
+    cls_rgw_bucket_prepare_op(p, CLS_RGW_OP_ADD, tag, name, locator);
+    utime_t start = ceph_clock_now(NULL);
+    r = ioctx.operate(oid, &p);
+    prepare.add(start, r);
+
+    rgw_bucket_dir_entry_meta meta;
+    meta.category = 1;
+    meta.size = 4096;
+    meta.mtime = ceph_clock_now(NULL);
+    ObjectWriteOperation c;
+    cls_rgw_bucket_complete_op(c, CLS_RGW_OP_ADD, tag, i + 1, name, meta);
+    start = ceph_clock_now(NULL);
+    r = ioctx.operate(oid, &c);
+    complete.add(start, r);
+  }
+  prepare.report();
+  complete.report();
+  return 0;
+}
+
+static int bench_rbd(IoCtx& ioctx, int num)
+{
+  string oid = "bench_cls.rbd_header";
+  int r = librbd::cls_client::create_image(&ioctx, oid, 1 << 30, 22, 0,
+					    "bench_cls_data");
+  if (r < 0) {
+    cerr << "rbd: create failed: " << cpp_strerror(r)
+	 << " (is libcls_rbd loaded?)" << std::endl;
+    return r;
+  }
+
+  Timer get_size("rbd get_size"), set_size("rbd set_size");
+  for (int i = 0; i < num; i++) {
+    uint64_t size;
+    uint8_t order;
+    utime_t start = ceph_clock_now(NULL);
+    r = librbd::cls_client::get_size(&ioctx, oid, CEPH_NOSNAP, &size, &order);
+    get_size.add(start, r);
+
+    start = ceph_clock_now(NULL);
+    r = librbd::cls_client::set_size(&ioctx, oid, (1ull << 30) + (i % 2) * 4096);
+    set_size.add(start, r);
+  }
+  get_size.report();
+  set_size.report();
+  return 0;
+}
+
+int main(int argc, const char **argv)
+{
+  const char *which = argc > 1 ? argv[1] : "all";
+  int num = argc > 2 ? atoi(argv[2]) : 1000;
+  bool rgw = !strcmp(which, "all") || !strcmp(which, "rgw");
+  bool rbd = !strcmp(which, "all") || !strcmp(which, "rbd");
+  if ((!rgw && !rbd) || num <= 0) {
+    cerr << "usage: bench_cls [rgw|rbd|all] [num_ops]" << std::endl;
+    return 1;
+  }
+
+  Rados rados;
+  IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+  string err = create_one_pool_pp(pool_name, rados);
+  if (err.length()) {
+    cerr << err << std::endl;
+    return 1;
+  }
+  int r = rados.ioctx_create(pool_name.c_str(), ioctx);
+  if (r < 0) {
+    cerr << "ioctx_create failed: " << cpp_strerror(r) << std::endl;
+    destroy_one_pool_pp(pool_name, rados);
+    return 1;
+  }
+
+  cout << num << " calls each" << std::endl;
+  int ret = 0;
+  if (rgw && bench_rgw(ioctx, num) < 0)
+    ret = 1;
+  if (rbd && bench_rbd(ioctx, num) < 0)
+    ret = 1;
+
+  ioctx.close();
+  destroy_one_pool_pp(pool_name, rados);
+  return ret;
+}
@@ -0,0 +1,117 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * Decode a synthetic stream of MOSDOp/MOSDOpReply messages through
+ * decode_message() and report how many message allocations were
+ * served by the per-type MessageSlab vs the heap.  Run with
+ * --no-slab to trim the slab after every message for a baseline.
+ */
+
+#include "include/types.h"
+#include "common/Clock.h"
+#include "common/config.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "msg/Message.h"
+#include "messages/MOSDOp.h"
+#include "messages/MOSDOpReply.h"
+
+#include <iostream>
+
+static void usage()
+{
+  cout << "usage: bench_msg_alloc [--num N] [--ops-per-msg N] [--no-slab]" << std::endl;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  int num = 1000000;
+  int ops_per_msg = 1;
+  bool slab = true;
+  std::string val;
+  for (std::vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_witharg(args, i, &val, "--num", (char*)NULL)) {
+      num = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--ops-per-msg", (char*)NULL)) {
+      ops_per_msg = atoi(val.c_str());
+    } else if (ceph_argparse_flag(args, i, "--no-slab", (char*)NULL)) {
+      slab = false;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  // build one encoded op and reply to replay
+  object_t oid("rb.0.1234.000000000001");
+  object_locator_t oloc(0);
+  pg_t pgid(1, 0, -1);
+  MOSDOp *op = new MOSDOp(1, 1, oid, oloc, pgid, 1, CEPH_OSD_FLAG_WRITE);
+  bufferlist bl;
+  bl.append_zero(4096);
+  op->write(0, 4096, bl);
+  for (int i = 1; i < ops_per_msg; i++)
+    op->stat();
+  MOSDOpReply *reply = new MOSDOpReply(op, 0, 1, CEPH_OSD_FLAG_ACK);
+
+  bufferlist op_bl, reply_bl;
+  encode_message(op, CEPH_FEATURES_ALL, op_bl);
+  encode_message(reply, CEPH_FEATURES_ALL, reply_bl);
+  op->put();
+  reply->put();
+  MessageSlab<MOSDOp>::trim();
+  MessageSlab<MOSDOpReply>::trim();
+
+  uint64_t op_alloc = MessageSlab<MOSDOp>::get_num_alloc();
+  uint64_t op_reuse = MessageSlab<MOSDOp>::get_num_reuse();
+  uint64_t reply_alloc = MessageSlab<MOSDOpReply>::get_num_alloc();
+  uint64_t reply_reuse = MessageSlab<MOSDOpReply>::get_num_reuse();
+
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (int i = 0; i < num; i++) {
+    bufferlist::iterator p = op_bl.begin();
+    Message *m = decode_message(g_ceph_context, p);
+    assert(m);
+    bufferlist::iterator q = reply_bl.begin();
+    Message *r = decode_message(g_ceph_context, q);
+    assert(r);
+    m->put();
+    r->put();
+    if (!slab) {
+      MessageSlab<MOSDOp>::trim();
+      MessageSlab<MOSDOpReply>::trim();
+    }
+  }
+  utime_t dur = ceph_clock_now(g_ceph_context) - start;
+
+  cout << num << " op+reply pairs in " << dur << " s, "
+       << (double)num / (double)dur << " pairs/s" << std::endl;
+  cout << "MOSDOp:      " << (MessageSlab<MOSDOp>::get_num_alloc() - op_alloc)
+       << " heap allocs, " << (MessageSlab<MOSDOp>::get_num_reuse() - op_reuse)
+       << " slab reuses" << std::endl;
+  cout << "MOSDOpReply: " << (MessageSlab<MOSDOpReply>::get_num_alloc() - reply_alloc)
+       << " heap allocs, " << (MessageSlab<MOSDOpReply>::get_num_reuse() - reply_reuse)
+       << " slab reuses" << std::endl;
+  return 0;
+}
@@ -0,0 +1,278 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * In-process messenger benchmark.
+ *
+ * Starts --servers server and --clients client Messengers in this
+ * process, bound to loopback.  Each client thread sends --num messages
+ * with --size bytes of data, round robin over all servers (so clients >
+ * servers is fan-in, servers > clients is fan-out), keeping at most
+ * --window in flight.  Servers echo each message back with --reply-size
+ * bytes of data.  Priorities cycle through the comma separated --prio
+ * list.
+ *
+ * Reports msgs/s and MB/s (requests and replies, both directions), round
+ * trip p50/p99 latency, and process CPU time per message.  Only the
+ * Messenger interface is used, so whatever Messenger::create() builds is
+ * what gets measured.
+ */
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "include/types.h"
+#include "common/Clock.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "common/LatencyHistogram.h"
+#include "common/config.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "msg/Messenger.h"
+#include "messages/MPing.h"
+
+static LatencyHistogram rtt;
+static atomic_t msgs_done, bytes_done;
+
+class BenchServer : public Dispatcher {
+  Messenger *msgr;
+  bufferlist reply_data;
+
+public:
+  BenchServer(CephContext *cct, Messenger *m, unsigned reply_size)
+    : Dispatcher(cct), msgr(m) {
+    if (reply_size)
+      reply_data.append(buffer::create(reply_size));
+  }
+
+  bool ms_dispatch(Message *m) {
+    MPing *reply = new MPing;
+    reply->set_tid(m->get_tid());
+    reply->set_priority(m->get_priority());
+    if (reply_data.length())
+      reply->set_data(reply_data);
+    msgr->send_message(reply, m->get_connection());
+    m->put();
+    return true;
+  }
+  bool ms_handle_reset(Connection *con) { return false; }
+  void ms_handle_remote_reset(Connection *con) {}
+};
+
+class BenchClient : public Dispatcher, public Thread {
+  Messenger *msgr;
+  vector<entity_inst_t> servers;
+  vector<int> prios;
+  int num, window;
+  bufferlist data;
+
+  Mutex lock;
+  Cond cond;
+  map<uint64_t, utime_t> in_flight;
+
+public:
+  BenchClient(CephContext *cct, Messenger *m, const vector<entity_inst_t>& s,
+	      const vector<int>& p, int n, int w, unsigned size)
+    : Dispatcher(cct), msgr(m), servers(s), prios(p), num(n), window(w),
+      lock("BenchClient::lock") {
+    if (size)
+      data.append(buffer::create(size));
+  }
+
+  bool ms_dispatch(Message *m) {
+    utime_t now = ceph_clock_now(cct);
+    lock.Lock();
+    map<uint64_t, utime_t>::iterator p = in_flight.find(m->get_tid());
+    assert(p != in_flight.end());
+    rtt.add(now - p->second);
+    in_flight.erase(p);
+    cond.Signal();
+    lock.Unlock();
+
+    msgs_done.inc();
+    bytes_done.add(m->get_data().length());
+    m->put();
+    return true;
+  }
+  bool ms_handle_reset(Connection *con) { return false; }
+  void ms_handle_remote_reset(Connection *con) {}
+
+  void *entry() {
+    lock.Lock();
+    for (int i = 0; i < num; i++) {
+      while ((int)in_flight.size() >= window)
+	cond.Wait(lock);
+      MPing *m = new MPing;
+      m->set_tid(i + 1);
+      m->set_priority(prios[i % prios.size()]);
+      if (data.length())
+	m->set_data(data);
+      in_flight[i + 1] = ceph_clock_now(cct);
+      lock.Unlock();
+      msgr->send_message(m, servers[i % servers.size()]);
+      msgs_done.inc();
+      bytes_done.add(data.length());
+      lock.Lock();
+    }
+    while (!in_flight.empty())
+      cond.Wait(lock);
+    lock.Unlock();
+    return 0;
+  }
+};
+
+static double cpu_seconds()
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+    (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+}
+
+static void usage()
+{
+  cout << "usage: bench_msgr [--servers N] [--clients N] [--num N] [--window N]\n"
+       << "                  [--size BYTES] [--reply-size BYTES] [--prio P[,P...]]\n"
+       << "                  [--batch]" << std::endl;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  int num_servers = 1, num_clients = 1;
+  int num = 100000, window = 16;
+  unsigned size = 4096, reply_size = 0;
+  vector<int> prios;
+  bool batch = false;
+  std::string val;
+  for (std::vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_witharg(args, i, &val, "--servers", (char*)NULL)) {
+      num_servers = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--clients", (char*)NULL)) {
+      num_clients = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--num", (char*)NULL)) {
+      num = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--window", (char*)NULL)) {
+      window = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--size", (char*)NULL)) {
+      size = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--reply-size", (char*)NULL)) {
+      reply_size = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--prio", (char*)NULL)) {
+      const char *p = val.c_str();
+      while (*p) {
+	char *end;
+	prios.push_back(strtol(p, &end, 10));
+	p = *end ? end + 1 : end;
+      }
+    } else if (ceph_argparse_flag(args, i, "--batch", (char*)NULL)) {
+      batch = true;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (num_servers < 1 || num_clients < 1 || num < 1 || window < 1) {
+    usage();
+    return 1;
+  }
+  if (prios.empty())
+    prios.push_back(CEPH_MSG_PRIO_DEFAULT);
+
+  entity_addr_t bind_addr;
+  bind_addr.parse("127.0.0.1:0");
+
+  vector<Messenger*> msgrs;
+  vector<Dispatcher*> dispatchers;
+  vector<entity_inst_t> server_insts;
+  for (int i = 0; i < num_servers; i++) {
+    Messenger *m = Messenger::create(g_ceph_context, entity_name_t::OSD(i),
+				     "server", getpid() + i);
+    Messenger::Policy p = Messenger::Policy::stateless_server(0, 0);
+    p.batch = batch;
+    m->set_default_policy(p);
+    if (m->bind(bind_addr) < 0) {
+      cerr << "failed to bind server " << i << std::endl;
+      return 1;
+    }
+    BenchServer *s = new BenchServer(g_ceph_context, m, reply_size);
+    m->add_dispatcher_head(s);
+    m->start();
+    msgrs.push_back(m);
+    dispatchers.push_back(s);
+    server_insts.push_back(m->get_myinst());
+  }
+
+  vector<BenchClient*> clients;
+  for (int i = 0; i < num_clients; i++) {
+    Messenger *m = Messenger::create(g_ceph_context, entity_name_t::CLIENT(i),
+				     "client", getpid() + num_servers + i);
+    Messenger::Policy p = Messenger::Policy::lossless_client(0, 0);
+    p.batch = batch;
+    m->set_default_policy(p);
+    BenchClient *c = new BenchClient(g_ceph_context, m, server_insts, prios,
+				     num, window, size);
+    m->add_dispatcher_head(c);
+    m->start();
+    msgrs.push_back(m);
+    dispatchers.push_back(c);
+    clients.push_back(c);
+  }
+
+  double cpu_start = cpu_seconds();
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (vector<BenchClient*>::iterator p = clients.begin(); p != clients.end(); ++p)
+    (*p)->create();
+  for (vector<BenchClient*>::iterator p = clients.begin(); p != clients.end(); ++p)
+    (*p)->join();
+  double dur = ceph_clock_now(g_ceph_context) - start;
+  double cpu = cpu_seconds() - cpu_start;
+
+  uint64_t msgs = msgs_done.read();
+  uint64_t bytes = bytes_done.read();
+  cout << num_clients << " clients -> " << num_servers << " servers, "
+       << num << " x " << size << " byte msgs per client, window " << window
+       << ", reply " << reply_size << " bytes" << std::endl;
+  cout << msgs << " msgs in " << dur << " s: "
+       << (double)msgs / dur << " msgs/s, "
+       << (double)bytes / dur / (1024.0 * 1024.0) << " MB/s" << std::endl;
+  cout << "round trip: p50 " << rtt.get_percentile(50) << " us, p99 "
+       << rtt.get_percentile(99) << " us" << std::endl;
+  cout << "cpu: " << cpu << " s, " << cpu * 1000000.0 / (double)msgs
+       << " us/msg" << std::endl;
+
+  for (vector<Messenger*>::iterator p = msgrs.begin(); p != msgrs.end(); ++p)
+    (*p)->shutdown();
+  for (vector<Messenger*>::iterator p = msgrs.begin(); p != msgrs.end(); ++p) {
+    (*p)->wait();
+    delete *p;
+  }
+  for (vector<Dispatcher*>::iterator p = dispatchers.begin(); p != dispatchers.end(); ++p)
+    delete *p;
+  return 0;
+}
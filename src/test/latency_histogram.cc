@@ -0,0 +1,33 @@
+#include "gtest/gtest.h"
+
+#include "common/LatencyHistogram.h"
+
+TEST(LatencyHistogram, Buckets)
+{
+  ASSERT_EQ(0, LatencyHistogram::bucket_for(0));
+  ASSERT_EQ(1, LatencyHistogram::bucket_for(1));
+  ASSERT_EQ(2, LatencyHistogram::bucket_for(2));
+  ASSERT_EQ(2, LatencyHistogram::bucket_for(3));
+  ASSERT_EQ(11, LatencyHistogram::bucket_for(1024));
+  ASSERT_EQ(LatencyHistogram::NUM_BUCKETS - 1,
+	    LatencyHistogram::bucket_for(-1ull));
+}
+
+TEST(LatencyHistogram, Percentile)
+{
+  LatencyHistogram h;
+  ASSERT_EQ(0u, h.get_count());
+  ASSERT_EQ(0u, h.get_percentile(50));
+
+  for (int i = 0; i < 98; i++)
+    h.add_usec(100);          // bucket [64, 128)
+  h.add(utime_t(0, 5000000)); // 5ms, bucket [4096, 8192)
+  h.add(utime_t(1, 0));       // 1s
+  ASSERT_EQ(100u, h.get_count());
+  ASSERT_EQ(128u, h.get_percentile(50));
+  ASSERT_EQ(8192u, h.get_percentile(98.5));
+  ASSERT_EQ(1048576u, h.get_percentile(100));
+
+  h.reset();
+  ASSERT_EQ(0u, h.get_count());
+}
@@ -0,0 +1,158 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "gtest/gtest.h"
+#include "osd/OSDMap.h"
+#include "common/ceph_context.h"
+#include "common/code_environment.h"
+
+static const int num_osds = 8;
+
+class OSDMapTest : public ::testing::Test {
+public:
+  CephContext *cct;
+  OSDMap plain, precomputed;
+
+  virtual void SetUp() {
+    cct = new CephContext(CODE_ENVIRONMENT_UTILITY);
+    uuid_d fsid;
+    plain.build_simple(cct, 1, fsid, num_osds, 4, 4);
+    OSDMap::Incremental inc(2);
+    inc.fsid = fsid;
+    for (int i = 0; i < num_osds; i++) {
+      inc.new_up_client[i] = entity_addr_t();
+      inc.new_weight[i] = CEPH_OSD_IN;
+    }
+    plain.apply_incremental(inc);
+
+    bufferlist bl;
+    plain.encode(bl);
+    precomputed.decode(bl);
+    precomputed.build_pg_mappings();
+  }
+  virtual void TearDown() {
+    cct->put();
+  }
+
+  OSDMap::Incremental next_inc() {
+    OSDMap::Incremental inc(plain.get_epoch() + 1);
+    inc.fsid = plain.get_fsid();
+    return inc;
+  }
+
+  void apply(OSDMap::Incremental& inc) {
+    ASSERT_EQ(0, plain.apply_incremental(inc));
+    ASSERT_EQ(0, precomputed.apply_incremental(inc));
+  }
+
+  void check_same() {
+    const map<int64_t,pg_pool_t>& pools = plain.get_pools();
+    for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
+	 p != pools.end();
+	 ++p) {
+      // include raw pgs beyond pg_num, as the objecter passes them
+      for (unsigned ps = 0; ps < 2 * p->second.get_pg_num(); ps++) {
+	pg_t pgid(ps, p->first, -1);
+	vector<int> up1, acting1, up2, acting2;
+	plain.pg_to_up_acting_osds(pgid, up1, acting1);
+	precomputed.pg_to_up_acting_osds(pgid, up2, acting2);
+	ASSERT_TRUE(up1 == up2) << pgid;
+	ASSERT_TRUE(acting1 == acting2) << pgid;
+	ASSERT_FALSE(up1.empty()) << pgid;
+      }
+    }
+  }
+};
+
+TEST_F(OSDMapTest, Build) {
+  ASSERT_TRUE(precomputed.have_pg_mappings());
+  ASSERT_FALSE(plain.have_pg_mappings());
+  check_same();
+}
+
+TEST_F(OSDMapTest, Reweight) {
+  OSDMap::Incremental inc = next_inc();
+  inc.new_weight[3] = CEPH_OSD_OUT;
+  inc.new_weight[5] = CEPH_OSD_IN / 2;
+  apply(inc);
+  check_same();
+
+  OSDMap::Incremental inc2 = next_inc();
+  inc2.new_weight[3] = CEPH_OSD_IN;
+  apply(inc2);
+  check_same();
+}
+
+TEST_F(OSDMapTest, ReweightDownInSteps) {
+  // each step only redoes the rows osd.2 is in
+  unsigned w[] = { CEPH_OSD_IN * 3 / 4, CEPH_OSD_IN / 4, CEPH_OSD_OUT };
+  for (unsigned i = 0; i < sizeof(w) / sizeof(w[0]); i++) {
+    OSDMap::Incremental inc = next_inc();
+    inc.new_weight[2] = w[i];
+    apply(inc);
+    check_same();
+  }
+}
+
+TEST_F(OSDMapTest, DownAndTemp) {
+  OSDMap::Incremental inc = next_inc();
+  inc.new_state[2] = CEPH_OSD_UP;
+  vector<int> temp;
+  temp.push_back(6);
+  temp.push_back(7);
+  inc.new_pg_temp[pg_t(1, 0, -1)] = temp;
+  apply(inc);
+  check_same();
+}
+
+TEST_F(OSDMapTest, PoolChange) {
+  OSDMap::Incremental inc = next_inc();
+  pg_pool_t pool = *plain.get_pg_pool(0);
+  pool.set_pgp_num(pool.get_pgp_num() / 2);
+  pool.size = 3;
+  inc.new_pools[0] = pool;
+  apply(inc);
+  check_same();
+}
+
+TEST_F(OSDMapTest, FullMap) {
+  OSDMap::Incremental inc = next_inc();
+  OSDMap other;
+  bufferlist bl;
+  plain.encode(bl);
+  other.decode(bl);
+  other.inc_epoch();
+  other.set_weight(1, CEPH_OSD_OUT);
+  other.encode(inc.fullmap);
+  apply(inc);
+  ASSERT_TRUE(precomputed.have_pg_mappings());
+  check_same();
+}
+
+TEST_F(OSDMapTest, DeepishCopy) {
+  OSDMap copy;
+  copy.deepish_copy_from(plain);
+  OSDMap::Incremental inc = next_inc();
+  vector<int> temp;
+  temp.push_back(4);
+  inc.new_pg_temp[pg_t(0, 1, -1)] = temp;
+  ASSERT_EQ(0, copy.apply_incremental(inc));
+
+  vector<int> acting;
+  plain.pg_to_acting_osds(pg_t(0, 1, -1), acting);
+  ASSERT_TRUE(acting != temp);
+  copy.pg_to_acting_osds(pg_t(0, 1, -1), acting);
+  ASSERT_TRUE(acting == temp);
+  ASSERT_EQ(plain.get_epoch() + 1, copy.get_epoch());
+}
@@ -122,3 +122,94 @@ TEST(pg_t, split)
   ASSERT_TRUE(s.count(pg_t(7, 0, -1)));
 
 }
+
+TEST(pg_stat_delta_t, build_apply)
+{
+  list<pg_stat_t*> l;
+  pg_stat_t::generate_test_instances(l);
+  pg_stat_t base = *l.back();
+
+  // writes: versions, stamps, log and object counts move
+  pg_stat_t cur = base;
+  cur.version = eversion_t(1, 10);
+  cur.reported = eversion_t(1, 11);
+  cur.last_fresh = utime_t(2000, 0);
+  cur.last_active = utime_t(2000, 0);
+  cur.log_size += 7;
+  cur.stats.sum.num_objects += 3;
+  cur.stats.sum.num_bytes += 12288;
+  cur.stats.sum.num_wr += 3;
+
+  pg_stat_delta_t d;
+  ASSERT_TRUE(d.build(base, cur));
+  ASSERT_EQ(base.reported, d.base_reported);
+
+  bufferlist bl;
+  ::encode(d, bl);
+  bufferlist::iterator p = bl.begin();
+  pg_stat_delta_t d2;
+  ::decode(d2, p);
+
+  pg_stat_t rebuilt = base;
+  d2.apply(rebuilt);
+  bufferlist a, b;
+  ::encode(rebuilt, a);
+  ::encode(cur, b);
+  ASSERT_TRUE(a.contents_equal(b));
+
+  // an idle pg's delta carries no object stats
+  pg_stat_t idle = base;
+  idle.reported = eversion_t(1, 12);
+  ASSERT_TRUE(d.build(base, idle));
+  ASSERT_TRUE(d.sum.is_zero());
+
+  // anything else changing needs the full stats
+  pg_stat_t changed = cur;
+  changed.state = base.state + 1;
+  ASSERT_FALSE(d.build(base, changed));
+  changed = cur;
+  changed.acting.push_back(7);
+  ASSERT_FALSE(d.build(base, changed));
+
+  for (list<pg_stat_t*>::iterator i = l.begin(); i != l.end(); ++i)
+    delete *i;
+}
+
+TEST(pg_missing_t, can_apply_delta)
+{
+  hobject_t oid(object_t("foo"), "", CEPH_NOSNAP, 123, 0);
+  hobject_t other(object_t("bar"), "", CEPH_NOSNAP, 456, 0);
+  pg_missing_t missing;
+  missing.add(oid, eversion_t(10, 5), eversion_t(10, 3));
+
+  ASSERT_TRUE(missing.can_apply_delta(oid, eversion_t(10, 3)));
+
+  // the primary thought we had some other version
+  ASSERT_FALSE(missing.can_apply_delta(oid, eversion_t(10, 2)));
+  ASSERT_FALSE(missing.can_apply_delta(oid, eversion_t(9, 3)));
+  // or that we had an object we're not missing at all
+  ASSERT_FALSE(missing.can_apply_delta(other, eversion_t(10, 3)));
+  // not a delta push
+  ASSERT_FALSE(missing.can_apply_delta(oid, eversion_t()));
+
+  // once a push has started our old copy is gone
+  missing.revise_have(oid, eversion_t());
+  ASSERT_FALSE(missing.can_apply_delta(oid, eversion_t(10, 3)));
+}
+
+TEST(pg_log_entry_t, readable_on_replica)
+{
+  pg_log_entry_t e(pg_log_entry_t::MODIFY, hobject_t(), eversion_t(10, 5),
+		   eversion_t(10, 4), osd_reqid_t(), utime_t());
+
+  // committed everywhere and applied here
+  ASSERT_TRUE(e.readable_on_replica(eversion_t(10, 5), eversion_t(10, 5)));
+  ASSERT_TRUE(e.readable_on_replica(eversion_t(10, 7), eversion_t(10, 6)));
+
+  // still in flight
+  ASSERT_FALSE(e.readable_on_replica(eversion_t(10, 4), eversion_t(10, 5)));
+
+  // committed (journaled) everywhere, but not yet applied to our store
+  ASSERT_FALSE(e.readable_on_replica(eversion_t(10, 5), eversion_t(10, 4)));
+  ASSERT_FALSE(e.readable_on_replica(eversion_t(10, 9), eversion_t()));
+}
@@ -0,0 +1,127 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2012 Inktank, Inc.
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "gtest/gtest.h"
+#include "common/TimerWheel.h"
+#include "common/Clock.h"
+#include "common/ceph_context.h"
+#include "common/code_environment.h"
+#include "include/Context.h"
+
+#include <unistd.h>
+
+struct C_Fired : public Context {
+  CephContext *cct;
+  utime_t deadline;
+  int *fired;
+  bool *early;
+  C_Fired(CephContext *c, utime_t d, int *f, bool *e)
+    : cct(c), deadline(d), fired(f), early(e) {}
+  void finish(int r) {
+    if (ceph_clock_now(cct) < deadline)
+      *early = true;
+    (*fired)++;
+  }
+};
+
+class TimerWheelTest : public ::testing::Test {
+public:
+  CephContext *cct;
+  Mutex lock;
+  TimerWheel *wheel;
+  int fired;
+  bool early;
+
+  TimerWheelTest() : lock("TimerWheelTest::lock"), fired(0), early(false) {}
+
+  virtual void SetUp() {
+    cct = new CephContext(CODE_ENVIRONMENT_UTILITY);
+    // a small wheel, so deadlines take several laps
+    wheel = new TimerWheel(cct, lock, .01, 4);
+    wheel->init();
+  }
+  virtual void TearDown() {
+    lock.Lock();
+    wheel->shutdown();
+    lock.Unlock();
+    delete wheel;
+    cct->put();
+  }
+
+  Context *add(double after) {
+    utime_t when = ceph_clock_now(cct);
+    when += after;
+    Context *c = new C_Fired(cct, when, &fired, &early);
+    wheel->add_event_at(when, c);
+    return c;
+  }
+};
+
+TEST_F(TimerWheelTest, Fire) {
+  lock.Lock();
+  for (int i = 0; i < 10; i++)
+    add(.005 * i);
+  add(.1);  // 2.5 laps out
+  ASSERT_EQ(11u, wheel->get_num_events());
+  lock.Unlock();
+
+  usleep(300000);
+
+  lock.Lock();
+  ASSERT_EQ(11, fired);
+  ASSERT_FALSE(early);
+  ASSERT_EQ(0u, wheel->get_num_events());
+  lock.Unlock();
+}
+
+TEST_F(TimerWheelTest, Cancel) {
+  lock.Lock();
+  Context *a = add(.05);
+  Context *b = add(.05);
+  add(.05);
+  ASSERT_TRUE(wheel->cancel_event(a));
+  ASSERT_TRUE(wheel->cancel_event(b));
+  ASSERT_EQ(1u, wheel->get_num_events());
+  lock.Unlock();
+
+  usleep(200000);
+
+  lock.Lock();
+  ASSERT_EQ(1, fired);
+  ASSERT_FALSE(early);
+  lock.Unlock();
+}
+
+TEST_F(TimerWheelTest, CancelAll) {
+  lock.Lock();
+  for (int i = 0; i < 100; i++)
+    add(.02 + .001 * i);
+  wheel->cancel_all_events();
+  ASSERT_EQ(0u, wheel->get_num_events());
+  lock.Unlock();
+
+  usleep(200000);
+
+  lock.Lock();
+  ASSERT_EQ(0, fired);
+  // still usable afterwards
+  add(0);
+  lock.Unlock();
+
+  usleep(100000);
+
+  lock.Lock();
+  ASSERT_EQ(1, fired);
+  lock.Unlock();
+}